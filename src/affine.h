@@ -1,4 +1,22 @@
 #pragma once
 
+#include "batch_iterate_map.h"
+#include "bit_scan.h"
+#include "bitmap_storage.h"
+#include "checkpoint.h"
+#include "descent_certificate.h"
+#include "dynamic_iterate_map.h"
+#include "export.h"
 #include "map_def.h"
 #include "iterate_map.h"
+#include "out_of_core_iterate_map.h"
+#include "popcount.h"
+#include "progress.h"
+#include "provenance.h"
+#include "rank_select.h"
+#include "residue_stats.h"
+#include "scheduler.h"
+#include "semiring_iterate_map.h"
+#include "sparse_iterate_map.h"
+#include "streaming.h"
+#include "vectorized_iterate_map.h"
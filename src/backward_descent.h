@@ -0,0 +1,184 @@
+/**
+ * Reachability of values beyond a computed bitmap, by descending through their predecessors into it.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+#include "map_def.h"
+
+namespace Affine {
+    namespace Descent {
+        // Largest value that can be queried, so that no arithmetic on it can overflow
+        constexpr int64_t MAX_VALUE = int64_t{1} << 62;
+
+        // Shards of the memo, each with its own lock
+        constexpr int CACHE_SHARDS = 64;
+
+        // A shard is emptied when it grows past this many values
+        constexpr std::size_t MAX_SHARD_ENTRIES = 1 << 20;
+
+        // Largest lcm of the linear coefficients for which the divisibility tests are tabulated
+        constexpr int64_t MAX_RESIDUE_TABLE = 1 << 16;
+    }
+
+    /**
+     * n > 2 is reachable iff it is an initial value or (n - b) / a is reachable for some map ax+b with a | n - b;
+     * every such predecessor is at most n / 2 + 1 (as a >= 2 and b >= -a), so a descent from any n reaches the
+     * computed bitmap in at most about log2(n) steps. Ancestors of an unreachable value are all unreachable, so
+     * disproving n only visits (a few of) the sparse unreachable values above the bitmap, and proving it usually
+     * follows a single chain.
+     *
+     * Which maps have a predecessor depends only on n mod the lcm of the linear coefficients, so these tests are
+     * looked up in a table of map masks when the lcm is small. Every value above the bitmap that the descent
+     * decides is memoized, shared by all queries and threads; the answers only depend on the maps and the initial
+     * values, so the memo survives the bitmap growing.
+     */
+    template <AffineMapSet Maps>
+        class BackwardDescent {
+            static constexpr auto coeffs = Maps.get_coeffs();
+            static constexpr std::size_t map_count = coeffs.size();
+
+            struct Shard {
+                std::mutex mutex;
+                std::unordered_map<int64_t, bool> values;
+            };
+
+            std::unique_ptr<Shard[]> shards = std::make_unique<Shard[]>(Descent::CACHE_SHARDS);
+
+            // Initial values the memo was filled for, sorted
+            std::vector<int64_t> initial;
+
+            // Bit i of predecessor_masks[r] is set if map i has a predecessor for every n = r mod modulus
+            int64_t modulus = 1;
+            std::vector<uint64_t> predecessor_masks;
+
+            static constexpr bool can_tabulate() {
+                int64_t l = 1;
+                for (auto [a, b] : coeffs) {
+                    l = std::lcm(l, (int64_t)a);
+                    if (l > Descent::MAX_RESIDUE_TABLE) return false;
+                }
+
+                return map_count <= 64;
+            }
+
+            uint64_t predecessor_mask(int64_t n) const {
+                if constexpr (can_tabulate()) {
+                    return predecessor_masks[n % modulus];
+                } else {
+                    uint64_t mask = 0;
+                    for (std::size_t i = 0; i < map_count; ++i) {
+                        if ((n - coeffs[i].second) % coeffs[i].first == 0) mask |= uint64_t{1} << i;
+                    }
+
+                    return mask;
+                }
+            }
+
+            Shard& shard(int64_t n) const {
+                return shards[(uint64_t)(n * 0x9E3779B97F4A7C15ULL) >> 58];
+            }
+
+            template <typename Table>
+                bool search(int64_t n, int64_t max_reached, Table& table) {
+                    if (n <= max_reached) return table(n);
+                    if (std::binary_search(initial.begin(), initial.end(), n)) return true;
+
+                    Shard& s = shard(n);
+                    {
+                        std::lock_guard lock{s.mutex};
+                        if (auto it = s.values.find(n); it != s.values.end()) return it->second;
+                    }
+
+                    uint64_t mask = predecessor_mask(n);
+                    std::array<int64_t, map_count> preds;
+                    int count = 0;
+
+                    for (std::size_t i = 0; i < map_count; ++i) {
+                        if ((mask >> i) & 1) {
+                            int64_t k = (n - coeffs[i].second) / coeffs[i].first;
+                            if (k >= 0) preds[count++] = k;
+                        }
+                    }
+
+                    // Predecessors in the bitmap cost one lookup, so they are all tried before descending
+                    bool reachable = std::any_of(preds.begin(), preds.begin() + count, [&] (int64_t k) {
+                        return k <= max_reached && table(k);
+                    }) || std::any_of(preds.begin(), preds.begin() + count, [&] (int64_t k) {
+                        return k > max_reached && search(k, max_reached, table);
+                    });
+
+                    std::lock_guard lock{s.mutex};
+                    if (s.values.size() >= Descent::MAX_SHARD_ENTRIES) s.values.clear();
+                    s.values.emplace(n, reachable);
+
+                    return reachable;
+                }
+        public:
+            BackwardDescent() {
+                if constexpr (can_tabulate()) {
+                    for (auto [a, b] : coeffs) modulus = std::lcm(modulus, (int64_t)a);
+
+                    predecessor_masks.resize(modulus);
+                    for (int64_t r = 0; r < modulus; ++r) {
+                        for (std::size_t i = 0; i < map_count; ++i) {
+                            int64_t a = coeffs[i].first, b = coeffs[i].second;
+                            if (((r - b) % a + a) % a == 0) predecessor_masks[r] |= uint64_t{1} << i;
+                        }
+                    }
+                }
+            }
+
+            /**
+             * Start over if the initial values differ from those the memo was filled for
+             */
+            void set_initial(std::vector<int64_t> values) {
+                std::sort(values.begin(), values.end());
+                if (values == initial) return;
+
+                initial = std::move(values);
+                clear();
+            }
+
+            /**
+             * Forget all memoized values
+             */
+            void clear() {
+                for (int i = 0; i < Descent::CACHE_SHARDS; ++i) {
+                    std::lock_guard lock{shards[i].mutex};
+                    shards[i].values.clear();
+                }
+            }
+
+            /**
+             * Number of memoized values
+             */
+            std::size_t cache_size() const {
+                std::size_t size = 0;
+                for (int i = 0; i < Descent::CACHE_SHARDS; ++i) {
+                    std::lock_guard lock{shards[i].mutex};
+                    size += shards[i].values.size();
+                }
+
+                return size;
+            }
+
+            /**
+             * Whether n is reachable, where table(k) gives the reachability of every k in [0, max_reached] and
+             * max_reached >= 2. Safe to call from several threads at once.
+             */
+            template <typename Table>
+                bool is_reachable(int64_t n, int64_t max_reached, Table table) {
+                    return search(n, max_reached, table);
+                }
+        };
+}
@@ -0,0 +1,352 @@
+/**
+ * Bit-sliced engine evaluating many configurations (seed sets and subsets of one map set) in a single pass.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bitmap_storage.h"
+#include "iterate_map.h"
+#include "map_def.h"
+#include "progress.h"
+#include "scheduler.h"
+
+namespace Affine {
+    namespace Batch {
+        // Transpose a 64x64 bit matrix in place, mirrored: bit c of row r ends up as bit 63 - r of row 63 - c
+        inline void transpose64(uint64_t a[64]) {
+            uint64_t m = 0x00000000FFFFFFFFULL;
+
+            for (int j = 32; j != 0; j >>= 1, m ^= m << j) {
+                for (int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+                    uint64_t t = (a[k] ^ (a[k | j] >> j)) & m;
+                    a[k] ^= t;
+                    a[k | j] ^= t << j;
+                }
+            }
+        }
+
+        // Integers per block handed out by the scheduler when computing with threads
+        constexpr int64_t BLOCK_ENTRIES = 1 << 16;
+
+        // Entries computed by a fixpoint, since their sources may come after them (e.g. 2x-2 maps 1 to 0)
+        constexpr int64_t PREFIX_ENTRIES = 64;
+    }
+
+    /**
+     * Up to 64 * lane_words configurations computed together. Every configuration has its own initial values and
+     * uses a subset of the maps of Maps, so variants sharing the same linear coefficients are expressed by putting
+     * all their maps into Maps. Each integer holds lane_words words with one bit per configuration, and the
+     * propagation from the source integer of each map is done once for all lanes with word-wide ANDs and ORs; with
+     * lane_words = 4 the compiler turns these into AVX2 operations.
+     *
+     * Memory is 8 * lane_words bytes per integer, the same as that many separate bitmaps, but every integer and
+     * source index is visited once instead of once per configuration.
+     */
+    template <AffineMapSet Maps, int lane_words=1, int64_t max_entry=_DEFAULT_MAX_ENTRY>
+        class BatchIterateMap {
+        public:
+            static constexpr int LANES = 64 * lane_words;
+
+        private:
+            static constexpr auto coeffs = Maps.get_coeffs();
+            static constexpr std::size_t map_count = coeffs.size();
+
+            static_assert(lane_words >= 1, "At least one lane word is required");
+
+            struct Configuration {
+                std::vector<int64_t> initial_values;
+                std::array<bool, map_count> maps;
+            };
+
+            std::vector<Configuration> configurations;
+
+            // Lanes of the configurations using map i
+            std::array<std::array<uint64_t, lane_words>, map_count> map_masks{};
+
+            int64_t _max_reached = -1;
+
+            BitmapStorage lanes;
+
+            // Meter of the running computation, if progress is being reported
+            ProgressMeter* _progress = nullptr;
+
+            uint64_t* entry(int64_t n) {
+                return lanes.data() + n * lane_words;
+            }
+
+            const uint64_t* entry(int64_t n) const {
+                return lanes.data() + n * lane_words;
+            }
+
+            static constexpr int64_t floor_div(int64_t x, int64_t y) {
+                return (x >= 0) ? x / y : -((-x + y - 1) / y);
+            }
+
+            // Largest source integer read when computing the integers up to n
+            static constexpr int64_t last_source(int64_t n) {
+                int64_t s = -1;
+                for (auto [a, b] : coeffs) s = std::max(s, floor_div(n - b, a));
+                return s;
+            }
+
+            // Compute the integers [n0, n1) by pulling from the source of each map. The source index and residue of
+            // each map are stepped along with n, so the inner loop has no divisions.
+            void compute_range(int64_t n0, int64_t n1, int slot = 0) {
+                std::array<int64_t, map_count> k, r;
+
+                for (std::size_t i = 0; i < map_count; ++i) {
+                    k[i] = floor_div(n0 - coeffs[i].second, coeffs[i].first);
+                    r[i] = (n0 - coeffs[i].second) - k[i] * coeffs[i].first;
+                }
+
+                for (int64_t n = n0; n < n1; ++n) {
+                    uint64_t acc[lane_words];
+                    std::memcpy(acc, entry(n), sizeof(acc));
+
+                    [&]<std::size_t... I>(std::index_sequence<I...>) {
+                        ([&] {
+                            if (r[I] == 0 && k[I] >= 0) {
+                                const uint64_t* src = entry(k[I]);
+                                for (int j = 0; j < lane_words; ++j) acc[j] |= src[j] & map_masks[I][j];
+                            }
+
+                            if (++r[I] == coeffs[I].first) {
+                                r[I] = 0;
+                                ++k[I];
+                            }
+                        }(), ...);
+                    }(std::make_index_sequence<map_count>{});
+
+                    std::memcpy(entry(n), acc, sizeof(acc));
+                }
+
+                if (_progress) _progress->add(slot, n1 - n0);
+            }
+
+            void compute_prefix() {
+                std::vector<uint64_t> before;
+
+                do {
+                    before.assign(entry(0), entry(Batch::PREFIX_ENTRIES));
+                    compute_range(0, Batch::PREFIX_ENTRIES);
+                } while (!std::equal(before.begin(), before.end(), entry(0)));
+            }
+
+            void compute_range_parallel(int64_t n0, int64_t n1, int thread_count) {
+                constexpr int64_t B = Batch::BLOCK_ENTRIES;
+
+                // Blocks from here on only read integers before their own start
+                int64_t start = (n0 + B - 1) / B * B;
+                while (last_source(start + B - 1) >= start) start += B;
+
+                if (start >= n1) {
+                    compute_range(n0, n1);
+                    return;
+                }
+
+                compute_range(n0, start);
+
+                auto block_end = [&] (int64_t b) {
+                    return std::min(start + (b + 1) * B, n1);
+                };
+
+                WatermarkScheduler scheduler{(n1 - start + B - 1) / B};
+                scheduler.run(ThreadPool::shared(), thread_count, [&] (int64_t b) -> int64_t {
+                    int64_t last = last_source(block_end(b) - 1);
+                    return (last < start) ? 0 : (last - start) / B + 1;
+                }, [&] (int64_t b, int slot) {
+                    compute_range(start + b * B, block_end(b), slot);
+                });
+            }
+        public:
+            // Only reserves address space; memory is committed as compute_till advances
+            BatchIterateMap() : lanes(max_entry * lane_words) {
+
+            }
+
+            /**
+             * Number of configurations added so far
+             */
+            int size() const {
+                return configurations.size();
+            }
+
+            int64_t max_reached() const {
+                return _max_reached;
+            }
+
+            /**
+             * Add a configuration iterating the maps of Maps with the given indices (all of them by default) from
+             * the given initial values. Returns its lane.
+             */
+            int add_configuration(std::initializer_list<int64_t> initial, std::vector<int> maps={}) {
+                if (_max_reached >= 0) {
+                    throw std::runtime_error("Configurations must be added before computing (call clear_data first)");
+                }
+
+                if (size() >= LANES) {
+                    throw std::runtime_error("Batch is full (" + std::to_string(LANES) + " configurations)");
+                }
+
+                Configuration c{ {}, {} };
+
+                for (int64_t i : initial) {
+                    if (i < 0 || i >= max_entry) {
+                        throw std::runtime_error{"Invalid initial value " + std::to_string(i)};
+                    }
+
+                    c.initial_values.push_back(i);
+                }
+
+                if (maps.empty()) {
+                    c.maps.fill(true);
+                }
+
+                for (int i : maps) {
+                    if (i < 0 || i >= (int)map_count) {
+                        throw std::runtime_error("Invalid map index " + std::to_string(i));
+                    }
+
+                    c.maps[i] = true;
+                }
+
+                int lane = size();
+                for (std::size_t i = 0; i < map_count; ++i) {
+                    if (c.maps[i]) map_masks[i][lane / 64] |= uint64_t{1} << (lane % 64);
+                }
+
+                configurations.push_back(std::move(c));
+                return lane;
+            }
+
+            /**
+             * Add a configuration using the maps of Variant, which must all appear in Maps
+             */
+            template <AffineMapSet Variant>
+                int add_configuration(std::initializer_list<int64_t> initial) {
+                    std::vector<int> maps;
+
+                    for (auto pair : Variant.get_coeffs()) {
+                        auto it = std::find(coeffs.begin(), coeffs.end(), pair);
+                        if (it == coeffs.end()) {
+                            throw std::runtime_error("Map " + std::to_string(pair.first) + "x+"
+                                    + std::to_string(pair.second) + " is not part of the batch's map set");
+                        }
+
+                        maps.push_back(it - coeffs.begin());
+                    }
+
+                    return add_configuration(initial, maps);
+                }
+
+            void compute_till(const IterateMapOpts& opts) {
+                int64_t max = (opts.max < 0) ? max_entry - 1 : opts.max;
+
+                if (max <= _max_reached) {
+                    return;
+                }
+
+                if (max >= max_entry) {
+                    throw std::runtime_error("Max entry exceeded (max=" + std::to_string(max) +")");
+                }
+
+                int64_t n = _max_reached + 1;
+                lanes.ensure(std::max(max + 1, Batch::PREFIX_ENTRIES) * lane_words);
+
+                if (_max_reached == -1) {
+                    for (int lane = 0; lane < size(); ++lane) {
+                        for (int64_t i : configurations[lane].initial_values) {
+                            lanes.ensure((i + 1) * lane_words);
+                            entry(i)[lane / 64] |= uint64_t{1} << (lane % 64);
+                        }
+                    }
+
+                    compute_prefix();
+                    n = Batch::PREFIX_ENTRIES;
+                }
+
+                int thread_count = opts.use_threads ? opts.num_threads : 1;
+                ProgressScope progress{_progress, opts.progress_reporter(), (double)opts.callback_frequency,
+                        max + 1 - n, thread_count};
+
+                if (thread_count > 1 && max + 1 - n >= 16 * Batch::BLOCK_ENTRIES) {
+                    compute_range_parallel(n, max + 1, thread_count);
+                } else {
+                    for (; n <= max; n += Batch::BLOCK_ENTRIES) {
+                        compute_range(n, std::min(max + 1, n + Batch::BLOCK_ENTRIES));
+                    }
+                }
+
+                _max_reached = max;
+                progress.finish();
+            }
+
+            void clear_data() {
+                lanes.reset();
+                _max_reached = -1;
+            }
+
+            /**
+             * Whether i is reachable in the configuration of the given lane (unchecked)
+             */
+            bool is_reachable(int lane, int64_t i) const {
+                return (entry(i)[lane / 64] >> (lane % 64)) & 1;
+            }
+
+            /**
+             * Number of reachable values in [min, max] for every configuration, indexed by lane. Blocks of 64
+             * integers are transposed so that each configuration's bits can be counted a word at a time.
+             */
+            std::vector<int64_t> count_solutions(int64_t min=0, int64_t max=-1) const {
+                if (max == -1) max = _max_reached;
+                min = std::max(min, int64_t{0});
+
+                if (max < min || max > _max_reached) {
+                    throw std::runtime_error("Invalid bounds min=" + std::to_string(min)
+                            + ", max=" + std::to_string(max));
+                }
+
+                std::vector<int64_t> counts(LANES);
+                uint64_t block[64];
+
+                for (int64_t base = min & ~int64_t{63}; base <= max; base += 64) {
+                    for (int j = 0; j < lane_words; ++j) {
+                        for (int r = 0; r < 64; ++r) {
+                            int64_t n = base + r;
+                            block[r] = (n >= min && n <= max) ? entry(n)[j] : 0;
+                        }
+
+                        Batch::transpose64(block);
+                        for (int r = 0; r < 64; ++r) {
+                            counts[64 * j + 63 - r] += __builtin_popcountll(block[r]);
+                        }
+                    }
+                }
+
+                counts.resize(size());
+                return counts;
+            }
+
+            /**
+             * Bitmap of the configuration in the given lane over [0, max_reached()], in the engines' word layout
+             */
+            std::vector<uint64_t> bitmap(int lane) const {
+                std::vector<uint64_t> words((_max_reached + 64) / 64);
+
+                for (int64_t i = 0; i <= _max_reached; ++i) {
+                    words[i >> 6] |= uint64_t{is_reachable(lane, i)} << (i & 63);
+                }
+
+                return words;
+            }
+        };
+}
@@ -0,0 +1,254 @@
+// Benchmarks for the iterate map engines
+//
+// Usage: bench [--filter REGEX] [--sizes MIN-MAX] [--threads N] [--json FILE] [--file PATH]
+//
+// Every engine matching the filter is timed for compute (per doubling wave), count and iteration at 10^MIN ..
+// 10^MAX entries (default 6-9). Checksums are computed as in misc/m.cc and must agree between engines. The
+// out-of-core engine computes into PATH (default /tmp/affine_map_bench.bin), which is removed afterwards.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+#include "affine.h"
+
+using namespace Affine;
+
+AffineMapSet<
+    AffineMap<2, 1>,
+    AffineMap<3, 0>,
+    AffineMap<3, 2>,
+    AffineMap<3, 7>
+    > maps;
+
+// The per-bit engine is too slow to be worth running at the largest sizes
+constexpr int64_t STANDARD_MAX_SIZE = 1'000'000'000;
+
+// First doubling wave; compute_till is timed for [0, FIRST_WAVE) and then for every doubling after it
+constexpr int64_t FIRST_WAVE = 1 << 16;
+
+struct Wave {
+    int64_t end;
+    double seconds;
+};
+
+struct Result {
+    std::string engine;
+    int64_t size;
+    double compute_seconds;
+    double count_seconds;
+    double iterate_seconds;
+    int64_t count;
+    uint64_t checksum;
+    uint64_t checksum_100000;
+    std::vector<Wave> waves;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Checksum of misc/m.cc: s = s * word + 2 over the complete words below lim, starting from 1
+class Checksum {
+    uint64_t s = 1;
+    uint64_t word = 0;
+    int64_t lim;
+public:
+    explicit Checksum(int64_t lim) : lim(lim / 64 * 64) {
+
+    }
+
+    void add(int64_t i, bool reachable) {
+        if (i >= lim) return;
+
+        word |= uint64_t{reachable} << (i & 63);
+        if ((i & 63) == 63) {
+            s = s * word + 2;
+            word = 0;
+        }
+    }
+
+    uint64_t value() const {
+        return s;
+    }
+};
+
+template <typename Engine, typename... Args>
+Result run(const std::string& name, int64_t size, const ExecutionOpts& exec, Args... args) {
+    Result result{};
+    result.engine = name;
+    result.size = size;
+
+    auto m = std::make_unique<Engine>(args...);
+    m->set_initial({ 1 });
+
+    IterateMapOpts opts;
+    static_cast<ExecutionOpts&>(opts) = exec;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t end = std::min(FIRST_WAVE, size); ; end = std::min(2 * end, size)) {
+        auto wave_start = std::chrono::steady_clock::now();
+
+        opts.max = end - 1;
+        m->compute_till(opts);
+        result.waves.push_back({ end, seconds_since(wave_start) });
+
+        if (end == size) break;
+    }
+    result.compute_seconds = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    result.count = m->count_solutions(0, -1, exec);
+    result.count_seconds = seconds_since(start);
+
+    Checksum full{size}, reference{100'000};
+    start = std::chrono::steady_clock::now();
+    m->for_each_solution([&] (int64_t i, bool reachable) {
+        full.add(i, reachable);
+        reference.add(i, reachable);
+    });
+    result.iterate_seconds = seconds_since(start);
+
+    result.checksum = full.value();
+    result.checksum_100000 = reference.value();
+
+    return result;
+}
+
+void print(const Result& r) {
+    double gbits = r.size / r.compute_seconds / 1e9;
+    double ns_per_entry = r.compute_seconds * 1e9 / r.size;
+
+    printf("%-22s %14lld  compute %9.4f s  %8.3f Gbit/s  %8.4f ns/entry  count %8.4f s  iterate %8.3f s  "
+            "checksum %llu\n", r.engine.c_str(), (long long)r.size, r.compute_seconds, gbits, ns_per_entry,
+            r.count_seconds, r.iterate_seconds, (unsigned long long)r.checksum);
+
+    for (auto& w : r.waves) {
+        if (w.end > FIRST_WAVE) printf("    wave ..%-14lld %9.4f s\n", (long long)w.end, w.seconds);
+    }
+}
+
+void write_json(const char* filename, const std::vector<Result>& results) {
+    std::ofstream out{filename};
+    out.precision(9);
+
+    out << "[\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        auto& r = results[i];
+
+        out << "  { \"engine\": \"" << r.engine << "\", \"size\": " << r.size
+            << ", \"compute_seconds\": " << r.compute_seconds
+            << ", \"gbit_per_second\": " << r.size / r.compute_seconds / 1e9
+            << ", \"ns_per_entry\": " << r.compute_seconds * 1e9 / r.size
+            << ", \"count_seconds\": " << r.count_seconds
+            << ", \"iterate_seconds\": " << r.iterate_seconds
+            << ", \"count\": " << r.count
+            << ", \"checksum\": \"" << r.checksum << "\""
+            << ", \"checksum_100000\": \"" << r.checksum_100000 << "\""
+            << ", \"waves\": [";
+
+        for (std::size_t j = 0; j < r.waves.size(); ++j) {
+            out << (j ? ", " : "") << "{ \"end\": " << r.waves[j].end << ", \"seconds\": " << r.waves[j].seconds << " }";
+        }
+
+        out << "] }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+int main(int argc, char** argv) {
+    std::regex filter{""};
+    int min_exponent = 6, max_exponent = 9;
+    int threads = ThreadPool::shared().concurrency();
+    const char* json = nullptr;
+    std::string file = "/tmp/affine_map_bench.bin";
+
+    for (int i = 1; i < argc; ++i) {
+        auto arg = [&] {
+            if (i + 1 >= argc) throw std::runtime_error(std::string{"Missing value for "} + argv[i]);
+            return argv[++i];
+        };
+
+        if (!strcmp(argv[i], "--filter")) {
+            filter = std::regex{arg(), std::regex::icase};
+        } else if (!strcmp(argv[i], "--sizes")) {
+            if (sscanf(arg(), "%d-%d", &min_exponent, &max_exponent) != 2 || min_exponent < 5 || max_exponent > 11) {
+                throw std::runtime_error("--sizes must be of the form MIN-MAX with 5 <= MIN <= MAX <= 11");
+            }
+        } else if (!strcmp(argv[i], "--threads")) {
+            threads = std::stoi(arg());
+        } else if (!strcmp(argv[i], "--json")) {
+            json = arg();
+        } else if (!strcmp(argv[i], "--file")) {
+            file = arg();
+        } else {
+            throw std::runtime_error(std::string{"Unknown argument "} + argv[i]);
+        }
+    }
+
+    ExecutionOpts sequential, threaded;
+    threaded.use_threads = true;
+    threaded.num_threads = threads;
+
+    struct Engine {
+        std::string name;
+        int64_t max_size;
+        std::function<Result(int64_t)> run;
+    };
+
+    constexpr auto coeffs = maps.get_coeffs();
+    std::vector<coefficient_pair> dynamic_coeffs{ coeffs.begin(), coeffs.end() };
+
+    std::vector<Engine> engines = {
+        { "standard", STANDARD_MAX_SIZE, [&] (int64_t n) {
+            return run<StandardIterateMap<maps>>("standard", n, sequential); } },
+        { "vectorized", INT64_MAX, [&] (int64_t n) {
+            return run<VectorizedIterateMap<maps>>("vectorized", n, sequential); } },
+        { "vectorized-threads", INT64_MAX, [&] (int64_t n) {
+            return run<VectorizedIterateMap<maps>>("vectorized-threads", n, threaded); } },
+        { "dynamic-threads", INT64_MAX, [&] (int64_t n) {
+            return run<DynamicIterateMap>("dynamic-threads", n, threaded, dynamic_coeffs); } },
+        { "out-of-core", INT64_MAX, [&] (int64_t n) {
+            std::remove(file.c_str());
+            auto result = run<OutOfCoreIterateMap<maps>>("out-of-core", n, threaded, file);
+            std::remove(file.c_str());
+            return result; } }
+    };
+
+    std::vector<Result> results;
+    bool mismatch = false;
+
+    for (int e = min_exponent; e <= max_exponent; ++e) {
+        int64_t size = std::llround(std::pow(10.0, e));
+        int64_t first = -1;
+
+        for (auto& engine : engines) {
+            if (!std::regex_search(engine.name, filter) || size > engine.max_size) continue;
+
+            results.push_back(engine.run(size));
+            print(results.back());
+
+            if (first < 0) {
+                first = results.size() - 1;
+            } else if (results[first].checksum != results.back().checksum || results[first].count != results.back().count) {
+                printf("    MISMATCH with %s\n", results[first].engine.c_str());
+                mismatch = true;
+            }
+        }
+    }
+
+    if (!results.empty()) {
+        printf("Checksum 100000: %llu\n", (unsigned long long)results.back().checksum_100000);
+    }
+
+    if (json) write_json(json, results);
+
+    return mismatch;
+}
@@ -0,0 +1,94 @@
+/**
+ * Word-at-a-time iteration over the set (or unset) bits of a bitmap in the engines' word layout.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Affine {
+    // The values congruent to residue mod modulus; the default class contains everything
+    struct ResidueClass {
+        int64_t modulus = 1;
+        int64_t residue = 0;
+    };
+
+    /**
+     * Word masks selecting a residue class. The pattern repeats every modulus / gcd(modulus, 64) words, so one
+     * period is precomputed and indexed by the word number.
+     */
+    class ResidueMask {
+        std::vector<uint64_t> masks;
+    public:
+        static constexpr int64_t MAX_MODULUS = 1 << 16;
+
+        explicit ResidueMask(ResidueClass c) {
+            if (c.modulus < 1 || c.modulus > MAX_MODULUS) {
+                throw std::runtime_error("Invalid modulus " + std::to_string(c.modulus) + "; must be in range [1.."
+                        + std::to_string(MAX_MODULUS) + "]");
+            }
+
+            int64_t m = c.modulus;
+            int64_t r = ((c.residue % m) + m) % m;
+            masks.resize(m / std::gcd(m, int64_t{64}));
+
+            for (int64_t i = r; i < (int64_t)masks.size() * 64; i += m) {
+                masks[i >> 6] |= uint64_t{1} << (i & 63);
+            }
+        }
+
+        uint64_t operator()(int64_t w) const {
+            return masks[w % masks.size()];
+        }
+
+        bool is_trivial() const {
+            return masks.size() == 1 && masks[0] == ~uint64_t{0};
+        }
+    };
+
+    /**
+     * Call f(i) for every i in [min, max] in the class c whose bit is set (or unset if !ones), in increasing order.
+     * Costs one load and mask per word plus one call per hit.
+     */
+    template <bool ones, typename F>
+        void for_each_bit(const uint64_t* words, int64_t min, int64_t max, ResidueClass c, F f) {
+            if (max < min) return;
+
+            ResidueMask mask{c};
+            bool trivial = mask.is_trivial();
+            int64_t first = min >> 6, last = max >> 6;
+
+            for (int64_t w = first; w <= last; ++w) {
+                uint64_t bits = ones ? words[w] : ~words[w];
+
+                if (w == first) bits &= ~uint64_t{0} << (min & 63);
+                if (w == last) bits &= ~uint64_t{0} >> (63 - (max & 63));
+                if (!trivial) bits &= mask(w);
+
+                while (bits) {
+                    f(w * 64 + __builtin_ctzll(bits));
+                    bits &= bits - 1;
+                }
+            }
+        }
+
+    /**
+     * Call f(i, bit) for every i in [min, max] in increasing order, loading each word once
+     */
+    template <typename F>
+        void for_each_bit_value(const uint64_t* words, int64_t min, int64_t max, F f) {
+            for (int64_t w = min >> 6; w <= max >> 6; ++w) {
+                uint64_t word = words[w];
+                int64_t lo = std::max(min, w * 64), hi = std::min(max, w * 64 + 63);
+
+                for (int64_t i = lo; i <= hi; ++i) {
+                    f(i, (word >> (i & 63)) & 1);
+                }
+            }
+        }
+}
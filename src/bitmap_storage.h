@@ -0,0 +1,172 @@
+/**
+ * Page-backed storage for the engines' bitmaps.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <sys/mman.h>
+
+namespace Affine {
+    constexpr int64_t PAGE_SIZE = 4096;
+
+    /**
+     * Zero-initialized words in a reserved range of address space. Nothing is committed up front: ensure() makes a
+     * prefix accessible as computation advances, and the kernel only backs a page with memory once it is touched.
+     * Since the reservation never moves, pointers into the storage stay valid as it grows.
+     */
+    class BitmapStorage {
+    public:
+        // Words are made accessible in steps of this many bytes (one huge page)
+        static constexpr int64_t COMMIT_GRANULARITY = 1 << 21;
+        // Upper bound on the address space reserved by one instance (8.8 * 10^12 bits)
+        static constexpr int64_t MAX_RESERVE_BYTES = int64_t{1} << 40;
+
+    private:
+        uint64_t* base = nullptr;
+        int64_t reserved = 0;
+        int64_t committed = 0;
+
+        static int64_t round_up(int64_t n, int64_t to) {
+            return (n + to - 1) / to * to;
+        }
+
+        void* map_inaccessible(void* at, int64_t n) {
+            return mmap(at, n, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | (at ? MAP_FIXED : 0), -1, 0);
+        }
+
+        // Reserve n bytes aligned to COMMIT_GRANULARITY, so that every committed step can be one huge page
+        void* reserve_aligned(int64_t n) {
+            void* p = map_inaccessible(nullptr, n + COMMIT_GRANULARITY);
+            if (p == MAP_FAILED) return p;
+
+            char* start = static_cast<char*>(p);
+            char* aligned = reinterpret_cast<char*>(round_up(reinterpret_cast<uintptr_t>(start), COMMIT_GRANULARITY));
+
+            if (aligned > start) munmap(start, aligned - start);
+            munmap(aligned + n, start + COMMIT_GRANULARITY - aligned);
+
+            return aligned;
+        }
+    public:
+        /**
+         * Reserve address space for max_words words. If the address space is limited (e.g. by ulimit -v), less is
+         * reserved and ensure() throws once it is exhausted.
+         */
+        explicit BitmapStorage(int64_t max_words) {
+            int64_t n = round_up(std::clamp<int64_t>(max_words * sizeof(uint64_t), 1, MAX_RESERVE_BYTES),
+                    COMMIT_GRANULARITY);
+
+            for (; n >= COMMIT_GRANULARITY; n = round_up(n / 2, COMMIT_GRANULARITY)) {
+                void* p = reserve_aligned(n);
+
+                if (p != MAP_FAILED) {
+                    base = static_cast<uint64_t*>(p);
+                    reserved = n;
+                    return;
+                }
+
+                if (n == COMMIT_GRANULARITY) break;
+            }
+
+            throw std::runtime_error("Failed to reserve address space for bitmap storage");
+        }
+
+        BitmapStorage(const BitmapStorage&) = delete;
+        BitmapStorage& operator=(const BitmapStorage&) = delete;
+
+        BitmapStorage(BitmapStorage&& other) noexcept :
+            base(std::exchange(other.base, nullptr)), reserved(std::exchange(other.reserved, 0)),
+            committed(std::exchange(other.committed, 0)) {
+
+        }
+
+        ~BitmapStorage() {
+            if (base) munmap(base, reserved);
+        }
+
+        uint64_t* data() {
+            return base;
+        }
+
+        const uint64_t* data() const {
+            return base;
+        }
+
+        /**
+         * Number of words that may be accessed
+         */
+        int64_t size_words() const {
+            return committed / sizeof(uint64_t);
+        }
+
+        int64_t capacity_words() const {
+            return reserved / sizeof(uint64_t);
+        }
+
+        /**
+         * Make the words [0, words) accessible. Newly accessible words are zero.
+         */
+        void ensure(int64_t words) {
+            int64_t n = round_up(words * sizeof(uint64_t), COMMIT_GRANULARITY);
+            if (n <= committed) return;
+
+            if (n > reserved) {
+                throw std::runtime_error("Bitmap storage exhausted (" + std::to_string(words) + " words requested, "
+                        + std::to_string(capacity_words()) + " reserved)");
+            }
+
+            char* start = reinterpret_cast<char*>(base) + committed;
+            if (mprotect(start, n - committed, PROT_READ | PROT_WRITE) != 0) {
+                throw std::runtime_error("Failed to commit " + std::to_string(n) + " bytes of bitmap storage");
+            }
+
+#ifdef MADV_HUGEPAGE
+            // Back the bitmap with transparent huge pages where the kernel allows it (one TLB entry per 2 MB instead
+            // of per 4 KB); failure just leaves normal pages
+            madvise(start, n - committed, MADV_HUGEPAGE);
+#endif
+
+            committed = n;
+        }
+
+        /**
+         * Zero everything, returning all pages (and any file mapping) to the OS
+         */
+        void reset() {
+            if (committed == 0) return;
+
+            if (map_inaccessible(base, committed) == MAP_FAILED) {
+                throw std::runtime_error("Failed to release bitmap storage");
+            }
+
+            committed = 0;
+        }
+
+        /**
+         * Map n bytes of a file, starting at the page-aligned offset, copy-on-write over the start of the storage.
+         * Reads are served straight from the page cache; writes only touch private copies of the affected pages.
+         * A read-only mapping is shared instead, which reflects later writes to the file and isn't charged against
+         * the commit limit, so it can be larger than memory.
+         */
+        void map_file(int fd, int64_t offset, int64_t n, bool read_only = false) {
+            if (offset % PAGE_SIZE != 0) {
+                throw std::runtime_error("Invalid file mapping at offset " + std::to_string(offset));
+            }
+
+            n = round_up(n, PAGE_SIZE);
+            ensure(n / sizeof(uint64_t));
+
+            int protection = read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+            int flags = (read_only ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED;
+
+            if (n > 0 && mmap(base, n, protection, flags, fd, offset) == MAP_FAILED) {
+                throw std::runtime_error("Failed to map bitmap from file");
+            }
+        }
+    };
+}
@@ -0,0 +1,360 @@
+/**
+ * On-disk checkpoint format for iterate maps.
+ *
+ * Layout (all integers little-endian):
+ *
+ *   Header                  fixed-size struct below
+ *   coefficients            map_count pairs of int32 (a, b)
+ *   initial values          initial_count int64
+ *   block checksums         block_count uint64, one per block_bytes of the bitmap
+ *   padding                 to bitmap_offset, a multiple of the page size (files that grow in place reserve room
+ *                           for more block checksums here)
+ *   bitmap                  bitmap_bytes bytes in the engines' word layout, zero-padded to a whole page
+ *
+ * Since the bitmap is page-aligned it can be mapped straight into an engine's storage.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <span>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bitmap_storage.h"
+#include "map_def.h"
+
+namespace Affine {
+    namespace Checkpoint {
+        constexpr char MAGIC[8] = { 'A', 'F', 'F', 'I', 'N', 'E', 'M', 'P' };
+        constexpr uint32_t VERSION = 1;
+
+        // Granularity of the bitmap checksums
+        constexpr int64_t BLOCK_BYTES = 1 << 20;
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t map_count;
+            int64_t max_reached;
+            uint64_t initial_count;
+            uint64_t block_bytes;
+            uint64_t block_count;
+            uint64_t bitmap_offset;
+            uint64_t bitmap_bytes;
+            // Checksum of everything before the bitmap, computed with this field set to zero
+            uint64_t header_checksum;
+        };
+
+        struct Contents {
+            Header header;
+            std::vector<coefficient_pair> coeffs;
+            std::vector<int64_t> initial_values;
+            std::vector<uint64_t> block_checksums;
+        };
+
+        constexpr uint64_t CHECKSUM_SEED = 0x9E3779B97F4A7C15ULL;
+
+        // Word-wise multiply-xorshift hash; cheap enough to be bound by memory bandwidth. Hashing a buffer in pieces
+        // of whole words, passing each result on as h, gives the same result as hashing it at once.
+        inline uint64_t checksum(const void* data, size_t n, uint64_t h = CHECKSUM_SEED) {
+            const char* p = static_cast<const char*>(data);
+
+            for (; n >= 8; n -= 8, p += 8) {
+                uint64_t w;
+                std::memcpy(&w, p, 8);
+                h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+                h ^= h >> 31;
+            }
+
+            for (; n > 0; --n, ++p) {
+                h = (h ^ static_cast<unsigned char>(*p)) * 0x94D049BB133111EBULL;
+            }
+
+            return h;
+        }
+
+        class File {
+            int fd;
+        public:
+            File(const char* filename, int flags, mode_t mode = 0644) : fd(open(filename, flags, mode)) {
+                if (fd < 0) {
+                    throw std::runtime_error(std::string{"Failed to open file "} + filename);
+                }
+            }
+
+            File(const File&) = delete;
+            File& operator=(const File&) = delete;
+
+            ~File() {
+                close(fd);
+            }
+
+            int descriptor() const {
+                return fd;
+            }
+
+            void write_all(const void* data, size_t n) {
+                const char* p = static_cast<const char*>(data);
+
+                while (n > 0) {
+                    ssize_t written = ::write(fd, p, n);
+                    if (written <= 0) throw std::runtime_error("Failed to write checkpoint");
+
+                    p += written;
+                    n -= written;
+                }
+            }
+
+            void write_all_at(const void* data, size_t n, int64_t offset) {
+                const char* p = static_cast<const char*>(data);
+
+                while (n > 0) {
+                    ssize_t written = pwrite(fd, p, n, offset);
+                    if (written <= 0) throw std::runtime_error("Failed to write checkpoint");
+
+                    p += written;
+                    n -= written;
+                    offset += written;
+                }
+            }
+
+            void read_all(void* data, size_t n, int64_t offset) {
+                char* p = static_cast<char*>(data);
+
+                while (n > 0) {
+                    ssize_t got = pread(fd, p, n, offset);
+                    if (got <= 0) throw std::runtime_error("Unexpected end of checkpoint");
+
+                    p += got;
+                    n -= got;
+                    offset += got;
+                }
+            }
+        };
+
+        inline uint64_t header_checksum(Contents c) {
+            c.header.header_checksum = 0;
+
+            uint64_t h = checksum(&c.header, sizeof(Header));
+            h = checksum(c.coeffs.data(), c.coeffs.size() * sizeof(coefficient_pair), h);
+            h = checksum(c.initial_values.data(), c.initial_values.size() * sizeof(int64_t), h);
+            return checksum(c.block_checksums.data(), c.block_checksums.size() * sizeof(uint64_t), h);
+        }
+
+        // Size of everything before the padding
+        inline int64_t metadata_bytes(const Contents& c) {
+            return sizeof(Header) + c.coeffs.size() * sizeof(coefficient_pair)
+                + c.initial_values.size() * sizeof(int64_t) + c.block_checksums.size() * sizeof(uint64_t);
+        }
+
+        /**
+         * Overwrite everything before the padding in place, with a fresh header checksum. The metadata must fit
+         * before c.header.bitmap_offset. It can also be stored at another offset, or in another file, as a copy.
+         */
+        inline void write_metadata(File& file, Contents& c, int64_t offset = 0) {
+            if (metadata_bytes(c) > (int64_t)c.header.bitmap_offset) {
+                throw std::runtime_error("Checkpoint metadata does not fit before the bitmap");
+            }
+
+            c.header.block_count = c.block_checksums.size();
+            c.header.header_checksum = header_checksum(c);
+
+            auto write_array = [&] (const void* data, size_t n) {
+                file.write_all_at(data, n, offset);
+                offset += n;
+            };
+
+            write_array(&c.header, sizeof(Header));
+            write_array(c.coeffs.data(), c.coeffs.size() * sizeof(coefficient_pair));
+            write_array(c.initial_values.data(), c.initial_values.size() * sizeof(int64_t));
+            write_array(c.block_checksums.data(), c.block_checksums.size() * sizeof(uint64_t));
+        }
+
+        /**
+         * Write the bits [0, max_reached] of words. The file is written under a temporary name and renamed into
+         * place once it has been synced, so a crash never leaves a truncated checkpoint behind.
+         */
+        inline void write(const char* filename, std::span<const coefficient_pair> coeffs,
+                const std::vector<int64_t>& initial_values, int64_t max_reached, const uint64_t* words) {
+            static_assert(sizeof(coefficient_pair) == 2 * sizeof(int32_t));
+
+            Contents c{};
+            std::memcpy(c.header.magic, MAGIC, sizeof(MAGIC));
+            c.header.version = VERSION;
+            c.header.map_count = coeffs.size();
+            c.header.max_reached = max_reached;
+            c.header.initial_count = initial_values.size();
+            c.header.block_bytes = BLOCK_BYTES;
+
+            int64_t data_bytes = (max_reached + 64) / 64 * sizeof(uint64_t);
+            c.header.bitmap_bytes = (data_bytes + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+            c.header.block_count = (c.header.bitmap_bytes + BLOCK_BYTES - 1) / BLOCK_BYTES;
+
+            c.coeffs.assign(coeffs.begin(), coeffs.end());
+            c.initial_values = initial_values;
+
+            int64_t metadata_bytes = sizeof(Header) + coeffs.size() * sizeof(coefficient_pair)
+                + c.initial_values.size() * sizeof(int64_t) + c.header.block_count * sizeof(uint64_t);
+            c.header.bitmap_offset = (metadata_bytes + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+
+            // The stored bitmap ends with zero padding, which the checksums cover as well
+            std::vector<char> tail(PAGE_SIZE, 0);
+            int64_t full_pages = data_bytes / PAGE_SIZE * PAGE_SIZE;
+            std::memcpy(tail.data(), reinterpret_cast<const char*>(words) + full_pages, data_bytes - full_pages);
+
+            auto bitmap_chunk = [&] (int64_t offset, int64_t n, auto f) {
+                int64_t direct = std::clamp(full_pages - offset, int64_t{0}, n);
+                if (direct > 0) f(reinterpret_cast<const char*>(words) + offset, direct);
+                if (n > direct) f(tail.data() + (offset + direct - full_pages), n - direct);
+            };
+
+            for (uint64_t b = 0; b < c.header.block_count; ++b) {
+                int64_t offset = b * BLOCK_BYTES;
+                int64_t n = std::min<int64_t>(BLOCK_BYTES, c.header.bitmap_bytes - offset);
+
+                uint64_t h = CHECKSUM_SEED;
+                bitmap_chunk(offset, n, [&] (const char* p, int64_t m) { h = checksum(p, m, h); });
+                c.block_checksums.push_back(h);
+            }
+
+            c.header.header_checksum = header_checksum(c);
+
+            std::string temporary = std::string{filename} + ".tmp";
+
+            {
+                File file{temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC};
+
+                file.write_all(&c.header, sizeof(Header));
+                file.write_all(c.coeffs.data(), coeffs.size() * sizeof(coefficient_pair));
+                file.write_all(c.initial_values.data(), c.initial_values.size() * sizeof(int64_t));
+                file.write_all(c.block_checksums.data(), c.block_checksums.size() * sizeof(uint64_t));
+
+                std::vector<char> padding(c.header.bitmap_offset - metadata_bytes, 0);
+                file.write_all(padding.data(), padding.size());
+
+                bitmap_chunk(0, c.header.bitmap_bytes, [&] (const char* p, int64_t m) {
+                    file.write_all(p, m);
+                });
+
+                if (fsync(file.descriptor()) != 0) {
+                    throw std::runtime_error("Failed to sync checkpoint");
+                }
+            }
+
+            if (rename(temporary.c_str(), filename) != 0) {
+                throw std::runtime_error(std::string{"Failed to rename checkpoint to "} + filename);
+            }
+        }
+
+        /**
+         * Read and validate everything before the bitmap, or a copy of it stored at offset in file, describing the
+         * bitmap in bitmap_file
+         */
+        inline Contents read_metadata(File& file, int64_t offset, File& bitmap_file) {
+            Contents c{};
+            file.read_all(&c.header, sizeof(Header), offset);
+
+            if (std::memcmp(c.header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+                throw std::runtime_error("Not an iterate map checkpoint");
+            }
+
+            if (c.header.version != VERSION) {
+                throw std::runtime_error("Unsupported checkpoint version " + std::to_string(c.header.version));
+            }
+
+            if (c.header.map_count > 4096 || c.header.initial_count > (1 << 24) || c.header.block_count > (1LL << 32)
+                    || c.header.bitmap_offset % PAGE_SIZE != 0) {
+                throw std::runtime_error("Corrupt checkpoint header");
+            }
+
+            offset += sizeof(Header);
+            auto read_array = [&] (auto& v, size_t n) {
+                v.resize(n);
+                file.read_all(v.data(), n * sizeof(v[0]), offset);
+                offset += n * sizeof(v[0]);
+            };
+
+            read_array(c.coeffs, c.header.map_count);
+            read_array(c.initial_values, c.header.initial_count);
+            read_array(c.block_checksums, c.header.block_count);
+
+            if (header_checksum(c) != c.header.header_checksum) {
+                throw std::runtime_error("Checkpoint header checksum mismatch");
+            }
+
+            // Mapping past the end of the file would fault on first access instead of failing here
+            struct stat st;
+            if (fstat(bitmap_file.descriptor(), &st) != 0
+                    || (uint64_t)st.st_size < c.header.bitmap_offset + c.header.bitmap_bytes) {
+                throw std::runtime_error("Checkpoint is truncated");
+            }
+
+            return c;
+        }
+
+        inline Contents read_metadata(File& file) {
+            return read_metadata(file, 0, file);
+        }
+
+        /**
+         * Throw unless the checkpoint was written for exactly the given maps
+         */
+        inline void check_maps(const Contents& c, std::span<const coefficient_pair> coeffs) {
+            if (!std::equal(coeffs.begin(), coeffs.end(), c.coeffs.begin(), c.coeffs.end())) {
+                throw std::runtime_error("Checkpoint was written for a different set of maps");
+            }
+        }
+
+        /**
+         * Throw unless the checkpoint was written for exactly the maps of Maps
+         */
+        template <AffineMapSet Maps>
+            void check_maps(const Contents& c) {
+                check_maps(c, Maps.get_coeffs());
+            }
+
+        /**
+         * Restore what a loaded checkpoint ending at max_reached doesn't store but compute_till needs to resume from
+         * it: set_bit(i) for every initial value above max_reached, then compute_prefix() if the checkpoint ends
+         * inside [0, prefix_end), the values the engine computes bit by bit (which compute_till only does when
+         * starting from scratch).
+         */
+        template <typename SetBit, typename ComputePrefix>
+            void restore_unsaved(int64_t max_reached, const std::vector<int64_t>& initial_values, int64_t prefix_end,
+                    SetBit set_bit, ComputePrefix compute_prefix) {
+                for (int64_t i : initial_values) {
+                    if (i > max_reached) set_bit(i);
+                }
+
+                if (max_reached < prefix_end - 1) compute_prefix();
+            }
+
+        /**
+         * Check every bitmap block against its stored checksum. Loading a checkpoint doesn't do this, since it would
+         * read the whole bitmap; returns the index of the first bad block, or -1 if all match.
+         */
+        inline int64_t verify(const char* filename) {
+            File file{filename, O_RDONLY};
+            Contents c = read_metadata(file);
+
+            std::vector<char> buffer(BLOCK_BYTES);
+            for (uint64_t b = 0; b < c.header.block_count; ++b) {
+                int64_t offset = b * BLOCK_BYTES;
+                int64_t n = std::min<int64_t>(BLOCK_BYTES, c.header.bitmap_bytes - offset);
+
+                file.read_all(buffer.data(), n, c.header.bitmap_offset + offset);
+                if (checksum(buffer.data(), n) != c.block_checksums[b]) return b;
+            }
+
+            return -1;
+        }
+    }
+}
@@ -0,0 +1,382 @@
+/**
+ * Compressed read-only copy of a bitmap in the engines' word layout, for processes that keep finished results
+ * loaded and only query them.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bit_scan.h"
+#include "popcount.h"
+#include "scheduler.h"
+
+namespace Affine {
+    /**
+     * Roaring-style hybrid: the bitmap is cut into 2^16-bit chunks, and each chunk only stores the positions of its
+     * minority value (usually the unreachable values), whichever of these is smallest:
+     *
+     *  - Array: the sorted 16-bit offsets, 2 bytes per position (a chunk with none is free);
+     *  - Runs: the first and last offset of each maximal run, 4 bytes per run;
+     *  - Bitmap: the chunk's 1024 words as they are.
+     *
+     * Every chunk also records the set bits before it, so range counts only look inside the two chunks at either
+     * end. Lookups are a binary search over at most 4096 offsets.
+     */
+    class CompressedBitmap {
+    public:
+        static constexpr int64_t CHUNK_BITS = 1 << 16;
+        static constexpr int64_t CHUNK_WORDS = CHUNK_BITS / 64;
+
+        enum class Kind : uint8_t { Array, Runs, Bitmap };
+
+    private:
+        struct Chunk {
+            // Set bits in the chunks before this one
+            uint64_t ones_before;
+            // Index of the first offset in positions, or of the first word in bitmaps
+            uint64_t offset;
+            // Number of offsets (two per run)
+            uint32_t length;
+            Kind kind;
+            // Whether the stored positions are set bits (otherwise unset)
+            bool ones;
+        };
+
+        // Chunks built by threads before being appended in order
+        static constexpr int64_t BUILD_BATCH_CHUNKS = 1024;
+
+        struct Built {
+            Kind kind;
+            bool ones;
+            uint64_t ones_count;
+            std::vector<uint16_t> positions;
+        };
+
+        std::vector<Chunk> chunks;
+        std::vector<uint16_t> positions;
+        std::vector<uint64_t> bitmaps;
+
+        int64_t bits = 0;
+        int64_t total_ones = 0;
+
+        int64_t chunk_bits(int64_t c) const {
+            return std::min(CHUNK_BITS, bits - c * CHUNK_BITS);
+        }
+
+        // The chunk starting at words, whose first n bits are valid
+        static Built build_chunk(const uint64_t* words, int64_t n) {
+            int64_t word_count = (n + 63) / 64;
+            auto valid = [&] (int64_t i) {
+                return (n - i * 64 >= 64) ? ~uint64_t{0} : (uint64_t{1} << (n - i * 64)) - 1;
+            };
+
+            Built b{ Kind::Array, false, 0, {} };
+            for (int64_t i = 0; i < word_count; ++i) b.ones_count += __builtin_popcountll(words[i] & valid(i));
+
+            b.ones = (int64_t)b.ones_count * 2 <= n;
+            auto minority = [&] (int64_t i) {
+                return (b.ones ? words[i] : ~words[i]) & valid(i);
+            };
+
+            // A run starts at every minority bit whose predecessor isn't one
+            int64_t count = b.ones ? b.ones_count : n - b.ones_count, runs = 0;
+            uint64_t carry = 0;
+            for (int64_t i = 0; i < word_count; ++i) {
+                uint64_t x = minority(i);
+                runs += __builtin_popcountll(x & ~((x << 1) | carry));
+                carry = x >> 63;
+            }
+
+            int64_t array_bytes = 2 * count, run_bytes = 4 * runs, bitmap_bytes = 8 * word_count;
+            if (bitmap_bytes < std::min(array_bytes, run_bytes)) {
+                b.kind = Kind::Bitmap;
+                return b;
+            }
+
+            b.kind = (run_bytes < array_bytes) ? Kind::Runs : Kind::Array;
+            b.positions.reserve((b.kind == Kind::Runs) ? 2 * runs : count);
+
+            carry = 0;
+            for (int64_t i = 0; i < word_count; ++i) {
+                uint64_t x = minority(i);
+
+                if (b.kind == Kind::Array) {
+                    for (; x; x &= x - 1) b.positions.push_back(i * 64 + __builtin_ctzll(x));
+                    continue;
+                }
+
+                uint64_t next = (i + 1 < word_count) ? minority(i + 1) & 1 : 0;
+                uint64_t starts = x & ~((x << 1) | carry), ends = x & ~((x >> 1) | (next << 63));
+                carry = x >> 63;
+
+                // Starts and ends alternate in bit order, a start coming first where a run is a single bit
+                for (uint64_t e = starts | ends; e; e &= e - 1) {
+                    int bit = __builtin_ctzll(e);
+                    if ((starts >> bit) & 1) b.positions.push_back(i * 64 + bit);
+                    if ((ends >> bit) & 1) b.positions.push_back(i * 64 + bit);
+                }
+            }
+
+            return b;
+        }
+
+        const uint16_t* chunk_positions(const Chunk& c) const {
+            return positions.data() + c.offset;
+        }
+
+        // Index of the first run of c ending at or after off, as a number of runs
+        int64_t first_run_ending_from(const Chunk& c, int64_t off) const {
+            const uint16_t* p = chunk_positions(c);
+            int64_t lo = 0, hi = c.length / 2;
+
+            while (lo < hi) {
+                int64_t mid = (lo + hi) / 2;
+                if (p[2 * mid + 1] < off) lo = mid + 1;
+                else hi = mid;
+            }
+
+            return lo;
+        }
+
+        // Whether the stored positions of c include off
+        bool contains(const Chunk& c, int64_t off) const {
+            const uint16_t* p = chunk_positions(c);
+
+            if (c.kind == Kind::Array) {
+                return std::binary_search(p, p + c.length, off);
+            }
+
+            int64_t r = first_run_ending_from(c, off);
+            return r < c.length / 2 && p[2 * r] <= off;
+        }
+
+        // Set bits among the first off bits of chunk k
+        int64_t rank_in_chunk(int64_t k, int64_t off) const {
+            const Chunk& c = chunks[k];
+            const uint16_t* p = chunk_positions(c);
+            int64_t stored = 0;
+
+            switch (c.kind) {
+                case Kind::Bitmap:
+                    return (off == 0) ? 0 : count_bits(bitmaps.data() + c.offset, 0, off - 1);
+                case Kind::Array:
+                    stored = std::lower_bound(p, p + c.length, off) - p;
+                    break;
+                case Kind::Runs:
+                    for (int64_t r = 0; r < c.length / 2 && p[2 * r] < off; ++r) {
+                        stored += std::min<int64_t>(p[2 * r + 1] + 1, off) - p[2 * r];
+                    }
+                    break;
+            }
+
+            return c.ones ? stored : off - stored;
+        }
+
+        // Set bits in [0, n)
+        int64_t rank(int64_t n) const {
+            if (n >= bits) return total_ones;
+
+            int64_t k = n / CHUNK_BITS;
+            return chunks[k].ones_before + rank_in_chunk(k, n % CHUNK_BITS);
+        }
+
+        // Words of chunk k, restored into buf (for the bitmap kind, its stored words)
+        const uint64_t* chunk_words(int64_t k, uint64_t* buf) const {
+            const Chunk& c = chunks[k];
+            if (c.kind == Kind::Bitmap) return bitmaps.data() + c.offset;
+
+            const uint16_t* p = chunk_positions(c);
+            std::fill(buf, buf + CHUNK_WORDS, c.ones ? 0 : ~uint64_t{0});
+
+            auto flip = [&] (int64_t i) { buf[i >> 6] ^= uint64_t{1} << (i & 63); };
+            if (c.kind == Kind::Array) {
+                for (uint32_t i = 0; i < c.length; ++i) flip(p[i]);
+            } else {
+                for (uint32_t r = 0; r < c.length; r += 2) {
+                    for (int64_t i = p[r]; i <= p[r + 1]; ++i) flip(i);
+                }
+            }
+
+            return buf;
+        }
+
+        template <bool ones, typename F>
+            void for_each(F f, int64_t min, int64_t max, ResidueClass residue) const {
+                if (max == -1) max = bits - 1;
+                min = std::max(min, int64_t{0});
+
+                if (max < min || max >= bits) {
+                    throw std::runtime_error("Invalid bounds min=" + std::to_string(min)
+                            + ", max=" + std::to_string(max));
+                }
+
+                ResidueMask mask{residue};
+                std::vector<uint64_t> buf;
+
+                for (int64_t k = min / CHUNK_BITS; k <= max / CHUNK_BITS; ++k) {
+                    const Chunk& c = chunks[k];
+                    int64_t base = k * CHUNK_BITS;
+                    int64_t lo = std::max(min - base, int64_t{0}), hi = std::min(max - base, CHUNK_BITS - 1);
+
+                    // Positions of the wanted value are stored as they are: no need to restore the words
+                    if (c.kind == Kind::Array && c.ones == ones) {
+                        const uint16_t* p = chunk_positions(c);
+                        for (const uint16_t* i = std::lower_bound(p, p + c.length, lo); i < p + c.length && *i <= hi;
+                                ++i) {
+                            int64_t n = base + *i;
+                            if ((mask(n >> 6) >> (n & 63)) & 1) f(n);
+                        }
+
+                        continue;
+                    }
+
+                    buf.resize(CHUNK_WORDS);
+                    ResidueClass shifted{ residue.modulus, residue.residue - base % residue.modulus };
+                    for_each_bit<ones>(chunk_words(k, buf.data()), lo, hi, shifted, [&] (int64_t i) {
+                        f(base + i);
+                    });
+                }
+            }
+    public:
+        CompressedBitmap() = default;
+
+        /**
+         * Compress the bits [0, n) of words. Chunks are independent, so they are built across threads if
+         * thread_count > 1.
+         */
+        CompressedBitmap(const uint64_t* words, int64_t n, int thread_count = 1) : bits(std::max(n, int64_t{0})) {
+            int64_t chunk_count = (bits + CHUNK_BITS - 1) / CHUNK_BITS;
+            chunks.reserve(chunk_count);
+
+            std::vector<Built> batch;
+            for (int64_t first = 0; first < chunk_count; first += BUILD_BATCH_CHUNKS) {
+                int64_t count = std::min(BUILD_BATCH_CHUNKS, chunk_count - first);
+                batch.assign(count, {});
+
+                std::atomic<int64_t> next{0};
+                auto work = [&] (int) {
+                    int64_t i;
+                    while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count) {
+                        batch[i] = build_chunk(words + (first + i) * CHUNK_WORDS, chunk_bits(first + i));
+                    }
+                };
+
+                if (thread_count > 1 && count > 1) {
+                    ThreadPool::shared().run(thread_count, work);
+                } else {
+                    work(0);
+                }
+
+                for (int64_t i = 0; i < count; ++i) {
+                    Built& b = batch[i];
+                    Chunk c{ (uint64_t)total_ones, 0, 0, b.kind, b.ones };
+
+                    if (b.kind == Kind::Bitmap) {
+                        c.offset = bitmaps.size();
+                        bitmaps.resize(bitmaps.size() + CHUNK_WORDS);
+
+                        int64_t n = chunk_bits(first + i);
+                        std::memcpy(bitmaps.data() + c.offset, words + (first + i) * CHUNK_WORDS, (n + 63) / 64 * 8);
+                        if (n % 64) bitmaps[c.offset + (n - 1) / 64] &= (uint64_t{1} << n % 64) - 1;
+                    } else {
+                        c.offset = positions.size();
+                        c.length = b.positions.size();
+                        positions.insert(positions.end(), b.positions.begin(), b.positions.end());
+                    }
+
+                    chunks.push_back(c);
+                    total_ones += b.ones_count;
+                }
+            }
+
+            positions.shrink_to_fit();
+            bitmaps.shrink_to_fit();
+        }
+
+        /**
+         * Number of bits covered, i.e. max_reached() + 1 of the map it was compressed from
+         */
+        int64_t size() const {
+            return bits;
+        }
+
+        /**
+         * Bytes used by the compressed form
+         */
+        size_t memory_usage() const {
+            return chunks.size() * sizeof(Chunk) + positions.size() * sizeof(uint16_t)
+                + bitmaps.size() * sizeof(uint64_t);
+        }
+
+        /**
+         * Representation chosen for the chunk containing value n
+         */
+        Kind chunk_kind(int64_t n) const {
+            return chunks[n / CHUNK_BITS].kind;
+        }
+
+        /**
+         * Whether a value is reachable (unchecked)
+         */
+        bool is_reachable(int64_t n) const {
+            const Chunk& c = chunks[n / CHUNK_BITS];
+            int64_t off = n % CHUNK_BITS;
+
+            if (c.kind == Kind::Bitmap) {
+                return (bitmaps[c.offset + off / 64] >> (off % 64)) & 1;
+            }
+
+            return contains(c, off) == c.ones;
+        }
+
+        /**
+         * Whether a value is reachable (throws if outside [0, size()))
+         */
+        bool is_reachable_checked(int64_t n) const {
+            if (n < 0 || n >= bits) {
+                throw std::runtime_error("Attempted to access value " + std::to_string(n) + " out of bounds [0.."
+                        + std::to_string(bits - 1) + "]");
+            }
+
+            return is_reachable(n);
+        }
+
+        /**
+         * Count the reachable values in [min, max], inclusive (by default up to the last value)
+         */
+        int64_t count_solutions(int64_t min=0, int64_t max=-1) const {
+            if (max == -1) max = bits - 1;
+            min = std::max(min, int64_t{0});
+
+            if (max < min || max >= bits) {
+                throw std::runtime_error("Invalid bounds min=" + std::to_string(min)
+                        + ", max=" + std::to_string(max));
+            }
+
+            return rank(max + 1) - rank(min);
+        }
+
+        /**
+         * Call f(i) for every unreachable i in [min, max] in the given residue class, in increasing order
+         */
+        template <typename F>
+            void for_each_unreachable(F f, int64_t min=0, int64_t max=-1, ResidueClass residue={}) const {
+                for_each<false>(f, min, max, residue);
+            }
+
+        /**
+         * Call f(i) for every reachable i in [min, max] in the given residue class, in increasing order
+         */
+        template <typename F>
+            void for_each_reachable(F f, int64_t min=0, int64_t max=-1, ResidueClass residue={}) const {
+                for_each<true>(f, min, max, residue);
+            }
+    };
+}
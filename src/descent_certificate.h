@@ -0,0 +1,401 @@
+/**
+ * Search for descent certificates: bounds M such that any unreachable value of a residue class above M forces a
+ * smaller unreachable value of the same class.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bit_scan.h"
+#include "iterate_map.h"
+#include "map_def.h"
+#include "scheduler.h"
+
+namespace Affine {
+    namespace Certificate {
+        // Bounds are saturated here, far beyond anything that could be brute-forced
+        constexpr int64_t MAX_BOUND = int64_t{1} << 62;
+
+        // Shards of the memo, each with its own lock
+        constexpr int MEMO_SHARDS = 64;
+
+        // Root classes handed to a thread at once
+        constexpr std::size_t ROOT_CHUNK = 16;
+    }
+
+    struct CertificateOpts : public ExecutionOpts {
+        // Predecessor steps taken from a root class before a branch is given up
+        int max_depth = 24;
+        // Largest modulus of the classes inside the tree
+        int64_t max_modulus = int64_t{1} << 40;
+        // Largest modulus the root classes are refined to; the unresolved classes are reported at this granularity
+        int64_t max_root_modulus = 1 << 16;
+    };
+
+    struct CertificateClass {
+        ResidueClass c;
+        // Filled in by DescentCertificate::check: unreachable values of the class in the bitmap, and the first of
+        // them, or -1 if there are none
+        int64_t unreachable = -1;
+        int64_t first_unreachable = -1;
+    };
+
+    struct CertificateResult {
+        ResidueClass target;
+
+        // Every unreachable value above bound in a resolved class forces a smaller unreachable value in the target
+        int64_t bound = -1;
+        int64_t resolved_classes = 0;
+        std::vector<CertificateClass> unresolved;
+        // Fraction of the target covered by the unresolved classes
+        double unresolved_fraction = 0;
+
+        // Distinct residue states visited
+        int64_t states = 0;
+
+        // Filled in by DescentCertificate::check: largest value checked, and the unreachable values of the target
+        // class in [0, min(bound, checked_till)]
+        int64_t checked_till = -1;
+        int64_t unreachable_below_bound = -1;
+
+        /**
+         * Whether the target class is proven to be entirely reachable
+         */
+        bool proves_reachable() const {
+            return unresolved.empty() && checked_till >= bound && unreachable_below_bound == 0;
+        }
+
+        std::string to_string() const {
+            auto name = [] (ResidueClass c) {
+                return std::to_string(c.modulus) + "k+" + std::to_string(c.residue);
+            };
+
+            std::string s = "Descent for " + name(target) + ": " + std::to_string(resolved_classes)
+                    + " resolved classes, " + std::to_string(unresolved.size()) + " unresolved, "
+                    + std::to_string(states) + " states, " + std::to_string(100 * unresolved_fraction)
+                    + "% unresolved\n";
+
+            if (resolved_classes > 0) s += "M = " + std::to_string(bound) + "\n";
+            if (checked_till >= 0) {
+                s += "Unreachable values of " + name(target) + " up to " + std::to_string(std::min(bound, checked_till))
+                        + ": " + std::to_string(unreachable_below_bound) + "\n";
+            }
+
+            for (auto& u : unresolved) {
+                s += "unresolved " + name(u.c);
+                if (u.unreachable >= 0) {
+                    s += ": " + std::to_string(u.unreachable) + " unreachable";
+                    if (u.first_unreachable >= 0) s += ", first " + std::to_string(u.first_unreachable);
+                }
+                s += "\n";
+            }
+
+            if (proves_reachable()) s += "Every value of " + name(target) + " is reachable\n";
+            return s;
+        }
+    };
+
+    /**
+     * Suppose n is the least unreachable value of the target class. Every predecessor (n - b) / a of n is then
+     * unreachable too, and so are theirs, so if some chain of predecessors of n lands in the target class again, n
+     * was not the least after all. Whether a map has a predecessor, and whether a value lies in the target class,
+     * depend only on residues, so this is decided for whole classes at once: a state is a class of values v = P t + s
+     * that are all unreachable, it is resolved if every value of it (above some bound) has a chain of predecessors
+     * into the target, and
+     *
+     *   - a state inside the target class (other than the root) is resolved,
+     *   - a state whose tests are not determined by s mod P is split into the classes mod a multiple of P, and is
+     *     resolved if all of them are,
+     *   - otherwise it is resolved if the state of any of its predecessors (v - b) / a, a class mod P / a, is.
+     *
+     * Along the way each state accumulates the bound above which every value in its chain is nonnegative and
+     * decreasing. The root classes (of the target) are refined mod powers of the primes of the coefficients and
+     * searched in parallel; states are memoized across all of them, as the same classes recur throughout.
+     *
+     * What remains is brute force: check (DescentCertificate::check) that the target has no unreachable value up to
+     * the bound, and that the unresolved classes have none in the bitmap either, if there are any.
+     */
+    template <AffineMapSet Maps>
+        class DescentCertificate {
+            static constexpr auto coeffs = Maps.get_coeffs();
+
+            struct State {
+                int64_t modulus;
+                int64_t residue;
+
+                bool operator==(const State&) const = default;
+            };
+
+            struct StateHash {
+                std::size_t operator()(const State& s) const {
+                    return (uint64_t)(s.modulus * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)s.residue;
+                }
+            };
+
+            struct Outcome {
+                bool resolved = false;
+                // Values of the state at least this large are covered
+                int64_t bound = 0;
+                // Remaining depth the state was searched with, if unresolved
+                int depth = 0;
+            };
+
+            struct Shard {
+                std::mutex mutex;
+                std::unordered_map<State, Outcome, StateHash> states;
+            };
+
+            ResidueClass target;
+            CertificateOpts opts;
+            std::unique_ptr<Shard[]> shards = std::make_unique<Shard[]>(Certificate::MEMO_SHARDS);
+
+            Shard& shard(const State& s) {
+                return shards[StateHash{}(s) * 0x9E3779B97F4A7C15ULL >> 58];
+            }
+
+            static int64_t normalize(int64_t r, int64_t m) {
+                return (r % m + m) % m;
+            }
+
+            // Factor P must be multiplied by for every test on the state to be determined, or 1 if they are
+            int64_t refinement(State s, bool in_tree) const {
+                int64_t factor = 1;
+
+                auto need = [&] (int64_t a, int64_t b) {
+                    int64_t g = std::gcd(a, s.modulus);
+                    if (normalize(s.residue - b, g) == 0) factor = std::lcm(factor, a / g);
+                };
+
+                if (in_tree) need(target.modulus, target.residue);
+                for (auto [a, b] : coeffs) need(a, b);
+
+                return factor;
+            }
+
+            // Bound for a state given the bound of its predecessor by ax + b, which must also be at least 3 so that
+            // the predecessor is smaller
+            static int64_t lift(int64_t bound, int64_t a, int64_t b) {
+                if (bound >= (Certificate::MAX_BOUND - b) / a) return Certificate::MAX_BOUND;
+                return std::max(a * bound + b, int64_t{3});
+            }
+
+            template <typename F>
+                bool split(State s, int64_t factor, F f) {
+                    if (s.modulus > opts.max_modulus / factor) return false;
+
+                    for (int64_t i = 0; i < factor; ++i) {
+                        if (!f(State{ s.modulus * factor, s.residue + i * s.modulus })) return false;
+                    }
+
+                    return true;
+                }
+
+            Outcome solve(State s, int depth) {
+                Shard& sh = shard(s);
+                {
+                    std::lock_guard lock{sh.mutex};
+                    if (auto it = sh.states.find(s); it != sh.states.end()) {
+                        if (it->second.resolved || it->second.depth >= depth) return it->second;
+                    }
+                }
+
+                Outcome result{ .depth = depth };
+                int64_t factor = refinement(s, true);
+
+                if (s.modulus % target.modulus == 0 && normalize(s.residue - target.residue, target.modulus) == 0) {
+                    result.resolved = true;
+                } else if (factor > 1) {
+                    int64_t bound = 0;
+                    result.resolved = split(s, factor, [&] (State child) {
+                        Outcome o = solve(child, depth);
+                        bound = std::max(bound, o.bound);
+                        return o.resolved;
+                    });
+                    result.bound = bound;
+                } else if (depth > 0) {
+                    result.bound = Certificate::MAX_BOUND;
+
+                    for (auto [a, b] : coeffs) {
+                        if (normalize(s.residue - b, a) != 0) continue;
+
+                        int64_t m = s.modulus / a;
+                        Outcome o = solve(State{ m, normalize((s.residue - b) / a, m) }, depth - 1);
+                        if (o.resolved) {
+                            result.resolved = true;
+                            result.bound = std::min(result.bound, lift(o.bound, a, b));
+                        }
+                    }
+
+                    if (!result.resolved) result.bound = 0;
+                }
+
+                std::lock_guard lock{sh.mutex};
+                sh.states[s] = result;
+                return result;
+            }
+
+            // Resolve a root class, or return the factor to refine it by (0 if it cannot be refined further)
+            int64_t solve_root(State s, int64_t& bound) {
+                int64_t factor = refinement(s, false);
+
+                if (factor == 1) {
+                    bound = Certificate::MAX_BOUND;
+
+                    for (auto [a, b] : coeffs) {
+                        if (normalize(s.residue - b, a) != 0) continue;
+
+                        int64_t m = s.modulus / a;
+                        Outcome o = solve(State{ m, normalize((s.residue - b) / a, m) }, opts.max_depth - 1);
+                        if (o.resolved) bound = std::min(bound, lift(o.bound, a, b));
+                    }
+
+                    if (bound < Certificate::MAX_BOUND) return 1;
+
+                    // Unresolved: refine by the prime of the coefficients whose power in the modulus is smallest
+                    int64_t best = 0, best_power = 0;
+                    for (auto [a, b] : coeffs) {
+                        for (int64_t p = 2, rest = a; rest > 1; ++p) {
+                            if (rest % p) continue;
+                            while (rest % p == 0) rest /= p;
+
+                            int64_t power = 1;
+                            for (int64_t q = s.modulus; q % p == 0; q /= p) power *= p;
+                            if (!best || power < best_power) best = p, best_power = power;
+                        }
+                    }
+
+                    factor = best;
+                }
+
+                return factor && s.modulus <= opts.max_root_modulus / factor ? factor : 0;
+            }
+        public:
+            explicit DescentCertificate(ResidueClass target) : target(target) {
+                if (target.modulus < 1 || target.modulus > (int64_t{1} << 32)) {
+                    throw std::runtime_error("Invalid target modulus " + std::to_string(target.modulus));
+                }
+
+                this->target.residue = normalize(target.residue, target.modulus);
+            }
+
+            /**
+             * Refine the target class until every root class is resolved or reaches opts.max_root_modulus
+             */
+            CertificateResult search(const CertificateOpts& opts={}) {
+                if (opts.max_depth < 1 || opts.max_root_modulus < target.modulus
+                        || opts.max_modulus < opts.max_root_modulus || opts.max_modulus > Certificate::MAX_BOUND) {
+                    throw std::runtime_error("Invalid certificate search options");
+                }
+
+                this->opts = opts;
+                for (int i = 0; i < Certificate::MEMO_SHARDS; ++i) shards[i].states.clear();
+
+                CertificateResult result{};
+                result.target = target;
+                std::mutex result_mutex;
+
+                int thread_count = opts.use_threads ? std::max(1, opts.num_threads) : 1;
+                std::vector<State> level{ State{ target.modulus, target.residue } };
+
+                // Each level holds the classes of one refinement depth; threads claim chunks of it
+                while (!level.empty()) {
+                    std::vector<State> next;
+                    std::atomic<std::size_t> claimed{0};
+
+                    ThreadPool::shared().run(thread_count, [&] (int) {
+                        std::vector<State> children;
+                        CertificateResult partial;
+
+                        std::size_t i;
+                        while ((i = claimed.fetch_add(Certificate::ROOT_CHUNK)) < level.size()) {
+                            for (std::size_t j = i; j < std::min(level.size(), i + Certificate::ROOT_CHUNK); ++j) {
+                                State s = level[j];
+                                int64_t bound = 0, factor = solve_root(s, bound);
+
+                                if (factor == 1) {
+                                    partial.resolved_classes++;
+                                    partial.bound = std::max(partial.bound, bound - 1);
+                                } else if (factor == 0) {
+                                    partial.unresolved.push_back({ ResidueClass{ s.modulus, s.residue } });
+                                } else {
+                                    for (int64_t k = 0; k < factor; ++k) {
+                                        children.push_back({ s.modulus * factor, s.residue + k * s.modulus });
+                                    }
+                                }
+                            }
+                        }
+
+                        std::lock_guard lock{result_mutex};
+                        next.insert(next.end(), children.begin(), children.end());
+                        result.resolved_classes += partial.resolved_classes;
+                        result.bound = std::max(result.bound, partial.bound);
+                        result.unresolved.insert(result.unresolved.end(), partial.unresolved.begin(),
+                                partial.unresolved.end());
+                    });
+
+                    level = std::move(next);
+                }
+
+                std::sort(result.unresolved.begin(), result.unresolved.end(), [] (auto& x, auto& y) {
+                    return std::pair{ x.c.modulus, x.c.residue } < std::pair{ y.c.modulus, y.c.residue };
+                });
+
+                for (auto& u : result.unresolved) result.unresolved_fraction += (double)target.modulus / u.c.modulus;
+                for (int i = 0; i < Certificate::MEMO_SHARDS; ++i) result.states += shards[i].states.size();
+                return result;
+            }
+
+            /**
+             * Brute-force part of the proof: count the unreachable values of the target up to the bound, and of
+             * every unresolved class, in an engine computed for the same maps
+             */
+            template <typename Engine>
+                void check(CertificateResult& result, Engine& m, const ExecutionOpts& opts={}) {
+                    int64_t max = m.max_reached();
+                    if (max < 0) throw std::runtime_error("Engine has not computed anything");
+
+                    auto count = [&] (ResidueClass c, int64_t till, int64_t& first) {
+                        int64_t n = 0;
+                        first = -1;
+                        if (till < 0) return n;
+
+                        auto f = [&] (int64_t i) {
+                            if (n++ == 0) first = i;
+                        };
+
+                        if (c.modulus <= ResidueMask::MAX_MODULUS) {
+                            m.for_each_unreachable(f, 0, till, c);
+                        } else {
+                            for (int64_t i = c.residue; i <= till; i += c.modulus) {
+                                if (!m.is_reachable(i)) f(i);
+                            }
+                        }
+
+                        return n;
+                    };
+
+                    int64_t first;
+                    result.checked_till = max;
+                    result.unreachable_below_bound = count(result.target, std::min(result.bound, max), first);
+
+                    std::atomic<std::size_t> claimed{0};
+                    ThreadPool::shared().run(opts.use_threads ? std::max(1, opts.num_threads) : 1, [&] (int) {
+                        std::size_t i;
+                        while ((i = claimed.fetch_add(1)) < result.unresolved.size()) {
+                            auto& u = result.unresolved[i];
+                            u.unreachable = count(u.c, max, u.first_unreachable);
+                        }
+                    });
+                }
+        };
+}
@@ -0,0 +1,450 @@
+/**
+ * Iterate map whose maps are given at runtime, for drivers sweeping over many map sets without recompiling.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bit_scan.h"
+#include "bitmap_storage.h"
+#include "checkpoint.h"
+#include "iterate_map.h"
+#include "map_def.h"
+#include "popcount.h"
+#include "progress.h"
+#include "word_driver.h"
+#include "word_kernel.h"
+
+namespace Affine {
+    namespace Kernel {
+        // Fill of the spread stream S_a for a fixed a (see SpreadStream)
+        using SpreadFill = void (*)(const uint64_t* src, uint64_t* buf, int64_t k0, int64_t k1, int64_t origin);
+
+        // Linear coefficients with a spread specialized at compile time; the others use DynamicKernel's own
+        constexpr int MAX_SPECIALIZED_COEFF = 6;
+
+        constexpr auto specialized_fills = [] {
+            std::array<SpreadFill, MAX_SPECIALIZED_COEFF + 1> t{};
+
+            [&]<std::size_t... A>(std::index_sequence<A...>) {
+                ((t[A + 2] = &SpreadStream<A + 2>::fill), ...);
+            }(std::make_index_sequence<MAX_SPECIALIZED_COEFF - 1>{});
+
+            return t;
+        }();
+
+        /**
+         * WordKernel with the maps given at runtime. Each distinct a gets one spread stream: the precompiled
+         * SpreadStream<a>::fill for a <= MAX_SPECIALIZED_COEFF, and otherwise a PDEP per word from a table of
+         * phases built for that a. The constants only enter as word and bit offsets, so any b works with either.
+         * The shifted spread words are ORed in one pass per map over the tile, with the shift a loop invariant.
+         */
+        class DynamicKernel {
+        public:
+            struct Phase {
+                int shift;
+                uint64_t mask;
+            };
+
+            struct Stream {
+                int a;
+                // Precompiled fill, or null to use phases
+                SpreadFill fill;
+                std::vector<Phase> phases;
+                // Range of word offsets of the maps reading this stream
+                int64_t min_offset, max_offset;
+            };
+
+            struct Map {
+                std::size_t stream;
+                int64_t word_offset;
+                int bit_offset;
+            };
+
+        private:
+            std::vector<Stream> streams;
+            std::vector<Map> maps;
+
+            int64_t _tile_words = TILE_WORDS;
+            int64_t _first_word = 1;
+
+            static int64_t floor_div(int64_t x, int64_t y) {
+                return (x >= 0) ? x / y : -((-x + y - 1) / y);
+            }
+
+            static std::vector<Phase> make_phases(int a) {
+                std::vector<Phase> t(a);
+
+                for (int f = 0; f < a; ++f) {
+                    int first = (64 * f + a - 1) / a;
+
+                    uint64_t mask = 0;
+                    for (int p = a * first - 64 * f; p < 64; p += a) mask |= uint64_t{1} << p;
+
+                    t[f] = { (mask == 0) ? 0 : first, mask };
+                }
+
+                return t;
+            }
+
+            static void fill_generic(const Stream& s, const uint64_t* src, uint64_t* buf, int64_t k0, int64_t k1) {
+                int64_t k = k0;
+                for (; k < k1 && k < 0; ++k) buf[k - k0] = 0;
+
+                int64_t q = k / s.a, r = k % s.a;
+                for (; k < k1; ++k) {
+                    const Phase& p = s.phases[r];
+                    buf[k - k0] = (p.mask == 0) ? 0 : pdep(src[q] >> p.shift, p.mask);
+
+                    if (++r == s.a) {
+                        r = 0;
+                        ++q;
+                    }
+                }
+            }
+        public:
+            DynamicKernel() = default;
+
+            explicit DynamicKernel(const std::vector<coefficient_pair>& coeffs) {
+                for (auto [a, b] : coeffs) {
+                    auto it = std::find_if(streams.begin(), streams.end(), [a] (const Stream& s) { return s.a == a; });
+                    int64_t offset = floor_div(-b, 64);
+
+                    if (it == streams.end()) {
+                        bool specialized = a <= MAX_SPECIALIZED_COEFF;
+                        streams.push_back({ a, specialized ? specialized_fills[a] : nullptr,
+                                specialized ? std::vector<Phase>{} : make_phases(a), offset, offset });
+                        it = streams.end() - 1;
+                    }
+
+                    it->min_offset = std::min(it->min_offset, offset);
+                    it->max_offset = std::max(it->max_offset, offset);
+                    maps.push_back({ (std::size_t)(it - streams.begin()), offset, (int)(-b - 64 * offset) });
+                }
+
+                // Tiles are aligned to the period of all phases when it fits, as in WordKernel
+                int64_t block = 1;
+                for (const Stream& s : streams) block = std::min<int64_t>(std::lcm(block, s.a), TILE_WORDS + 1);
+                _tile_words = (block <= TILE_WORDS) ? TILE_WORDS / block * block : TILE_WORDS;
+
+                while (max_tile_end(_first_word) <= _first_word) ++_first_word;
+            }
+
+            int64_t tile_words() const {
+                return _tile_words;
+            }
+
+            /**
+             * Words per spread buffer, so that a caller can provide scratch for compute_tile
+             */
+            int64_t buffer_words() const {
+                int64_t spread = 0;
+                for (const Stream& s : streams) spread = std::max(spread, s.max_offset - s.min_offset);
+                return _tile_words + spread + 2;
+            }
+
+            std::size_t scratch_words() const {
+                return streams.size() * buffer_words();
+            }
+
+            int64_t first_word() const {
+                return _first_word;
+            }
+
+            int64_t last_source_word(int64_t w1) const {
+                int64_t last = -1;
+                for (const Stream& s : streams) {
+                    int64_t k = w1 + s.max_offset;
+                    last = std::max(last, (k < 0) ? -1 : k / s.a);
+                }
+
+                return last;
+            }
+
+            int64_t max_tile_end(int64_t w0) const {
+                int64_t lo = w0, hi = (w0 / _tile_words + 1) * _tile_words;
+
+                while (lo < hi) {
+                    int64_t mid = (lo + hi + 1) / 2;
+                    if (last_source_word(mid) < w0) lo = mid; else hi = mid - 1;
+                }
+
+                return lo;
+            }
+
+            /**
+             * Same contract as WordKernel::compute_tile, with scratch_words() words of scratch
+             */
+            void compute_tile(const uint64_t* src, uint64_t* out, int64_t w0, int64_t w1, uint64_t* scratch) const {
+                int64_t stride = buffer_words();
+
+                for (std::size_t d = 0; d < streams.size(); ++d) {
+                    const Stream& s = streams[d];
+                    uint64_t* buf = scratch + d * stride;
+                    int64_t k0 = w0 + s.min_offset, k1 = w1 + s.max_offset + 1;
+
+                    if (s.fill) {
+                        s.fill(src, buf, k0, k1, 0);
+                    } else {
+                        fill_generic(s, src, buf, k0, k1);
+                    }
+                }
+
+                int64_t n = w1 - w0;
+                for (const Map& m : maps) {
+                    const Stream& s = streams[m.stream];
+                    const uint64_t* p = scratch + m.stream * stride + (m.word_offset - s.min_offset);
+                    int r = m.bit_offset;
+
+                    if (r == 0) {
+                        for (int64_t j = 0; j < n; ++j) out[j] |= p[j];
+                    } else {
+                        for (int64_t j = 0; j < n; ++j) out[j] |= (p[j] >> r) | (p[j + 1] << (64 - r));
+                    }
+                }
+            }
+        };
+    }
+
+    /**
+     * VectorizedIterateMap for a map set chosen at runtime, e.g. read from a configuration file. The maps are
+     * validated like ValidAffineMapCoefficients, and computed by a DynamicKernel. Since IterateMap is parametrized
+     * by its maps, this is a class of its own with the same interface for computing, querying and checkpoints.
+     */
+    class DynamicIterateMap {
+        std::vector<coefficient_pair> coeffs;
+        int64_t max_entry;
+
+        Kernel::DynamicKernel kernel;
+
+        // The kernel as WordDriver sees it, with scratch for the spread buffers of each thread slot
+        struct Tiles {
+            const Kernel::DynamicKernel& kernel;
+            std::vector<std::vector<uint64_t>> scratch;
+
+            int64_t first_word() const { return kernel.first_word(); }
+            int64_t tile_words() const { return kernel.tile_words(); }
+            int64_t last_source_word(int64_t w1) const { return kernel.last_source_word(w1); }
+            int64_t max_tile_end(int64_t w0) const { return kernel.max_tile_end(w0); }
+
+            void reserve(int thread_count) {
+                scratch.resize(std::max<std::size_t>(scratch.size(), thread_count),
+                        std::vector<uint64_t>(kernel.scratch_words()));
+            }
+
+            void compute_tile(uint64_t* words, int64_t w0, int64_t w1, int slot) {
+                kernel.compute_tile(words, words + w0, w0, w1, scratch[slot].data());
+            }
+        };
+
+        int64_t _max_reached = -1;
+        std::vector<int64_t> _initial_values;
+
+        BitmapStorage words;
+        Tiles tiles{kernel, {}};
+        WordDriver<Tiles> driver{tiles, words, coeffs};
+
+        // Meter of the running computation, if progress is being reported
+        ProgressMeter* _progress = nullptr;
+
+        static const std::vector<coefficient_pair>& validate(const std::vector<coefficient_pair>& maps) {
+            if (maps.empty()) {
+                throw std::runtime_error("At least one map is required");
+            }
+
+            for (auto [a, b] : maps) {
+                if (a <= 1 || a > LINEAR_COEFF_MAX || b < -a || b > LINEAR_CONST_MAX) {
+                    throw std::runtime_error("Invalid map " + std::to_string(a) + "x+" + std::to_string(b)
+                            + "; requires 1 < a <= " + std::to_string(LINEAR_COEFF_MAX) + " and -a <= b <= "
+                            + std::to_string(LINEAR_CONST_MAX));
+                }
+            }
+
+            return maps;
+        }
+
+        bool get_bit(int64_t i) const {
+            return (words.data()[i >> 6] >> (i & 63)) & 1;
+        }
+
+        void range_bounds_check(int64_t min, int64_t max) const {
+            min = (min < 0) ? 0 : min;
+            if (max < min || max > _max_reached) {
+                throw std::runtime_error("Invalid bounds min=" + std::to_string(min)
+                        + ", max=" + std::to_string(max));
+            }
+        }
+    public:
+        /**
+         * Iterate the maps ax+b given as (a, b) pairs, up to max_entry (exclusive). Only reserves address space;
+         * memory is committed as compute_till advances.
+         */
+        explicit DynamicIterateMap(std::vector<coefficient_pair> maps, int64_t max_entry=_DEFAULT_MAX_ENTRY)
+                : coeffs(validate(maps)), max_entry(max_entry), kernel(coeffs),
+                words(std::max((max_entry + 63) / 64, kernel.first_word()) + 1) {
+
+        }
+
+        // The driver refers to the kernel and bitmap in place
+        DynamicIterateMap(const DynamicIterateMap&) = delete;
+        DynamicIterateMap& operator=(const DynamicIterateMap&) = delete;
+
+        /**
+         * Set the initial values from which the maps will be iterated
+         */
+        void set_initial(const std::vector<int64_t>& initial) {
+            _initial_values.clear();
+            for (int64_t i : initial) {
+                if (i < 0 || i >= max_entry) {
+                    throw std::runtime_error{"Invalid initial value " + std::to_string(i) + "; must be in range [0.."
+                            + std::to_string(max_entry - 1)};
+                }
+
+                _initial_values.push_back(i);
+            }
+        }
+
+        void set_initial(std::initializer_list<int64_t> initial) {
+            set_initial(std::vector<int64_t>(initial));
+        }
+
+        const std::vector<coefficient_pair>& maps() const {
+            return coeffs;
+        }
+
+        /**
+         * Whether the maps with linear coefficient a use a precompiled spread
+         */
+        static bool is_specialized(int a) {
+            return a <= Kernel::MAX_SPECIALIZED_COEFF;
+        }
+
+        int64_t max_reached() const {
+            return _max_reached;
+        }
+
+        void compute_till(const IterateMapOpts& opts) {
+            int64_t max = (opts.max < 0) ? max_entry - 1 : opts.max;
+
+            if (max <= _max_reached) {
+                return;
+            }
+
+            if (max >= max_entry) {
+                throw std::runtime_error("Max entry exceeded (max=" + std::to_string(max) +")");
+            }
+
+            int64_t end = (max >> 6) + 1;
+            int64_t w = driver.begin(_max_reached, end, _initial_values, [] (int64_t, int) {});
+
+            int thread_count = opts.use_threads ? opts.num_threads : 1;
+            ProgressScope progress{_progress, opts.progress_reporter(), (double)opts.callback_frequency,
+                    (end - w) * 64, thread_count};
+
+            tiles.reserve(thread_count);
+            driver.compute(w, end, thread_count, _progress, [] (int64_t) {});
+
+            _max_reached = max;
+            progress.finish();
+        }
+
+        void clear_data() {
+            words.reset();
+            _max_reached = -1;
+        }
+
+        /**
+         * Whether a value is reachable (unchecked)
+         */
+        bool is_reachable(int64_t i) const {
+            return get_bit(i);
+        }
+
+        /**
+         * Whether a value is reachable (throws if it hasn't been computed)
+         */
+        bool is_reachable_checked(int64_t i) const {
+            if (i < 0 || i > _max_reached) {
+                throw std::runtime_error("Attempted to access value " + std::to_string(i) + " out of bounds [0.."
+                        + std::to_string(_max_reached) + "]");
+            }
+
+            return get_bit(i);
+        }
+
+        /**
+         * Count the reachable values in [min, max], inclusive. Large ranges are split across threads if
+         * opts.use_threads is set.
+         */
+        int64_t count_solutions(int64_t min=0, int64_t max=-1, const ExecutionOpts& opts={}) const {
+            if (max == -1) max = _max_reached;
+            range_bounds_check(min, max);
+
+            return count_bits_parallel(words.data(), std::max(min, int64_t{0}), max,
+                    opts.use_threads ? opts.num_threads : 1);
+        }
+
+        template <SolutionLambda L>
+            void for_each_solution(L l, int64_t min=0, int64_t max=-1) const {
+                if (max == -1) max = _max_reached;
+                range_bounds_check(min, max);
+
+                for_each_bit_value(words.data(), std::max(min, int64_t{0}), max, l);
+            }
+
+        template <typename F>
+            void for_each_reachable(F f, int64_t min=0, int64_t max=-1, ResidueClass c={}) const {
+                if (max == -1) max = _max_reached;
+                range_bounds_check(min, max);
+
+                for_each_bit<true>(words.data(), std::max(min, int64_t{0}), max, c, f);
+            }
+
+        template <typename F>
+            void for_each_unreachable(F f, int64_t min=0, int64_t max=-1, ResidueClass c={}) const {
+                if (max == -1) max = _max_reached;
+                range_bounds_check(min, max);
+
+                for_each_bit<false>(words.data(), std::max(min, int64_t{0}), max, c, f);
+            }
+
+        /**
+         * Underlying bitmap as little-endian 64-bit words
+         */
+        const uint64_t* data() const {
+            return words.data();
+        }
+
+        void write_to_file(const char* filename) const {
+            Checkpoint::write(filename, coeffs, _initial_values, _max_reached, words.data());
+        }
+
+        /**
+         * Map a checkpoint written for the same maps, as VectorizedIterateMap::read_from_file does
+         */
+        void read_from_file(const char* filename) {
+            Checkpoint::File file{filename, O_RDONLY};
+            auto contents = Checkpoint::read_metadata(file);
+
+            Checkpoint::check_maps(contents, coeffs);
+
+            if (contents.header.max_reached >= max_entry
+                    || (int64_t)contents.header.bitmap_bytes > words.capacity_words() * 8) {
+                throw std::runtime_error("Checkpoint exceeds max entry (max_reached="
+                        + std::to_string(contents.header.max_reached) + ")");
+            }
+
+            _initial_values = contents.initial_values;
+            _max_reached = contents.header.max_reached;
+            driver.load(file, contents);
+        }
+    };
+}
@@ -0,0 +1,473 @@
+/**
+ * Compressed export of the unreachable values of a bitmap, and a streaming reader for it.
+ *
+ * Layout:
+ *
+ *   Header                  fixed-size struct below
+ *   chunks                  varint-encoded gaps, one independently decodable run per chunk
+ *   chunk table             chunk_count ChunkEntry structs, at table_offset
+ *
+ * Each chunk covers a fixed range of CHUNK_BITS values. Its first value is stored as the distance from the start
+ * of the range, and every following value as (gap - 1), all as LEB128 varints. The header and table are covered by
+ * one checksum and each chunk by its own, with the checkpoint format's hash.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "scheduler.h"
+
+namespace Affine {
+    namespace Export {
+        constexpr char MAGIC[8] = { 'U', 'N', 'R', 'E', 'A', 'C', 'H', 'V' };
+        constexpr uint32_t VERSION = 2;
+
+        // Values covered by one chunk
+        constexpr int64_t CHUNK_BITS = int64_t{1} << 24;
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t reserved;
+            // Exported range, inclusive
+            int64_t min;
+            int64_t max;
+            uint64_t count;
+            uint64_t chunk_count;
+            uint64_t table_offset;
+            // Checksum of the header and the chunk table, computed with this field set to zero
+            uint64_t table_checksum;
+        };
+
+        struct ChunkEntry {
+            // Range of values covered, inclusive
+            int64_t min;
+            int64_t max;
+            uint64_t count;
+            // Location of the encoded bytes in the file, and their checksum
+            uint64_t offset;
+            uint64_t bytes;
+            uint64_t checksum;
+        };
+
+        inline uint64_t table_checksum(Header header, const std::vector<ChunkEntry>& table) {
+            header.table_checksum = 0;
+
+            uint64_t h = Checkpoint::checksum(&header, sizeof(Header));
+            return Checkpoint::checksum(table.data(), table.size() * sizeof(ChunkEntry), h);
+        }
+
+        inline void put_varint(std::vector<uint8_t>& out, uint64_t v) {
+            while (v >= 0x80) {
+                out.push_back(static_cast<uint8_t>(v) | 0x80);
+                v >>= 7;
+            }
+
+            out.push_back(static_cast<uint8_t>(v));
+        }
+
+        // Decode the varint at p, which must end before end
+        inline uint64_t get_varint(const uint8_t*& p, const uint8_t* end) {
+            uint64_t v = 0;
+            for (int shift = 0; ; shift += 7) {
+                if (p == end || shift > 63) throw std::runtime_error("Corrupt export chunk");
+
+                uint8_t byte = *p++;
+                v |= uint64_t{byte & 0x7fu} << shift;
+
+                if (!(byte & 0x80)) return v;
+            }
+        }
+
+        /**
+         * Encode the unset bits in [min, max], appending to out, where words[0] holds the bits starting at
+         * 64 * base_word. prev is the last value encoded so far (one less than the chunk start for a new chunk) and is
+         * updated, so a chunk can be encoded in several pieces. Returns the number of values.
+         */
+        inline uint64_t encode_bits(const uint64_t* words, int64_t base_word, int64_t min, int64_t max, int64_t& prev,
+                std::vector<uint8_t>& out) {
+            uint64_t count = 0;
+
+            for (int64_t w = min >> 6; w <= max >> 6; ++w) {
+                uint64_t bits = ~words[w - base_word];
+
+                if (w == min >> 6) bits &= ~uint64_t{0} << (min & 63);
+                if (w == max >> 6) bits &= ~uint64_t{0} >> (63 - (max & 63));
+
+                while (bits) {
+                    int64_t v = w * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+
+                    put_varint(out, v - prev - 1);
+                    prev = v;
+                    ++count;
+                }
+            }
+
+            return count;
+        }
+
+        /**
+         * Encode the unset bits in [min, max] of words as one chunk, appending to out. Returns the number of values.
+         */
+        inline uint64_t encode_chunk(const uint64_t* words, int64_t min, int64_t max, std::vector<uint8_t>& out) {
+            int64_t prev = min - 1;
+            return encode_bits(words, 0, min, max, prev, out);
+        }
+
+        /**
+         * Decode a chunk of entry.bytes bytes, calling f(value) for each value in increasing order
+         */
+        template <typename F>
+            void decode_chunk(const ChunkEntry& entry, const uint8_t* data, F f) {
+                const uint8_t* end = data + entry.bytes;
+                int64_t v = entry.min - 1;
+
+                for (uint64_t i = 0; i < entry.count; ++i) {
+                    v += static_cast<int64_t>(get_varint(data, end)) + 1;
+                    if (v > entry.max) throw std::runtime_error("Corrupt export chunk");
+
+                    f(v);
+                }
+            }
+    }
+
+    /**
+     * Writer for the export format. Chunks are either handed over already encoded, in order (write_chunk), or the
+     * bitmap is appended piece by piece in increasing order (append), e.g. while it is being computed. The file is
+     * written under a temporary name and only renamed into place by finish(), once synced; an unfinished export
+     * removes it.
+     */
+    class UnreachableWriter {
+        std::string filename, temporary;
+        Checkpoint::File file;
+
+        Export::Header header{};
+        std::vector<Export::ChunkEntry> table;
+        uint64_t offset = sizeof(Export::Header);
+
+        // Chunk being filled by append, and the encoding state within it
+        int64_t current = 0;
+        int64_t prev = 0;
+        uint64_t pending_count = 0;
+        std::vector<uint8_t> pending;
+        // Next value expected by append
+        int64_t next_value;
+        bool finished = false;
+    public:
+        UnreachableWriter(const char* filename, int64_t min, int64_t max) : filename(filename),
+                temporary(std::string{filename} + ".tmp"), file(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC),
+                next_value(min) {
+            std::memcpy(header.magic, Export::MAGIC, sizeof(Export::MAGIC));
+            header.version = Export::VERSION;
+            header.min = min;
+            header.max = max;
+            header.chunk_count = (max >= min) ? (max - min) / Export::CHUNK_BITS + 1 : 0;
+
+            table.resize(header.chunk_count);
+            for (uint64_t c = 0; c < header.chunk_count; ++c) {
+                table[c].min = min + c * Export::CHUNK_BITS;
+                table[c].max = std::min(max, table[c].min + Export::CHUNK_BITS - 1);
+            }
+
+            prev = min - 1;
+            file.write_all(&header, sizeof(Export::Header));
+        }
+
+        UnreachableWriter(const UnreachableWriter&) = delete;
+        UnreachableWriter& operator=(const UnreachableWriter&) = delete;
+
+        ~UnreachableWriter() {
+            if (!finished) unlink(temporary.c_str());
+        }
+
+        int64_t chunk_count() const {
+            return table.size();
+        }
+
+        /**
+         * Range of values covered by chunk c
+         */
+        const Export::ChunkEntry& chunk(int64_t c) const {
+            return table[c];
+        }
+
+        /**
+         * Write the encoding of chunk c, which must be the next chunk of the file
+         */
+        void write_chunk(int64_t c, uint64_t count, const std::vector<uint8_t>& bytes) {
+            table[c].count = count;
+            table[c].offset = offset;
+            table[c].bytes = bytes.size();
+            table[c].checksum = Checkpoint::checksum(bytes.data(), bytes.size());
+            file.write_all(bytes.data(), bytes.size());
+
+            offset += bytes.size();
+            header.count += count;
+
+            current = c + 1;
+            next_value = table[c].max + 1;
+        }
+
+        /**
+         * Append the values [next value, last], where words[0] holds the bits starting at 64 * base_word
+         */
+        void append(const uint64_t* words, int64_t base_word, int64_t last) {
+            last = std::min(last, header.max);
+
+            while (next_value <= last) {
+                int64_t end = std::min(last, table[current].max);
+
+                pending_count += Export::encode_bits(words, base_word, next_value, end, prev, pending);
+                next_value = end + 1;
+
+                if (end == table[current].max) {
+                    write_chunk(current, pending_count, pending);
+
+                    pending.clear();
+                    pending_count = 0;
+                    prev = end;
+                }
+            }
+        }
+
+        void finish() {
+            if (current < chunk_count()) {
+                throw std::runtime_error("Export finished before all values were appended");
+            }
+
+            header.table_offset = offset;
+            header.table_checksum = Export::table_checksum(header, table);
+            file.write_all(table.data(), table.size() * sizeof(Export::ChunkEntry));
+            file.write_all_at(&header, sizeof(Export::Header), 0);
+
+            if (fsync(file.descriptor()) != 0) {
+                throw std::runtime_error("Failed to sync export");
+            }
+
+            if (rename(temporary.c_str(), filename.c_str()) != 0) {
+                throw std::runtime_error("Failed to rename export to " + filename);
+            }
+
+            finished = true;
+        }
+    };
+
+    /**
+     * Write the unset bits of words in [min, max]. Chunks are encoded in parallel, in batches that are written out
+     * in order, so memory use stays bounded by a few chunks per thread.
+     */
+    inline void export_unreachable(const char* filename, const uint64_t* words, int64_t min, int64_t max,
+            int thread_count = 1) {
+        UnreachableWriter writer{filename, min, max};
+
+        int64_t batch = std::max(1, thread_count) * 4;
+        std::vector<std::vector<uint8_t>> buffers(batch);
+        std::vector<uint64_t> counts(batch);
+
+        for (int64_t first = 0; first < writer.chunk_count(); first += batch) {
+            int64_t last = std::min<int64_t>(first + batch, writer.chunk_count());
+            std::atomic<int64_t> next{first};
+
+            auto work = [&] (int) {
+                int64_t c;
+                while ((c = next.fetch_add(1, std::memory_order_relaxed)) < last) {
+                    buffers[c - first].clear();
+                    counts[c - first] = Export::encode_chunk(words, writer.chunk(c).min, writer.chunk(c).max,
+                            buffers[c - first]);
+                }
+            };
+
+            if (thread_count > 1 && last - first > 1) {
+                ThreadPool::shared().run(thread_count, work);
+            } else {
+                work(0);
+            }
+
+            for (int64_t c = first; c < last; ++c) {
+                writer.write_chunk(c, counts[c - first], buffers[c - first]);
+            }
+        }
+
+        writer.finish();
+    }
+
+    /**
+     * Reader for files written by export_unreachable. Iterating yields every value in increasing order, reading one
+     * chunk at a time; chunks can also be decoded independently (e.g. by several threads).
+     */
+    class UnreachableReader {
+        Checkpoint::File file;
+        Export::Header header;
+        std::vector<Export::ChunkEntry> table;
+
+        // Read the encoded bytes of chunk i into data, checking them against the table
+        void read_chunk(int64_t i, std::vector<uint8_t>& data) {
+            data.resize(table[i].bytes);
+            file.read_all(data.data(), data.size(), table[i].offset);
+
+            if (Checkpoint::checksum(data.data(), data.size()) != table[i].checksum) {
+                throw std::runtime_error("Export chunk " + std::to_string(i) + " checksum mismatch");
+            }
+        }
+    public:
+        explicit UnreachableReader(const char* filename) : file(filename, O_RDONLY) {
+            file.read_all(&header, sizeof(header), 0);
+
+            if (std::memcmp(header.magic, Export::MAGIC, sizeof(Export::MAGIC)) != 0) {
+                throw std::runtime_error("Not an unreachable value export");
+            }
+
+            if (header.version != Export::VERSION) {
+                throw std::runtime_error("Unsupported export version " + std::to_string(header.version));
+            }
+
+            // The table ends the file, so its size bounds the chunk count before anything is allocated
+            struct stat st;
+            if (fstat(file.descriptor(), &st) != 0 || header.table_offset < sizeof(Export::Header)
+                    || header.table_offset > (uint64_t)st.st_size
+                    || header.chunk_count != (st.st_size - header.table_offset) / sizeof(Export::ChunkEntry)) {
+                throw std::runtime_error("Corrupt export header");
+            }
+
+            table.resize(header.chunk_count);
+            file.read_all(table.data(), table.size() * sizeof(Export::ChunkEntry), header.table_offset);
+
+            if (Export::table_checksum(header, table) != header.table_checksum) {
+                throw std::runtime_error("Export table checksum mismatch");
+            }
+
+            // Each varint takes at least a byte, and the chunks lie between the header and the table
+            uint64_t count = 0;
+            for (auto& entry : table) {
+                if (entry.offset < sizeof(Export::Header) || entry.offset > header.table_offset
+                        || entry.bytes > header.table_offset - entry.offset || entry.count > entry.bytes
+                        || entry.min > entry.max) {
+                    throw std::runtime_error("Corrupt export table");
+                }
+
+                count += entry.count;
+            }
+
+            if (count != header.count) {
+                throw std::runtime_error("Corrupt export table");
+            }
+        }
+
+        int64_t min() const { return header.min; }
+        int64_t max() const { return header.max; }
+
+        /**
+         * Total number of values
+         */
+        int64_t size() const {
+            return header.count;
+        }
+
+        int64_t chunk_count() const {
+            return table.size();
+        }
+
+        const Export::ChunkEntry& chunk(int64_t i) const {
+            return table[i];
+        }
+
+        /**
+         * Decode chunk i, calling f(value) for each value
+         */
+        template <typename F>
+            void for_each_in_chunk(int64_t i, F f) {
+                std::vector<uint8_t> data;
+                read_chunk(i, data);
+
+                Export::decode_chunk(table[i], data.data(), f);
+            }
+
+        class iterator {
+            UnreachableReader* reader = nullptr;
+            int64_t chunk = 0;
+            uint64_t remaining = 0;
+
+            std::vector<uint8_t> data;
+            const uint8_t* p = nullptr;
+            const uint8_t* data_end = nullptr;
+            int64_t value = 0;
+
+            // Advance to the next value, loading chunks as needed; becomes the end iterator when exhausted
+            void advance() {
+                while (remaining == 0) {
+                    if (++chunk >= reader->chunk_count()) {
+                        reader = nullptr;
+                        return;
+                    }
+
+                    load();
+                }
+
+                value += static_cast<int64_t>(Export::get_varint(p, data_end)) + 1;
+                if (value > reader->table[chunk].max) throw std::runtime_error("Corrupt export chunk");
+
+                --remaining;
+            }
+
+            void load() {
+                auto& entry = reader->table[chunk];
+
+                reader->read_chunk(chunk, data);
+
+                p = data.data();
+                data_end = p + data.size();
+                remaining = entry.count;
+                value = entry.min - 1;
+            }
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = int64_t;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const int64_t*;
+            using reference = const int64_t&;
+
+            iterator() = default;
+
+            explicit iterator(UnreachableReader* reader) : reader(reader), chunk(-1) {
+                advance();
+            }
+
+            const int64_t& operator*() const {
+                return value;
+            }
+
+            iterator& operator++() {
+                advance();
+                return *this;
+            }
+
+            void operator++(int) {
+                advance();
+            }
+
+            bool operator==(const iterator& other) const {
+                return reader == other.reader && (!reader || (chunk == other.chunk && remaining == other.remaining));
+            }
+        };
+
+        iterator begin() {
+            return iterator{this};
+        }
+
+        iterator end() {
+            return iterator{};
+        }
+    };
+}
@@ -1,22 +1,32 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <initializer_list>
 #include <vector>
 #include <functional>
 #include <optional>
 #include <string>
 #include <memory>
-#include <bitset>
+#include <span>
 #include <immintrin.h>
 
+#include "backward_descent.h"
+#include "bit_scan.h"
+#include "bitmap_storage.h"
+#include "checkpoint.h"
+#include "compressed_bitmap.h"
+#include "export.h"
 #include "map_def.h"
-
-namespace {
-    // Count the number of set bits in [start, start + count), where count is in bytes
-    int64_t vectorized_popcnt(void* start, size_t count) {
-
-    }
-}
+#include "point_query.h"
+#include "popcount.h"
+#include "progress.h"
+#include "provenance.h"
+#include "rank_select.h"
+#include "residue_stats.h"
+#include "word_kernel.h"
 
 namespace Affine {
     struct ExecutionOpts {
@@ -27,8 +37,20 @@ namespace Affine {
 
         // Does not need to be thread-safe
         std::optional<std::function<void(double /* progress */)>> progress_callback;
+        // Same, with throughput and ETA
+        std::optional<std::function<void(const ProgressReport&)>> progress_report_callback;
         // In seconds
         int callback_frequency = 1;
+
+        // Both progress callbacks as one, or an empty function if neither is set
+        std::function<void(const ProgressReport&)> progress_reporter() const {
+            if (!progress_callback && !progress_report_callback) return {};
+
+            return [fraction = progress_callback, report = progress_report_callback] (const ProgressReport& r) {
+                if (fraction) (*fraction)(r.progress);
+                if (report) (*report)(r);
+            };
+        }
     };
 
     struct IterateMapOpts : public ExecutionOpts {
@@ -36,7 +58,61 @@ namespace Affine {
         int64_t max = -1;
     };
 
-    constexpr int64_t _DEFAULT_MAX_ENTRY = 1'000'000'000;
+    // Limits for compute_till_async, which stops between steps once either is exceeded; zero means no limit
+    struct ComputeBudget {
+        double max_seconds = 0;
+        // Bitmap size, so values are computed up to at most 8 * max_bytes - 1
+        int64_t max_bytes = 0;
+    };
+
+    namespace Async {
+        // Values computed per step of compute_till_async, between which cancellation and the budget are checked
+        constexpr int64_t STEP_BITS = int64_t{1} << 28;
+    }
+
+    /**
+     * A computation running in the background. Destroying it cancels it and waits for the step in progress.
+     */
+    class ComputeTask {
+        std::future<int64_t> result;
+        std::shared_ptr<std::atomic<bool>> cancelled;
+    public:
+        ComputeTask(std::future<int64_t> result, std::shared_ptr<std::atomic<bool>> cancelled) :
+            result(std::move(result)), cancelled(std::move(cancelled)) {
+
+        }
+
+        ComputeTask(ComputeTask&&) = default;
+        ComputeTask& operator=(ComputeTask&&) = default;
+
+        ~ComputeTask() {
+            if (result.valid()) {
+                cancel();
+                result.wait();
+            }
+        }
+
+        /**
+         * Stop after the step in progress
+         */
+        void cancel() {
+            cancelled->store(true, std::memory_order_relaxed);
+        }
+
+        bool is_ready() const {
+            return result.wait_for(std::chrono::seconds{0}) == std::future_status::ready;
+        }
+
+        /**
+         * Wait for the computation and return the maximum value reached, rethrowing anything it threw
+         */
+        int64_t get() {
+            return result.get();
+        }
+    };
+
+    // Only bounds the values that may be computed: storage is committed as compute_till advances
+    constexpr int64_t _DEFAULT_MAX_ENTRY = 1'000'000'000'000;
 
     // Callback of the form (i, bool reachable) that can be applied to any solution
     template<class T>
@@ -44,9 +120,19 @@ namespace Affine {
             { x(int64_t{}, bool{}) } -> std::same_as<void>;
         };
 
+    // One step of a derivation chain: value was obtained by applying map (an index into the map set) to the
+    // previous value, or is an initial value if map is -1
+    struct DerivationStep {
+        int64_t value;
+        int map;
+    };
+
     template <AffineMapSet, int64_t>
         class StandardIterateMap;
 
+    template <AffineMapSet, int64_t>
+        class VectorizedIterateMap;
+
     // Base iterate map class that all analyzers should implement
     // @tparam maps Set of linear maps to analyze
     // @tparam max_entry Maximum number to consider when iterating, exclusive
@@ -55,6 +141,9 @@ namespace Affine {
             template<AffineMapSet, int64_t>
             friend class StandardIterateMap;
 
+            template<AffineMapSet, int64_t>
+            friend class VectorizedIterateMap;
+
         public:
             static constexpr int64_t DEFAULT_MAX_ENTRY = _DEFAULT_MAX_ENTRY; 
         protected:
@@ -62,6 +151,37 @@ namespace Affine {
 
             std::vector<int64_t> _initial_values;
 
+            // Optional rank/select index over [0, _max_reached]
+            bool _use_rank_index = false;
+            RankSelectIndex _rank_index;
+
+            // Optional record of a producing map for every computed reachable value
+            ProvenanceIndex<Maps> _provenance{(max_entry + 63) / 64 + 1};
+
+            // Meter of the running computation, if progress is being reported
+            ProgressMeter* _progress = nullptr;
+
+            // Memoized descent for values beyond _max_reached
+            BackwardDescent<Maps> _descent;
+
+            // Values in [0, _finalized] are final and may be read while compute_till runs on another thread. Engines
+            // that support this advance it as blocks complete; the others leave it at -1. It always ends a whole word,
+            // since the word holding an unaligned max_reached is written again when the computation resumes.
+            std::atomic<int64_t> _finalized{-1};
+
+            // Last value of the last whole word in [0, max], or -1 if there is none
+            static constexpr int64_t whole_words_end(int64_t max) {
+                return ((max + 1) & ~int64_t{63}) - 1;
+            }
+
+            // Move the watermark forward to the whole words up to max (never back), once they are written
+            void publish(int64_t max) {
+                max = whole_words_end(max);
+                int64_t current = _finalized.load(std::memory_order_relaxed);
+                while (current < max && !_finalized.compare_exchange_weak(current, max, std::memory_order_release,
+                            std::memory_order_relaxed));
+            }
+
             void range_bounds_check(int64_t min, int64_t max) {
                 min = (min < 0) ? 0 : min;
                 if (max < min || max > _max_reached) {
@@ -70,22 +190,93 @@ namespace Affine {
                 }
             }
 
-            virtual int64_t count_solutions_impl(int64_t min, int64_t max) = 0;
+            virtual int64_t count_solutions_impl(int64_t min, int64_t max, const ExecutionOpts& opts) = 0;
+
+            /**
+             * Underlying bitmap as little-endian 64-bit words (bit i is bit i % 64 of word i / 64)
+             */
+            virtual const uint64_t* word_data() = 0;
+
+            /**
+             * Bring the rank/select index (if enabled) up to date with _max_reached; engines call this at the end of
+             * compute_till
+             */
+            void update_rank_index(const ExecutionOpts& opts) {
+                if (_use_rank_index && _max_reached >= 0) {
+                    _rank_index.extend(word_data(), _max_reached + 1, opts.use_threads ? opts.num_threads : 1);
+                }
+            }
+
+            void require_rank_index() {
+                if (!_use_rank_index) {
+                    throw std::runtime_error("Rank/select index is not enabled (see enable_rank_index)");
+                }
+            }
+
+            /**
+             * Report progress on total_bits of work done by up to thread_count threads until the scope ends. Engines
+             * add to _progress once per tile or block, never in the kernels themselves.
+             */
+            ProgressScope progress_scope(const ExecutionOpts& opts, int64_t total_bits, int thread_count) {
+                return ProgressScope{_progress, opts.progress_reporter(), (double)opts.callback_frequency, total_bits,
+                        thread_count};
+            }
+
+            // Checked separately from the lookups so that a bad query is reported before any thread starts
+            void batch_bounds_check(std::span<const int64_t> queries) {
+                for (int64_t i : queries) {
+                    if (i < 0 || i > _max_reached) {
+                        throw std::runtime_error("Attempted to access value " + std::to_string(i)
+                                + " out of bounds [0.." + std::to_string(_max_reached) + "]");
+                    }
+                }
+            }
+
+            // Values beyond _max_reached are decided by descent, which needs [0, 2] to terminate
+            void extended_bounds_check(int64_t n) {
+                if (_max_reached < 2) {
+                    throw std::runtime_error("Values beyond the table need at least [0..2] computed");
+                }
+
+                if (n < 0 || n > Descent::MAX_VALUE) {
+                    throw std::runtime_error("Attempted to access value " + std::to_string(n)
+                            + " out of bounds [0.." + std::to_string(Descent::MAX_VALUE) + "]");
+                }
+            }
+
+            bool descend(int64_t n, const uint64_t* words) {
+                return _descent.is_reachable(n, _max_reached, [words] (int64_t k) {
+                    return (words[k >> 6] >> (k & 63)) & 1;
+                });
+            }
+
+            // Provenance isn't part of checkpoints, so it can't cover a loaded bitmap
+            void check_provenance_on_load() {
+                if (_provenance.is_enabled()) {
+                    throw std::runtime_error("Cannot read a checkpoint while provenance is enabled");
+                }
+            }
+
+            // Replace the initial values, and with them the descent memo, which is only filled for one set of them.
+            // Queries don't touch the initial values, so they can share the memo without syncing it.
+            void assign_initial(std::vector<int64_t> values) {
+                _descent.set_initial(values);
+                _initial_values = std::move(values);
+            }
         public:
             /**
              * Set the initial values from which the map will be iterated (e.g., { 1 })
              */
             virtual void set_initial(std::initializer_list<int64_t> initial) {
-                _initial_values.clear();
                 for (int64_t i : initial) {
                     if (i < 0 || i >= max_entry) {
                         throw std::runtime_error{"Invalid initial value " + std::to_string(i) + "; must be in range [0.."
                                 + std::to_string(max_entry - 1)};
                                 
                     }
-
-                    _initial_values.push_back(i);
                 }
+
+                assign_initial(initial);
             }
 
             /**
@@ -110,6 +301,78 @@ namespace Affine {
                 return _max_reached;
             }
 
+            /**
+             * Largest value below which everything is final, inclusive. Unlike max_reached(), this may be read while
+             * compute_till runs on another thread, and grows as it advances (in the standard and vectorized engines).
+             * It ends on a word boundary, so it trails an unaligned max_reached() by up to 63 values.
+             */
+            int64_t finalized() const {
+                return _finalized.load(std::memory_order_acquire);
+            }
+
+            /**
+             * Whether n is reachable if n is at most finalized(), or nothing otherwise. Safe to call from any thread
+             * while compute_till or compute_till_async runs, without locks.
+             */
+            std::optional<bool> try_is_reachable(int64_t n) {
+                if (n < 0 || n > finalized()) return std::nullopt;
+
+                const uint64_t* words = word_data();
+                return (words[n >> 6] >> (n & 63)) & 1;
+            }
+
+            /**
+             * Number of reachable values in [min, max], which must be within [0, finalized()] (max == -1 means
+             * finalized()). Safe to call while computing, like try_is_reachable.
+             */
+            int64_t count_finalized(int64_t min=0, int64_t max=-1) {
+                int64_t limit = finalized();
+                if (max == -1) max = limit;
+
+                min = std::max(min, int64_t{0});
+                if (max < min || max > limit) {
+                    throw std::runtime_error("Invalid bounds min=" + std::to_string(min) + ", max="
+                            + std::to_string(max) + " for finalized prefix [0.." + std::to_string(limit) + "]");
+                }
+
+                return count_bits_parallel(word_data(), min, max, 1);
+            }
+
+            /**
+             * Run compute_till on a background thread, in steps of Async::STEP_BITS values, stopping early if the
+             * task is cancelled or the budget runs out; the task's result is the maximum value reached. Queries
+             * up to finalized() may be made meanwhile, but nothing else until the task is finished.
+             */
+            ComputeTask compute_till_async(const IterateMapOpts& opts, ComputeBudget budget={}) {
+                auto cancelled = std::make_shared<std::atomic<bool>>(false);
+
+                auto future = std::async(std::launch::async, [this, opts, budget, cancelled] {
+                    auto start = std::chrono::steady_clock::now();
+                    int64_t max = (opts.max < 0) ? max_entry - 1 : opts.max;
+                    if (budget.max_bytes > 0) max = std::min(max, 8 * budget.max_bytes - 1);
+
+                    auto out_of_time = [&] {
+                        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                        return budget.max_seconds > 0 && elapsed.count() >= budget.max_seconds;
+                    };
+
+                    // One report covers all the steps
+                    auto progress = progress_scope(opts, max - _max_reached, opts.use_threads ? opts.num_threads : 1);
+                    IterateMapOpts step = opts;
+
+                    while (_max_reached < max && !cancelled->load(std::memory_order_relaxed) && !out_of_time()) {
+                        // Steps end on word boundaries, so no word is computed twice
+                        step.max = std::min(max, ((_max_reached + 1) >> 6 << 6) + Async::STEP_BITS - 1);
+                        compute_till(step);
+                    }
+
+                    if (_max_reached >= max) progress.finish();
+                    return _max_reached;
+                });
+
+                return ComputeTask{std::move(future), std::move(cancelled)};
+            }
+
             /**
              * Get the underlying maps of the analyzer
              */
@@ -135,13 +398,185 @@ namespace Affine {
             }
 
             /**
-             * Count the number of solutions in [min, max], inclusive
+             * Whether each of queries is reachable, into results (of the same size). Throws if any query is outside
+             * [0, max_reached()]. Queries are looked up in the given order, four per AVX2 gather with later ones
+             * prefetched; large batches are split across threads if opts.use_threads is set.
              */
-            virtual int64_t count_solutions(int64_t min=0, int64_t max=-1) {
+            void is_reachable_batch(std::span<const int64_t> queries, std::span<bool> results,
+                    const ExecutionOpts& opts={}) {
+                if (results.size() != queries.size()) {
+                    throw std::runtime_error("Expected " + std::to_string(queries.size()) + " results, got "
+                            + std::to_string(results.size()));
+                }
+
+                batch_bounds_check(queries);
+
+                bool* out = results.data();
+                int thread_count = opts.use_threads ? opts.num_threads : 1;
+                lookup_bits_parallel(word_data(), queries.data(), queries.size(), thread_count,
+                        [&] (int64_t w, uint64_t bits) {
+                    int64_t n = std::min((int64_t)queries.size() - w * 64, int64_t{64});
+                    for (int64_t j = 0; j < n; ++j) out[w * 64 + j] = (bits >> j) & 1;
+                });
+            }
+
+            /**
+             * is_reachable_batch with packed results: bit i % 64 of results[i / 64] is whether queries[i] is
+             * reachable, and results needs (queries.size() + 63) / 64 words. Bits past the last query are cleared.
+             */
+            void is_reachable_batch(std::span<const int64_t> queries, std::span<uint64_t> results,
+                    const ExecutionOpts& opts={}) {
+                if (results.size() != (queries.size() + 63) / 64) {
+                    throw std::runtime_error("Expected " + std::to_string((queries.size() + 63) / 64)
+                            + " result words, got " + std::to_string(results.size()));
+                }
+
+                batch_bounds_check(queries);
+
+                uint64_t* out = results.data();
+                int thread_count = opts.use_threads ? opts.num_threads : 1;
+                lookup_bits_parallel(word_data(), queries.data(), queries.size(), thread_count,
+                        [&] (int64_t w, uint64_t bits) {
+                    out[w] = bits;
+                });
+            }
+
+            /**
+             * Whether n is reachable, for any n in [0, 2^62]. Values beyond max_reached() are decided by descending
+             * through their predecessors into the computed bitmap (see backward_descent.h), memoized across calls.
+             */
+            bool is_reachable_extended(int64_t n) {
+                extended_bounds_check(n);
+                return descend(n, word_data());
+            }
+
+            /**
+             * is_reachable_extended for each of queries, into results (of the same size). The queries share the
+             * memo, and are split across threads if opts.use_threads is set.
+             */
+            void is_reachable_extended_batch(std::span<const int64_t> queries, std::span<bool> results,
+                    const ExecutionOpts& opts={}) {
+                if (results.size() != queries.size()) {
+                    throw std::runtime_error("Expected " + std::to_string(queries.size()) + " results, got "
+                            + std::to_string(results.size()));
+                }
+
+                for (int64_t n : queries) extended_bounds_check(n);
+
+                const uint64_t* words = word_data();
+                int64_t count = queries.size(), blocks = (count + 63) / 64;
+                std::atomic<int64_t> next{0};
+
+                auto work = [&] (int) {
+                    int64_t b;
+                    while ((b = next.fetch_add(1, std::memory_order_relaxed)) < blocks) {
+                        for (int64_t i = b * 64; i < std::min(count, b * 64 + 64); ++i) {
+                            results[i] = descend(queries[i], words);
+                        }
+                    }
+                };
+
+                int thread_count = opts.use_threads ? opts.num_threads : 1;
+                if (thread_count > 1 && blocks > 1) {
+                    ThreadPool::shared().run(thread_count, work);
+                } else {
+                    work(0);
+                }
+            }
+
+            /**
+             * Count the number of solutions (reachable values) in [min, max], inclusive. Large ranges are split across
+             * threads if opts.use_threads is set.
+             */
+            virtual int64_t count_solutions(int64_t min=0, int64_t max=-1, const ExecutionOpts& opts={}) {
                 if (max == -1) max = _max_reached;
                 range_bounds_check(min, max); 
 
-                return count_solutions_impl(min, max);
+                min = std::max(min, int64_t{0});
+                if (_use_rank_index && max < _rank_index.size()) {
+                    return _rank_index.count(word_data(), min, max);
+                }
+
+                return count_solutions_impl(min, max, opts);
+            }
+
+            /**
+             * Keep a rank/select index (about 3% of the bitmap) that makes count_solutions O(1) and enables
+             * nth_reachable/nth_unreachable. The index is built now if anything is computed, and then extended by
+             * every compute_till.
+             */
+            void enable_rank_index(bool enable=true, const ExecutionOpts& opts={}) {
+                _use_rank_index = enable;
+
+                if (enable) {
+                    update_rank_index(opts);
+                } else {
+                    _rank_index.clear();
+                }
+            }
+
+            /**
+             * The k-th (0-based) reachable value in [0, max_reached()], or -1 if there are at most k of them.
+             * Requires the rank/select index.
+             */
+            int64_t nth_reachable(int64_t k) {
+                require_rank_index();
+                return _rank_index.select<true>(word_data(), k);
+            }
+
+            /**
+             * The k-th (0-based) unreachable value in [0, max_reached()], or -1 if there are at most k of them.
+             * Requires the rank/select index.
+             */
+            int64_t nth_unreachable(int64_t k) {
+                require_rank_index();
+                return _rank_index.select<false>(word_data(), k);
+            }
+
+            /**
+             * Record, while computing, which map produces each reachable value (ceil(log2(map_count)) extra bits per
+             * value), so that derivation() can reconstruct a witness chain. Must be enabled before anything is computed.
+             */
+            void enable_provenance(bool enable=true) {
+                if (enable && _max_reached >= 0) {
+                    throw std::runtime_error("Provenance must be enabled before computing (call clear_data first)");
+                }
+
+                _provenance.enable(enable);
+            }
+
+            /**
+             * Chain of values from an initial value to the reachable value n, each obtained from the previous one by
+             * the map in its step. Requires provenance.
+             */
+            std::vector<DerivationStep> derivation(int64_t n) {
+                if (!_provenance.is_enabled()) {
+                    throw std::runtime_error("Provenance is not enabled (see enable_provenance)");
+                }
+
+                if (n < 0 || n > _max_reached || !is_reachable(n)) {
+                    throw std::runtime_error("Value " + std::to_string(n) + " is not a computed reachable value");
+                }
+
+                const auto coeffs = Maps.get_coeffs();
+                std::vector<DerivationStep> chain;
+
+                while (std::find(_initial_values.begin(), _initial_values.end(), n) == _initial_values.end()) {
+                    int m = _provenance.producer(n);
+                    chain.push_back({ n, m });
+
+                    // Each step at least halves the value, apart from a few steps among tiny values
+                    if (chain.size() > 256) {
+                        throw std::runtime_error("Inconsistent provenance for value " + std::to_string(n));
+                    }
+
+                    n = (n - coeffs[m].second) / coeffs[m].first;
+                }
+
+                chain.push_back({ n, -1 });
+                std::reverse(chain.begin(), chain.end());
+
+                return chain;
             }
 
             /**
@@ -153,25 +588,73 @@ namespace Affine {
                 if (max == -1) max = _max_reached;
                 range_bounds_check(min, max); 
 
-                {
-                    auto m = dynamic_cast<StandardIterateMap<Maps, max_entry>*>(this);
-                    if (m) { 
-                        m->for_each_solution_impl(min, max, l);
-                        return;
-                    }
-                }
+                for_each_bit_value(word_data(), std::max(min, int64_t{0}), max, l);
+            }
+
+            /**
+             * Call f(i) for every reachable i in [min, max], optionally only in a residue class. Words are scanned
+             * for set bits, so the cost is one step per 64 values plus one call per hit.
+             */
+            template <typename F>
+            void for_each_reachable(F f, int64_t min=0, int64_t max=-1, ResidueClass c={}) {
+                if (max == -1) max = _max_reached;
+                range_bounds_check(min, max);
+
+                for_each_bit<true>(word_data(), std::max(min, int64_t{0}), max, c, f);
+            }
+
+            /**
+             * Call f(i) for every unreachable i in [min, max], optionally only in a residue class
+             */
+            template <typename F>
+            void for_each_unreachable(F f, int64_t min=0, int64_t max=-1, ResidueClass c={}) {
+                if (max == -1) max = _max_reached;
+                range_bounds_check(min, max);
+
+                for_each_bit<false>(word_data(), std::max(min, int64_t{0}), max, c, f);
+            }
+
+            /**
+             * Write the unreachable values in [min, max] to a compressed file (see export.h), which can be read back
+             * with UnreachableReader
+             */
+            void export_unreachable(const char* filename, int64_t min=0, int64_t max=-1, const ExecutionOpts& opts={}) {
+                if (max == -1) max = _max_reached;
+                range_bounds_check(min, max);
+
+                Affine::export_unreachable(filename, word_data(), std::max(min, int64_t{0}), max,
+                        opts.use_threads ? opts.num_threads : 1);
+            }
+
+            /**
+             * Compressed copy of [0, max_reached()] answering is_reachable, range counts and iteration on its own
+             * (see compressed_bitmap.h), so that a process only querying the results can clear_data() afterwards
+             */
+            CompressedBitmap compress(const ExecutionOpts& opts={}) {
+                return CompressedBitmap{word_data(), _max_reached + 1, opts.use_threads ? opts.num_threads : 1};
+            }
 
-                throw std::runtime_error("Could not downcast iterate map");
+            /**
+             * Count, first, last and largest gap of the unreachable values in [min, max] in every residue class of
+             * each of the moduli, from a single sweep over the bitmap
+             */
+            ResidueStats residue_stats(std::vector<int> moduli, int64_t min=0, int64_t max=-1,
+                    const ExecutionOpts& opts={}) {
+                if (max == -1) max = _max_reached;
+                range_bounds_check(min, max);
+
+                return ResidueStats::compute(word_data(), std::max(min, int64_t{0}), max, std::move(moduli),
+                        opts.use_threads ? opts.num_threads : 1);
             }
 
             /**
-             * Essentially save the current progress by writing to a file
+             * Essentially save the current progress by writing to a file (see checkpoint.h for the format)
              */
             virtual void write_to_file(const char* filename) = 0;
         };
 
     /**
-     * Straightforward solution which uses a bitset and simply iterates over the numbers directly. This method
+     * Straightforward solution which uses a bitmap and simply iterates over the numbers directly. This method
      * is also platform-agnostic, which is obviously nice.
      */
     template<AffineMapSet Maps, int64_t max_entry=_DEFAULT_MAX_ENTRY>
@@ -180,27 +663,61 @@ namespace Affine {
                 friend class IterateMap;
 
         protected:
-            using BitsetType = std::bitset<max_entry>;
+            static constexpr int64_t PROGRESS_BLOCK = 1 << 16;
 
-            std::unique_ptr<BitsetType> entries;
+            BitmapStorage entries;
 
-            template<typename L>
-            void for_each_solution_impl(int64_t min, int64_t max, L l) {
-                for (int64_t i = min; i <= max; ++i) {
-                    l(i, (*entries)[i]);
-                }
+            bool get_bit(int64_t i) const {
+                return (entries.data()[i >> 6] >> (i & 63)) & 1;
             }
 
-            int64_t count_solutions_impl(int64_t min, int64_t max) {
-                return entries->count();
+            void set_bit(int64_t i) {
+                entries.data()[i >> 6] |= uint64_t{1} << (i & 63);
+            }
+
+            const uint64_t* word_data() {
+                return entries.data();
+            }
+
+            int64_t count_solutions_impl(int64_t min, int64_t max, const ExecutionOpts& opts) {
+                return count_bits_parallel(word_data(), min, max, opts.use_threads ? opts.num_threads : 1);
             }
         public:
-            StandardIterateMap() {
-                entries = std::make_unique<BitsetType>(); // initializes to 0 by default
+            // Only reserves address space; memory is committed as compute_till advances
+            StandardIterateMap() : entries((max_entry + 63) / 64) {
+
             }
 
             void read_from_file(const char* filename) {
+                Checkpoint::File file{filename, O_RDONLY};
+                auto contents = Checkpoint::read_metadata(file);
+
+                Checkpoint::check_maps<Maps>(contents);
+                this->check_provenance_on_load();
 
+                if (contents.header.max_reached >= max_entry) {
+                    throw std::runtime_error("Checkpoint exceeds max entry (max_reached="
+                            + std::to_string(contents.header.max_reached) + ")");
+                }
+
+                int64_t words = (contents.header.max_reached + 64) / 64;
+
+                entries.reset();
+                entries.ensure(words);
+                file.read_all(entries.data(), words * sizeof(uint64_t), contents.header.bitmap_offset);
+
+                this->assign_initial(contents.initial_values);
+                this->_max_reached = contents.header.max_reached;
+
+                // Every value is computed bit by bit from the start, so there is no prefix to redo
+                Checkpoint::restore_unsaved(this->_max_reached, this->_initial_values, 0, [&] (int64_t i) {
+                    entries.ensure((i >> 6) + 1);
+                    set_bit(i);
+                }, [] {});
+
+                this->_finalized.store(this->whole_words_end(this->_max_reached), std::memory_order_release);
+                this->_rank_index.clear();
+                this->update_rank_index({});
             }
 
             void compute_till(const IterateMapOpts& opts) {
@@ -216,44 +733,66 @@ namespace Affine {
                     throw std::runtime_error("Max entry exceeded (max=" + std::to_string(max) +")");
                 }
 
+                entries.ensure((max >> 6) + 1);
+                this->_provenance.ensure((max >> 6) + 1);
+
                 if (max_reached == -1) {
                     for (int64_t i : this->_initial_values) {
-                        (*entries)[i] = 1;
+                        entries.ensure((i >> 6) + 1);
+                        set_bit(i);
                     }
-
-                    max_reached = 0;
                 }
 
                 const auto coeffs = Maps.get_coeffs();
-
-                for (int i = max_reached; i <= max; ++i) {
-                    for (auto &coeff_pair : coeffs) {
-                        int64_t a = coeff_pair.first;
-                        int64_t b = coeff_pair.second;
-
-                        int64_t k = i - b;
-                        if (k % a == 0 && k >= 0) {
-                            if ((*entries)[k / a]) {
-                                (*entries)[i] = true;
-                                break;
+                const bool provenance = this->_provenance.is_enabled();
+
+                auto progress = this->progress_scope(opts, max - max_reached, 1);
+
+                // Progress is counted per block of PROGRESS_BLOCK values, outside the per-bit loop. Values up to
+                // max_reached are not revisited, as their words may already be published.
+                for (int64_t block = max_reached + 1; block <= max; block += PROGRESS_BLOCK) {
+                    int64_t block_end = std::min(max, block + PROGRESS_BLOCK - 1);
+
+                    for (int64_t i = block; i <= block_end; ++i) {
+                        for (int m = 0; m < (int)coeffs.size(); ++m) {
+                            int64_t a = coeffs[m].first;
+                            int64_t b = coeffs[m].second;
+
+                            int64_t k = i - b;
+                            if (k % a == 0 && k >= 0) {
+                                if (get_bit(k / a)) {
+                                    set_bit(i);
+                                    if (provenance) this->_provenance.record(i, m);
+                                    break;
+                                }
                             }
                         }
                     }
+
+                    if (this->_progress) this->_progress->add(0, block_end - block + 1);
+                    this->publish(block_end);
                 }
 
                 this->_max_reached = max;
+                this->update_rank_index(opts);
+                progress.finish();
             }
 
             void clear_data() {
-                entries.clear();
+                entries.reset();
+                this->_max_reached = -1;
+                this->_finalized.store(-1, std::memory_order_release);
+                this->_rank_index.clear();
+                this->_provenance.clear();
+                this->_descent.clear();
             }
 
             bool is_reachable(int64_t i) {
-                return entries[i];
+                return get_bit(i);
             }
 
             void write_to_file(const char* filename) {
-
+                Checkpoint::write(filename, Maps.get_coeffs(), this->_initial_values, this->_max_reached, word_data());
             }
         };
 
@@ -12,17 +12,21 @@ AffineMapSet<
 	> maps;
 
 int main() {
-	auto iterate_map = StandardIterateMap<maps>();
+	auto iterate_map = AutoIterateMap<maps>();
 
 	iterate_map.set_initial({ 1 });
 
 	iterate_map.compute_till({ .max = 1'000'000'00 });
-	iterate_map.for_each_solution([&] (int64_t k, bool r) {
-			if (k % 4 == 3 && !r) {
-				std::cout << k << '\n';
-				}
-				});
+	iterate_map.for_each_unreachable([&] (int64_t k) {
+			std::cout << k << '\n';
+			}, 0, -1, { .modulus = 4, .residue = 3 });
 
 
 	std::cout << iterate_map.maps().apply_once(1)[0] << '\n';
+
+	// Bound for the descent argument in result.tex, and the classes it leaves open
+	DescentCertificate<maps> certificate{{ .modulus = 8, .residue = 7 }};
+	auto result = certificate.search({ { .use_threads = true } });
+	certificate.check(result, iterate_map, { .use_threads = true });
+	std::cout << result.to_string();
 }
@@ -68,7 +68,7 @@ namespace Affine {
             template<int idx> requires AffineMapIndexInRange<idx, map_count>
                 using NthMap = typename std::tuple_element<idx, std::tuple<AffineMaps...> >::type;
 
-            std::array<int64_t, map_count> apply_once(int64_t x) {
+            std::array<int64_t, map_count> apply_once(int64_t x) const {
                 std::array<int64_t, map_count> a;
 
                 for (int i = 0; i < map_count; ++i) {
@@ -0,0 +1,586 @@
+/**
+ * Iterate map engine for tables larger than memory, backed by a file in the checkpoint format.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bitmap_storage.h"
+#include "checkpoint.h"
+#include "iterate_map.h"
+#include "scheduler.h"
+#include "word_kernel.h"
+
+namespace Affine {
+    /**
+     * Word kernel engine whose bitmap lives in a file instead of memory. Every map has a >= 2, so the output words
+     * [w0, w1) only read the words [w0 / a, w1 / a] for each distinct coefficient a: the file is read sequentially
+     * behind the computation, once per distinct coefficient, and written sequentially at its front.
+     *
+     * Output is computed chunk_words at a time, from source windows read with pread, and each finished chunk is
+     * written back by a background thread while the next one is computed. About (2 + sum of 1/a) * chunk_words words
+     * are held in memory, however large the table.
+     *
+     * The file is a checkpoint (see checkpoint.h) that the other engines can read, with room reserved for the block
+     * checksums of the whole range. It is committed (bitmap synced, then the metadata rewritten) at the end of every
+     * compute_till and every COMMIT_WORDS words in between, and constructing an engine on an existing file resumes
+     * from its last commit. Queries read the bitmap through a mapping of the file, i.e. through the page cache.
+     *
+     * Rewriting the metadata in place isn't atomic, so each commit first writes a copy of it to one of two slots of
+     * filename + ".meta", alternating between them. Resuming takes the newest copy that validates, of the file's own
+     * and the two slots: a crash during a commit damages at most one of them, leaving the previous commit or the new
+     * one intact.
+     */
+    template<AffineMapSet Maps, int64_t max_entry=_DEFAULT_MAX_ENTRY>
+        class OutOfCoreIterateMap : public IterateMap<Maps, max_entry> {
+            template<AffineMapSet, int64_t>
+                friend class IterateMap;
+
+            static_assert(Kernel::has_word_kernel<Maps>(), "No word kernel available for this map set");
+
+        public:
+            // Output words computed in memory at a time (32 MB)
+            static constexpr int64_t DEFAULT_CHUNK_WORDS = int64_t{1} << 22;
+
+            // Words computed between commits, bounding the work lost to a crash (2 GB)
+            static constexpr int64_t COMMIT_WORDS = int64_t{1} << 28;
+
+        protected:
+            using KernelType = Kernel::WordKernel<Maps>;
+            static constexpr std::size_t distinct_count = KernelType::distinct.size();
+
+            static constexpr int64_t capacity_words = std::max((max_entry + 63) / 64, KernelType::first_word) + 1;
+            static constexpr int64_t block_words = Checkpoint::BLOCK_BYTES / sizeof(uint64_t);
+
+            std::string filename;
+            int64_t chunk_words;
+
+            std::unique_ptr<Checkpoint::File> file;
+            // Metadata of the file; the layout is fixed by the first computation (bitmap_offset is 0 until then)
+            Checkpoint::Contents contents{};
+
+            // Copies of the metadata, in two slots of bitmap_offset bytes, and the max_reached each holds (-1 if none)
+            std::string metadata_filename;
+            std::unique_ptr<Checkpoint::File> metadata_file;
+            std::array<int64_t, 2> slot_max{ -1, -1 };
+
+            // Mapping of the file for queries
+            BitmapStorage view;
+
+            // The checksums of the blocks before word hashed_words are in contents.block_checksums, and block_hash is
+            // the running checksum of the block containing it. Only final words are hashed.
+            int64_t hashed_words = 0;
+            uint64_t block_hash = Checkpoint::CHECKSUM_SEED;
+
+            static int64_t round_up(int64_t n, int64_t to) {
+                return (n + to - 1) / to * to;
+            }
+
+            int64_t file_offset(int64_t w) const {
+                return contents.header.bitmap_offset + w * sizeof(uint64_t);
+            }
+
+            // Words before this are final (the last computed word may be partial)
+            int64_t final_words() const {
+                return (this->_max_reached + 1) >> 6;
+            }
+
+            // Continue the block checksums with the words [hashed_words, hashed_words + n)
+            void hash(const uint64_t* words, int64_t n) {
+                while (n > 0) {
+                    int64_t block = hashed_words / block_words;
+                    int64_t take = std::min(n, (block + 1) * block_words - hashed_words);
+
+                    block_hash = Checkpoint::checksum(words, take * sizeof(uint64_t), block_hash);
+                    hashed_words += take;
+                    words += take;
+                    n -= take;
+
+                    if (hashed_words % block_words == 0) {
+                        contents.block_checksums.resize(std::max<std::size_t>(contents.block_checksums.size(), block + 1));
+                        contents.block_checksums[block] = block_hash;
+                        block_hash = Checkpoint::CHECKSUM_SEED;
+                    }
+                }
+            }
+
+            // Hash the words [hashed_words, until) as stored in the file
+            void hash_file(int64_t until) {
+                std::vector<uint64_t> buffer;
+
+                while (hashed_words < until) {
+                    int64_t n = std::min(until - hashed_words, block_words);
+                    buffer.resize(n);
+
+                    file->read_all(buffer.data(), n * sizeof(uint64_t), file_offset(hashed_words));
+                    hash(buffer.data(), n);
+                }
+            }
+
+            // Grow the file to hold the words [0, words), page-aligned as in a checkpoint
+            void extend_file(int64_t words) {
+                int64_t size = file_offset(round_up(words * sizeof(uint64_t), PAGE_SIZE) / sizeof(uint64_t));
+
+                struct stat st;
+                if (fstat(file->descriptor(), &st) != 0) {
+                    throw std::runtime_error("Failed to stat " + filename);
+                }
+
+                if (st.st_size < size && ftruncate(file->descriptor(), size) != 0) {
+                    throw std::runtime_error("Failed to extend " + filename + " to " + std::to_string(size) + " bytes");
+                }
+            }
+
+            // Fix the layout of a fresh file, with room for the block checksums of every word up to max_entry
+            void create_layout() {
+                contents = {};
+                std::memcpy(contents.header.magic, Checkpoint::MAGIC, sizeof(Checkpoint::MAGIC));
+                contents.header.version = Checkpoint::VERSION;
+                contents.header.map_count = Maps.map_count;
+                contents.header.max_reached = -1;
+                contents.header.initial_count = this->_initial_values.size();
+                contents.header.block_bytes = Checkpoint::BLOCK_BYTES;
+
+                const auto coeffs = Maps.get_coeffs();
+                contents.coeffs.assign(coeffs.begin(), coeffs.end());
+                contents.initial_values = this->_initial_values;
+
+                int64_t max_blocks = round_up(capacity_words * sizeof(uint64_t), PAGE_SIZE) / Checkpoint::BLOCK_BYTES + 1;
+                contents.block_checksums.resize(max_blocks);
+                contents.header.bitmap_offset = round_up(Checkpoint::metadata_bytes(contents), PAGE_SIZE);
+                contents.block_checksums.clear();
+
+                hashed_words = 0;
+                block_hash = Checkpoint::CHECKSUM_SEED;
+                create_slots();
+            }
+
+            // Start the metadata copies afresh, for the current layout
+            void create_slots() {
+                metadata_file = std::make_unique<Checkpoint::File>(metadata_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC);
+
+                if (ftruncate(metadata_file->descriptor(), 2 * contents.header.bitmap_offset) != 0) {
+                    throw std::runtime_error("Failed to extend " + metadata_filename);
+                }
+
+                slot_max = { -1, -1 };
+            }
+
+            /**
+             * Make everything up to max_reached durable and record it in the metadata. The bitmap is synced before
+             * the metadata is written, so the metadata never describes words that aren't on disk, and the older slot
+             * is synced before the file's own copy is rewritten, so one of the two is intact whenever this stops.
+             */
+            void commit(int64_t max_reached) {
+                int64_t words = (max_reached + 64) / 64;
+                int64_t bitmap_bytes = round_up(words * sizeof(uint64_t), PAGE_SIZE);
+                int64_t block_count = (bitmap_bytes + Checkpoint::BLOCK_BYTES - 1) / Checkpoint::BLOCK_BYTES;
+
+                this->_max_reached = max_reached;
+                extend_file(words);
+
+                // The last block is stored up to bitmap_bytes, including a partial word and the zero padding
+                contents.block_checksums.resize(block_count);
+                if (hashed_words / block_words < block_count) {
+                    std::vector<uint64_t> rest(bitmap_bytes / sizeof(uint64_t) - hashed_words);
+                    file->read_all(rest.data(), rest.size() * sizeof(uint64_t), file_offset(hashed_words));
+
+                    contents.block_checksums[hashed_words / block_words] =
+                        Checkpoint::checksum(rest.data(), rest.size() * sizeof(uint64_t), block_hash);
+                }
+
+                if (fdatasync(file->descriptor()) != 0) {
+                    throw std::runtime_error("Failed to sync " + filename);
+                }
+
+                contents.header.max_reached = max_reached;
+                contents.header.bitmap_bytes = bitmap_bytes;
+
+                int slot = (slot_max[0] <= slot_max[1]) ? 0 : 1;
+                Checkpoint::write_metadata(*metadata_file, contents, slot * contents.header.bitmap_offset);
+                if (fdatasync(metadata_file->descriptor()) != 0) {
+                    throw std::runtime_error("Failed to sync " + metadata_filename);
+                }
+                slot_max[slot] = max_reached;
+
+                Checkpoint::write_metadata(*file, contents);
+
+                if (fsync(file->descriptor()) != 0) {
+                    throw std::runtime_error("Failed to sync " + filename);
+                }
+
+                remap();
+            }
+
+            void remap() {
+                view.reset();
+                view.map_file(file->descriptor(), contents.header.bitmap_offset, contents.header.bitmap_bytes, true);
+            }
+
+            // Pick up the computation committed to an existing file, from the newest copy of its metadata
+            void resume() {
+                std::optional<Checkpoint::Contents> newest;
+                bool from_slot = false;
+                std::string error;
+
+                // Slots only count if they describe the same layout as the file's own copy, when that is intact
+                auto consider = [&] (Checkpoint::File& source, int64_t offset, int slot) {
+                    try {
+                        auto c = Checkpoint::read_metadata(source, offset, *file);
+                        if (slot >= 0 && newest && !from_slot && (c.header.bitmap_offset != newest->header.bitmap_offset
+                                || c.initial_values != newest->initial_values)) {
+                            return;
+                        }
+
+                        if (slot >= 0) slot_max[slot] = c.header.max_reached;
+                        if (!newest || c.header.max_reached > newest->header.max_reached) {
+                            newest = std::move(c);
+                            from_slot = slot >= 0;
+                        }
+                    } catch (std::runtime_error& e) {
+                        if (error.empty()) error = e.what();
+                    }
+                };
+
+                consider(*file, 0, -1);
+
+                struct stat st;
+                if (stat(metadata_filename.c_str(), &st) == 0) {
+                    metadata_file = std::make_unique<Checkpoint::File>(metadata_filename.c_str(), O_RDWR);
+                    consider(*metadata_file, 0, 0);
+                    consider(*metadata_file, st.st_size / 2, 1);
+                }
+
+                if (!newest) {
+                    throw std::runtime_error(filename + ": " + error);
+                }
+
+                contents = std::move(*newest);
+                Checkpoint::check_maps<Maps>(contents);
+
+                if (contents.header.max_reached >= max_entry) {
+                    throw std::runtime_error(filename + " exceeds max entry (max_reached="
+                            + std::to_string(contents.header.max_reached) + ")");
+                }
+
+                if (contents.header.block_bytes != Checkpoint::BLOCK_BYTES) {
+                    throw std::runtime_error(filename + " has an unsupported block size");
+                }
+
+                this->assign_initial(contents.initial_values);
+                this->_max_reached = contents.header.max_reached;
+
+                // The stored checksum of the block being computed covers padding, so its running checksum is redone
+                hashed_words = final_words() / block_words * block_words;
+                block_hash = Checkpoint::CHECKSUM_SEED;
+                contents.block_checksums.resize(hashed_words / block_words);
+                hash_file(final_words());
+
+                if (!metadata_file || st.st_size != 2 * (int64_t)contents.header.bitmap_offset) {
+                    create_slots();
+                }
+
+                // The file's own copy is rewritten if it was damaged or stale
+                if (from_slot) {
+                    commit(this->_max_reached);
+                } else {
+                    remap();
+                }
+            }
+
+            // Compute the words before KernelType::first_word bit by bit, as in VectorizedIterateMap, and store them
+            void compute_prefix() {
+                const auto coeffs = Maps.get_coeffs();
+                const int64_t end = KernelType::first_word * 64;
+
+                std::vector<uint64_t> prefix(KernelType::first_word);
+                auto get_bit = [&] (int64_t i) { return (prefix[i >> 6] >> (i & 63)) & 1; };
+
+                for (int64_t i : this->_initial_values) {
+                    if (i < end) prefix[i >> 6] |= uint64_t{1} << (i & 63);
+                }
+
+                bool changed = true;
+                while (changed) {
+                    changed = false;
+
+                    for (int64_t i = 0; i < end; ++i) {
+                        if (get_bit(i)) continue;
+
+                        for (auto [a, b] : coeffs) {
+                            int64_t k = i - b;
+                            if (k >= 0 && k % a == 0 && get_bit(k / a)) {
+                                prefix[i >> 6] |= uint64_t{1} << (i & 63);
+                                changed = true;
+                                break;
+                            }
+                        }
+                    }
+                }
+
+                file->write_all_at(prefix.data(), prefix.size() * sizeof(uint64_t), file_offset(0));
+            }
+
+            // Largest c1 <= end such that the chunk [c0, c1) only reads words before c0, ending on a tile boundary
+            // when it is capped by the chunk size
+            int64_t chunk_end(int64_t c0, int64_t end) const {
+                constexpr int64_t T = KernelType::tile_words;
+                int64_t lo = c0, hi = std::min(end, std::max(c0 + 1, (c0 + chunk_words) / T * T));
+
+                while (lo < hi) {
+                    int64_t mid = (lo + hi + 1) / 2;
+                    if (KernelType::last_source_word(mid) < c0) lo = mid; else hi = mid - 1;
+                }
+
+                return lo;
+            }
+
+            // Compute the chunk [c0, c1) into out from the windows, tile by tile across the threads
+            void compute_chunk(uint64_t* out, int64_t c0, int64_t c1, const std::array<const uint64_t*, distinct_count>& sources,
+                    const std::array<int64_t, distinct_count>& origins, int thread_count) {
+                constexpr int64_t T = KernelType::tile_words;
+
+                std::fill(out, out + (c1 - c0), 0);
+                for (int64_t i : this->_initial_values) {
+                    if ((i >> 6) >= c0 && (i >> 6) < c1) out[(i >> 6) - c0] |= uint64_t{1} << (i & 63);
+                }
+
+                int64_t first_tile = c0 / T, tile_count = (c1 - 1) / T - first_tile + 1;
+                std::atomic<int64_t> next{0};
+
+                auto work = [&] (int slot) {
+                    int64_t t;
+                    while ((t = next.fetch_add(1, std::memory_order_relaxed)) < tile_count) {
+                        int64_t t0 = std::max(c0, (first_tile + t) * T), t1 = std::min(c1, (first_tile + t + 1) * T);
+
+                        KernelType::compute_tile(sources, origins, out + (t0 - c0), t0, t1);
+                        if (this->_progress) this->_progress->add(slot, (t1 - t0) * 64);
+                    }
+                };
+
+                if (thread_count > 1 && tile_count > 1) {
+                    ThreadPool::shared().run(thread_count, work);
+                } else {
+                    work(0);
+                }
+            }
+
+            const uint64_t* word_data() {
+                return view.data();
+            }
+
+            int64_t count_solutions_impl(int64_t min, int64_t max, const ExecutionOpts& opts) {
+                return count_bits_parallel(view.data(), min, max, opts.use_threads ? opts.num_threads : 1);
+            }
+        public:
+            /**
+             * Compute into filename, resuming from it if it holds a computation of the same maps. chunk_words bounds
+             * the memory used, see above.
+             */
+            explicit OutOfCoreIterateMap(std::string filename, int64_t chunk_words=DEFAULT_CHUNK_WORDS) :
+                    filename(std::move(filename)), chunk_words(std::max(chunk_words, KernelType::tile_words)),
+                    metadata_filename(this->filename + ".meta"), view(capacity_words) {
+                file = std::make_unique<Checkpoint::File>(this->filename.c_str(), O_RDWR | O_CREAT);
+
+                struct stat st;
+                if (fstat(file->descriptor(), &st) == 0 && st.st_size > 0) {
+                    resume();
+                } else {
+                    // Left over from an earlier file of the same name
+                    unlink(metadata_filename.c_str());
+                }
+            }
+
+            /**
+             * Initial values can only be changed while nothing is computed, since the file was computed from them
+             */
+            void set_initial(std::initializer_list<int64_t> initial) {
+                if (this->_max_reached >= 0 && std::vector<int64_t>(initial) != this->_initial_values) {
+                    throw std::runtime_error(filename + " was computed from other initial values (call clear_data first)");
+                }
+
+                IterateMap<Maps, max_entry>::set_initial(initial);
+            }
+
+            /**
+             * Copy a checkpoint written by any engine into the file
+             */
+            void read_from_file(const char* source_name) {
+                Checkpoint::File source{source_name, O_RDONLY};
+                auto source_contents = Checkpoint::read_metadata(source);
+
+                Checkpoint::check_maps<Maps>(source_contents);
+                this->check_provenance_on_load();
+
+                int64_t max_reached = source_contents.header.max_reached;
+                if (max_reached >= max_entry) {
+                    throw std::runtime_error("Checkpoint exceeds max entry (max_reached="
+                            + std::to_string(max_reached) + ")");
+                }
+
+                clear_data();
+                this->assign_initial(source_contents.initial_values);
+                create_layout();
+
+                int64_t words = (max_reached + 64) / 64, final = (max_reached + 1) >> 6;
+                extend_file(std::max(words, KernelType::first_word));
+
+                std::vector<uint64_t> buffer(std::min(words, chunk_words));
+                for (int64_t w = 0; w < words; w += chunk_words) {
+                    int64_t n = std::min(chunk_words, words - w);
+
+                    source.read_all(buffer.data(), n * sizeof(uint64_t),
+                            source_contents.header.bitmap_offset + w * sizeof(uint64_t));
+                    file->write_all_at(buffer.data(), n * sizeof(uint64_t), file_offset(w));
+                    hash(buffer.data(), std::clamp(final - w, int64_t{0}, n));
+                }
+
+                // The chunks seed the initial values above the checkpoint themselves, but nothing redoes the prefix
+                Checkpoint::restore_unsaved(max_reached, this->_initial_values, KernelType::first_word * 64,
+                        [] (int64_t) {}, [&] { compute_prefix(); });
+
+                commit(max_reached);
+
+                this->_rank_index.clear();
+                this->update_rank_index({});
+            }
+
+            void compute_till(const IterateMapOpts& opts) {
+                int64_t max = (opts.max < 0) ? max_entry - 1 : opts.max;
+
+                if (max <= this->_max_reached) {
+                    return;
+                }
+
+                if (max >= max_entry) {
+                    throw std::runtime_error("Max entry exceeded (max=" + std::to_string(max) +")");
+                }
+
+                if (this->_provenance.is_enabled()) {
+                    throw std::runtime_error("Provenance is not supported by the out-of-core engine");
+                }
+
+                // Partially computed words are simply recomputed
+                int64_t w = std::max(KernelType::first_word, final_words());
+                int64_t end = (max >> 6) + 1, final = (max + 1) >> 6;
+
+                if (this->_max_reached == -1) {
+                    create_layout();
+                    extend_file(std::max(end, KernelType::first_word));
+                    compute_prefix();
+                } else {
+                    extend_file(end);
+                }
+
+                hash_file(std::min(w, final));
+
+                int thread_count = opts.use_threads ? opts.num_threads : 1;
+                auto progress = this->progress_scope(opts, std::max<int64_t>(end - w, 0) * 64, thread_count);
+
+                std::array<std::vector<uint64_t>, distinct_count> windows;
+                std::array<std::vector<uint64_t>, 2> buffers;
+
+                // Write of the previous chunk, which starts at pending_start
+                std::future<void> pending;
+                int64_t pending_start = 0;
+                int64_t committed = w;
+
+                for (int64_t c0 = w, i = 0; c0 < end; ++i) {
+                    int64_t c1 = chunk_end(c0, end);
+
+                    std::array<const uint64_t*, distinct_count> sources;
+                    std::array<int64_t, distinct_count> origins;
+                    int64_t read_end = 0;
+
+                    for (std::size_t d = 0; d < distinct_count; ++d) {
+                        auto [first, window_end] = KernelType::source_window(d, c0, c1);
+                        origins[d] = first;
+                        read_end = std::max(read_end, window_end);
+
+                        windows[d].resize(std::max<int64_t>(windows[d].size(), window_end - first));
+                        sources[d] = windows[d].data();
+                    }
+
+                    // Only chunks near the start read words that may still be in flight
+                    if (pending.valid() && read_end > pending_start) pending.get();
+
+                    for (std::size_t d = 0; d < distinct_count; ++d) {
+                        auto [first, window_end] = KernelType::source_window(d, c0, c1);
+                        file->read_all(windows[d].data(), (window_end - first) * sizeof(uint64_t), file_offset(first));
+
+                        // Ask for the next chunk's window to be read ahead while this chunk is computed
+                        auto [next_first, next_end] = KernelType::source_window(d, c1, std::min(end, 2 * c1 - c0));
+                        posix_fadvise(file->descriptor(), file_offset(next_first),
+                                (next_end - next_first) * sizeof(uint64_t), POSIX_FADV_WILLNEED);
+                    }
+
+                    auto& buffer = buffers[i & 1];
+                    buffer.resize(std::max<int64_t>(buffer.size(), c1 - c0));
+                    compute_chunk(buffer.data(), c0, c1, sources, origins, thread_count);
+
+                    // The other buffer is reused by the next chunk
+                    if (pending.valid()) pending.get();
+
+                    pending = std::async(std::launch::async, [this, &buffer, c0, c1, final] {
+                        file->write_all_at(buffer.data(), (c1 - c0) * sizeof(uint64_t), file_offset(c0));
+                        hash(buffer.data(), std::clamp(final - c0, int64_t{0}, c1 - c0));
+                    });
+                    pending_start = c0;
+
+                    c0 = c1;
+                    if (c0 < end && c0 - committed >= COMMIT_WORDS) {
+                        pending.get();
+                        commit(c0 * 64 - 1);
+                        committed = c0;
+                    }
+                }
+
+                if (pending.valid()) pending.get();
+
+                commit(max);
+
+                this->update_rank_index(opts);
+                progress.finish();
+            }
+
+            void clear_data() {
+                view.reset();
+
+                metadata_file.reset();
+                unlink(metadata_filename.c_str());
+
+                if (ftruncate(file->descriptor(), 0) != 0) {
+                    throw std::runtime_error("Failed to truncate " + filename);
+                }
+
+                contents = {};
+                hashed_words = 0;
+                block_hash = Checkpoint::CHECKSUM_SEED;
+
+                this->_max_reached = -1;
+                this->_rank_index.clear();
+                this->_provenance.clear();
+                this->_descent.clear();
+            }
+
+            bool is_reachable(int64_t i) {
+                return (view.data()[i >> 6] >> (i & 63)) & 1;
+            }
+
+            void write_to_file(const char* filename) {
+                Checkpoint::write(filename, Maps.get_coeffs(), this->_initial_values, this->_max_reached, view.data());
+            }
+        };
+}
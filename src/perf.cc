@@ -1,6 +1,8 @@
 // Test for performance
 
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <regex>
 #include <optional>
@@ -58,15 +60,1534 @@ void test_map_set_apply() {
     std::cout << "All tests passed." << std::endl;
 }
 
+AffineMapSet<
+    AffineMap<2, 5>,
+    AffineMap<3, -3>,
+    AffineMap<3, 100>
+    > shifted_map_set;
+
+AffineMapSet<
+    AffineMap<5, 1>,
+    AffineMap<7, 3>,
+    AffineMap<2, 0>
+    > mixed_map_set;
+
+// Computed bit by bit up to word 2, as 2x-2 and 5x-5 let small values depend on larger ones
+AffineMapSet<
+    AffineMap<2, -2>,
+    AffineMap<3, 1>,
+    AffineMap<5, -5>
+    > prefix_map_set;
+
+AffineMapSet<
+    AffineMap<2, 1>,
+    AffineMap<4, -4>,
+    AffineMap<64, 5>,
+    AffineMap<255, 512>
+    > wide_map_set;
+
+// Sum of 1/a below 1, so the reachable set has density zero
+AffineMapSet<
+    AffineMap<3, 1>,
+    AffineMap<5, 3>
+    > sparse_map_set;
+
+AffineMapSet<
+    AffineMap<2, -2>,
+    AffineMap<3, 1>,
+    AffineMap<7, 0>
+    > near_dense_map_set;
+
+// Pairwise coprime coefficients, whose lcm doesn't fit in 64 bits
+AffineMapSet<
+    AffineMap<223, 1>,
+    AffineMap<227, 1>,
+    AffineMap<229, 1>,
+    AffineMap<233, 1>,
+    AffineMap<239, 1>,
+    AffineMap<241, 1>,
+    AffineMap<251, 1>,
+    AffineMap<255, 1>,
+    AffineMap<256, 1>
+    > coprime_map_set;
+
+// Enough of them that it doesn't fit in 128 bits either, before the sum passes 1
+AffineMapSet<
+    AffineMap<131, 1>,
+    AffineMap<137, 1>,
+    AffineMap<139, 1>,
+    AffineMap<149, 1>,
+    AffineMap<151, 1>,
+    AffineMap<157, 1>,
+    AffineMap<163, 1>,
+    AffineMap<167, 1>,
+    AffineMap<173, 1>,
+    AffineMap<179, 1>,
+    AffineMap<181, 1>,
+    AffineMap<191, 1>,
+    AffineMap<193, 1>,
+    AffineMap<197, 1>,
+    AffineMap<199, 1>,
+    AffineMap<211, 1>,
+    AffineMap<223, 1>,
+    AffineMap<227, 1>,
+    AffineMap<229, 1>,
+    AffineMap<233, 1>,
+    AffineMap<239, 1>,
+    AffineMap<241, 1>,
+    AffineMap<251, 1>,
+    AffineMap<255, 1>,
+    AffineMap<256, 1>,
+    AffineMap<2, 1>,
+    AffineMap<3, 1>,
+    AffineMap<5, 1>
+    > dense_coprime_map_set;
+
+// Compare every bit of the vectorized engine with the standard one, also across incremental compute_till calls
+template <AffineMapSet Maps>
+void compare_with_standard(std::initializer_list<int64_t> initial) {
+    constexpr int64_t max_entry = 1 << 20;
+
+    StandardIterateMap<Maps, max_entry> standard;
+    VectorizedIterateMap<Maps, max_entry> vectorized;
+
+    standard.set_initial(initial);
+    vectorized.set_initial(initial);
+
+    for (int64_t max : { int64_t{1000}, int64_t{77777}, max_entry - 1 }) {
+        standard.compute_till({ .max = max });
+        vectorized.compute_till({ .max = max });
+
+        for (int64_t i = 0; i <= max; ++i) {
+            _assert(standard.is_reachable(i) == vectorized.is_reachable(i));
+        }
+    }
+}
+
+void test_vectorized_matches_standard() {
+    compare_with_standard<standard_map_set>({ 1 });
+    compare_with_standard<shifted_map_set>({ 1, 2, 500'000 });
+    compare_with_standard<mixed_map_set>({ 1, 2 });
+    compare_with_standard<wide_map_set>({ 1, 3, 7 });
+
+    VectorizedIterateMap<standard_map_set, 1 << 20> m;
+    m.set_initial({ 1 });
+    m.compute_till({ .max = 100'000 });
+
+    // Checksum from misc/m.cc
+    uint64_t s = 1;
+    for (int64_t i = 0; i < 100'000 / 64; ++i) {
+        uint64_t word = 0;
+        for (int j = 0; j < 64; ++j) word |= uint64_t{m.is_reachable(64 * i + j)} << j;
+        s = s * word + 2;
+    }
+
+    _assert(s == 15063046391347018756ULL);
+    _assert(m.count_solutions(4000, 5000) == m.count_solutions(4000, 4999) + m.is_reachable(5000));
+}
+
+void test_watermark_scheduler() {
+    ThreadPool pool{3};
+    constexpr int64_t blocks = 5000;
+
+    std::vector<std::atomic<bool>> finished(blocks);
+    std::atomic<bool> ok{true};
+
+    WatermarkScheduler scheduler{blocks};
+    scheduler.run(pool, 4, [] (int64_t b) { return b / 2; }, [&] (int64_t b) {
+        for (int64_t i = 0; i < b / 2; ++i) {
+            if (!finished[i].load()) ok = false;
+        }
+
+        finished[b] = true;
+    });
+
+    _assert(ok);
+    _assert(scheduler.completed() == blocks);
+
+    constexpr int64_t max_entry = 1 << 24;
+
+    auto sequential = std::make_unique<VectorizedIterateMap<standard_map_set, max_entry>>();
+    auto threaded = std::make_unique<VectorizedIterateMap<standard_map_set, max_entry>>();
+
+    sequential->set_initial({ 1 });
+    threaded->set_initial({ 1 });
+
+    sequential->compute_till({ .max = max_entry - 1 });
+
+    IterateMapOpts opts;
+    opts.use_threads = true;
+    opts.max = max_entry / 3;
+    threaded->compute_till(opts);
+    opts.max = max_entry - 1;
+    threaded->compute_till(opts);
+
+    for (int64_t i = 0; i < max_entry; ++i) {
+        _assert(sequential->is_reachable(i) == threaded->is_reachable(i));
+    }
+}
+
+void test_count_solutions_range() {
+    constexpr int64_t max_entry = 1 << 20;
+
+    StandardIterateMap<standard_map_set, max_entry> standard;
+    VectorizedIterateMap<standard_map_set, max_entry> vectorized;
+
+    standard.set_initial({ 1 });
+    vectorized.set_initial({ 1 });
+    standard.compute_till({ .max = max_entry - 1 });
+    vectorized.compute_till({ .max = max_entry - 1 });
+
+    std::vector<int64_t> prefix{0};
+    for (int64_t i = 0; i < max_entry; ++i) {
+        prefix.push_back(prefix.back() + standard.is_reachable(i));
+    }
+
+    uint64_t state = 12345;
+    for (int i = 0; i < 2000; ++i) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        int64_t min = (state >> 20) % max_entry;
+        int64_t max = min + (i % 3 == 0 ? (state >> 40) % 200 : (state >> 30) % (max_entry - min));
+
+        _assert(standard.count_solutions(min, max) == prefix[max + 1] - prefix[min]);
+        _assert(vectorized.count_solutions(min, max) == prefix[max + 1] - prefix[min]);
+    }
+
+    std::vector<uint64_t> words(5 << 20);
+    int64_t expected = 0;
+    for (auto& w : words) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        w = state;
+        expected += __builtin_popcountll(state);
+    }
+
+    int64_t bits = words.size() * 64;
+    _assert(vectorized_popcnt(words.data(), words.size() * 8) == expected);
+    _assert(count_bits_parallel(words.data(), 0, bits - 1, 4) == expected);
+    _assert(count_bits_parallel(words.data(), 3, bits - 5, 4) == count_bits(words.data(), 3, bits - 5));
+}
+
+void test_rank_select_index() {
+    constexpr int64_t max_entry = 1 << 20;
+
+    VectorizedIterateMap<standard_map_set, max_entry> m;
+    m.set_initial({ 1 });
+    m.enable_rank_index();
+
+    for (int64_t max : { int64_t{300'001}, max_entry - 1 }) {
+        m.compute_till({ .max = max });
+
+        std::vector<int64_t> reachable, unreachable;
+        for (int64_t i = 0; i <= max; ++i) {
+            (m.is_reachable(i) ? reachable : unreachable).push_back(i);
+        }
+
+        for (int64_t k = 0; k < (int64_t)reachable.size(); k += 97) _assert(m.nth_reachable(k) == reachable[k]);
+        for (int64_t k = 0; k < (int64_t)unreachable.size(); ++k) _assert(m.nth_unreachable(k) == unreachable[k]);
+
+        _assert(m.nth_reachable(reachable.size() - 1) == reachable.back());
+        _assert(m.nth_reachable(reachable.size()) == -1);
+        _assert(m.nth_unreachable(unreachable.size()) == -1);
+
+        _assert(m.count_solutions() == (int64_t)reachable.size());
+        _assert(m.count_solutions(4443, 4443) == 0);
+        _assert(m.count_solutions(1000, max - 1000) == (int64_t)(std::upper_bound(reachable.begin(), reachable.end(),
+                        max - 1000) - std::lower_bound(reachable.begin(), reachable.end(), 1000)));
+    }
+}
+
+void test_checkpoint_round_trip() {
+    constexpr int64_t max_entry = 1 << 22;
+    const char* filename = "/tmp/affine_map_checkpoint_test.bin";
+
+    VectorizedIterateMap<standard_map_set, max_entry> original, full, loaded;
+    StandardIterateMap<standard_map_set, max_entry> standard;
+
+    original.set_initial({ 1 });
+    full.set_initial({ 1 });
+    original.compute_till({ .max = 1'234'567 });
+    full.compute_till({ .max = max_entry - 1 });
+    original.write_to_file(filename);
+
+    _assert(Checkpoint::verify(filename) == -1);
+
+    loaded.read_from_file(filename);
+    standard.read_from_file(filename);
+    _assert(loaded.max_reached() == 1'234'567);
+    _assert(standard.max_reached() == 1'234'567);
+
+    for (int64_t i = 0; i <= 1'234'567; ++i) {
+        _assert(loaded.is_reachable(i) == full.is_reachable(i));
+        _assert(standard.is_reachable(i) == full.is_reachable(i));
+    }
+
+    // Resume from the mapped file
+    loaded.compute_till({ .max = max_entry - 1 });
+    standard.compute_till({ .max = 2'000'000 });
+    for (int64_t i = 0; i < max_entry; ++i) {
+        _assert(loaded.is_reachable(i) == full.is_reachable(i));
+    }
+    _assert(standard.count_solutions() == full.count_solutions(0, 2'000'000));
+
+    // The mapping is private, so resuming doesn't modify the file
+    _assert(Checkpoint::verify(filename) == -1);
+
+    {
+        Checkpoint::File file{filename, O_RDWR};
+        auto contents = Checkpoint::read_metadata(file);
+        char byte = 1;
+        _assert(pwrite(file.descriptor(), &byte, 1, contents.header.bitmap_offset + 100'000) == 1);
+    }
+
+    _assert(Checkpoint::verify(filename) == 0);
+
+    bool threw = false;
+    try {
+        VectorizedIterateMap<shifted_map_set, max_entry> other;
+        other.read_from_file(filename);
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    _assert(threw);
+
+    // Initial values above the checkpoint aren't stored in it, but still seed the resumed computation
+    VectorizedIterateMap<standard_map_set, max_entry> seeded, seeded_full, seeded_loaded;
+    StandardIterateMap<standard_map_set, max_entry> seeded_standard;
+
+    seeded.set_initial({ 1, 503'009 });
+    seeded_full.set_initial({ 1, 503'009 });
+    seeded.compute_till({ .max = 1000 });
+    seeded_full.compute_till({ .max = 1'000'000 });
+    seeded.write_to_file(filename);
+
+    seeded_loaded.read_from_file(filename);
+    seeded_standard.read_from_file(filename);
+    seeded_loaded.compute_till({ .max = 1'000'000 });
+    seeded_standard.compute_till({ .max = 1'000'000 });
+
+    _assert(seeded_loaded.is_reachable(503'009) && seeded_standard.is_reachable(503'009));
+    _assert(seeded_loaded.count_solutions() == seeded_full.count_solutions());
+    _assert(seeded_standard.count_solutions() == seeded_full.count_solutions());
+
+    // Checkpoints ending inside the bit-by-bit prefix, whose remainder isn't stored either
+    VectorizedIterateMap<prefix_map_set, max_entry> prefix_full;
+    prefix_full.set_initial({ 3, 7 });
+    prefix_full.compute_till({ .max = 100'000 });
+
+    for (int64_t max : { 5, 10, 63, 100 }) {
+        VectorizedIterateMap<prefix_map_set, max_entry> partial, resumed;
+        partial.set_initial({ 3, 7 });
+        partial.compute_till({ .max = max });
+        partial.write_to_file(filename);
+
+        resumed.read_from_file(filename);
+        resumed.compute_till({ .max = 100'000 });
+        _assert(resumed.count_solutions() == prefix_full.count_solutions());
+    }
+
+    std::remove(filename);
+}
+
+void test_export_unreachable() {
+    constexpr int64_t max_entry = 40'000'000;
+    const char* filename = "/tmp/affine_map_export_test.bin";
+
+    auto m = std::make_unique<VectorizedIterateMap<standard_map_set, max_entry>>();
+    m->set_initial({ 1 });
+    m->compute_till({ .max = max_entry - 1 });
+
+    ExecutionOpts opts;
+    opts.use_threads = true;
+    m->export_unreachable(filename, 5, max_entry - 3, opts);
+
+    UnreachableReader reader{filename};
+    _assert(reader.chunk_count() == 3);
+    _assert(reader.size() == (max_entry - 7) - m->count_solutions(5, max_entry - 3));
+
+    int64_t expected = 5, count = 0;
+    for (int64_t v : reader) {
+        while (m->is_reachable(expected)) ++expected;
+
+        _assert(v == expected);
+        ++expected;
+        ++count;
+    }
+
+    _assert(count == reader.size());
+
+    int64_t chunk_total = 0;
+    reader.for_each_in_chunk(1, [&] (int64_t v) {
+        _assert(!m->is_reachable(v) && v >= reader.chunk(1).min && v <= reader.chunk(1).max);
+        ++chunk_total;
+    });
+    _assert(chunk_total == (int64_t)reader.chunk(1).count);
+
+    auto throws = [] (auto f) {
+        try {
+            f();
+        } catch (std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+
+    // Decoding stops at the end of the chunk, even if its varints don't
+    const uint8_t unterminated[] = { 0x85, 0x80 };
+    Export::ChunkEntry entry{};
+    entry.max = 1000;
+    entry.count = 1;
+    entry.bytes = 1;
+    _assert(throws([&] { Export::decode_chunk(entry, unterminated, [] (int64_t) {}); }));
+
+    // A damaged chunk fails its checksum, leaving the others readable
+    {
+        Checkpoint::File file{filename, O_RDWR};
+        uint8_t byte = 0x7f;
+        _assert(pwrite(file.descriptor(), &byte, 1, reader.chunk(1).offset + 1000) == 1);
+    }
+
+    UnreachableReader damaged{filename};
+    _assert(throws([&] { damaged.for_each_in_chunk(1, [] (int64_t) {}); }));
+    _assert(!throws([&] { damaged.for_each_in_chunk(0, [] (int64_t) {}); }));
+
+    // So does a truncated table
+    _assert(truncate(filename, reader.chunk(2).offset + reader.chunk(2).bytes + 8) == 0);
+    _assert(throws([&] { UnreachableReader truncated{filename}; }));
+
+    // An unfinished export leaves neither the file nor its temporary behind
+    std::remove(filename);
+    {
+        UnreachableWriter writer{filename, 0, 1000};
+    }
+    _assert(access(filename, F_OK) != 0 && access((std::string{filename} + ".tmp").c_str(), F_OK) != 0);
+}
+
+void test_growable_storage() {
+    BitmapStorage storage{int64_t{1} << 34};
+    _assert(storage.size_words() == 0);
+
+    storage.ensure(1000);
+    _assert(storage.size_words() >= 1000 && storage.size_words() < (int64_t{1} << 20));
+    storage.data()[999] = 42;
+
+    // Growing keeps the contents and the address
+    uint64_t* before = storage.data();
+    storage.ensure(int64_t{1} << 22);
+    _assert(storage.data() == before && storage.data()[999] == 42 && storage.data()[(1 << 22) - 1] == 0);
+
+    storage.reset();
+    _assert(storage.size_words() == 0);
+    storage.ensure(1000);
+    _assert(storage.data()[999] == 0);
+
+    // Many instances with the default (10^12) maximum only reserve address space
+    std::vector<std::unique_ptr<VectorizedIterateMap<standard_map_set>>> maps;
+    for (int i = 0; i < 32; ++i) {
+        maps.push_back(std::make_unique<VectorizedIterateMap<standard_map_set>>());
+        maps.back()->set_initial({ 1 });
+        maps.back()->compute_till({ .max = 10'000 * (i + 1) });
+    }
+
+    int64_t count = maps[3]->count_solutions(0, 40'000);
+    maps[3]->clear_data();
+    _assert(maps[3]->max_reached() == -1);
+    maps[3]->compute_till({ .max = 40'000 });
+    _assert(maps[3]->count_solutions() == count);
+    _assert(maps[31]->count_solutions(0, 40'000) == count);
+
+    StandardIterateMap<standard_map_set> standard;
+    standard.set_initial({ 1 });
+    standard.compute_till({ .max = 40'000 });
+    _assert(standard.count_solutions() == count);
+}
+
+void test_stream_till() {
+    constexpr int64_t max_entry = 40'000'000;
+    const char* filename = "/tmp/affine_map_stream_test.bin";
+
+    auto full = std::make_unique<VectorizedIterateMap<standard_map_set, max_entry>>();
+    auto streamed = std::make_unique<VectorizedIterateMap<standard_map_set, max_entry>>();
+
+    full->set_initial({ 1 });
+    streamed->set_initial({ 1 });
+    full->compute_till({ .max = max_entry - 1 });
+
+    int64_t count = 0, next = 0;
+    bool contiguous = true;
+    UnreachableWriter writer{filename, 5, max_entry - 3};
+
+    IterateMapOpts opts;
+    opts.use_threads = true;
+    streamed->stream_till(opts, {
+        count_consumer(count),
+        export_consumer(writer),
+        [&] (const BitmapChunk& chunk) {
+            contiguous &= chunk.min == next;
+            next = chunk.max + 1;
+        }
+    });
+    writer.finish();
+
+    _assert(contiguous && next == max_entry);
+    _assert(count == full->count_solutions());
+    _assert(streamed->max_reached() < max_entry / 2 + 64);
+    _assert(streamed->count_solutions(0, streamed->max_reached()) == full->count_solutions(0, streamed->max_reached()));
+
+    UnreachableReader reader{filename};
+    _assert(reader.size() == (max_entry - 7) - full->count_solutions(5, max_entry - 3));
+
+    int64_t expected = 5;
+    for (int64_t v : reader) {
+        while (full->is_reachable(expected)) ++expected;
+        _assert(v == expected++);
+    }
+
+    std::remove(filename);
+
+    // Initial values above the resident part, and a map set whose upper part reads past max / 2
+    VectorizedIterateMap<shifted_map_set, 1 << 20> shifted, shifted_streamed;
+    shifted.set_initial({ 1, 2, 900'000 });
+    shifted_streamed.set_initial({ 1, 2, 900'000 });
+    shifted.compute_till({ .max = 1'000'000 });
+
+    bool same = true;
+    shifted_streamed.stream_till({ .max = 1'000'000 }, {
+        value_consumer([&] (int64_t i, bool reachable) { same &= shifted.is_reachable(i) == reachable; })
+    });
+    _assert(same);
+}
+
+// Check that chain is a valid derivation of n under Maps from one of the initial values
+template <AffineMapSet Maps>
+bool valid_derivation(const std::vector<DerivationStep>& chain, int64_t n, std::initializer_list<int64_t> initial) {
+    const auto coeffs = Maps.get_coeffs();
+
+    if (chain.empty() || chain.back().value != n || chain[0].map != -1
+            || std::find(initial.begin(), initial.end(), chain[0].value) == initial.end()) {
+        return false;
+    }
+
+    for (std::size_t s = 1; s < chain.size(); ++s) {
+        int m = chain[s].map;
+        if (m < 0 || m >= (int)coeffs.size()
+                || chain[s].value != coeffs[m].first * chain[s - 1].value + coeffs[m].second) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <AffineMapSet Maps>
+void check_derivations(std::initializer_list<int64_t> initial) {
+    constexpr int64_t max_entry = 1 << 22;
+
+    auto standard = std::make_unique<StandardIterateMap<Maps, max_entry>>();
+    auto vectorized = std::make_unique<VectorizedIterateMap<Maps, max_entry>>();
+
+    standard->set_initial(initial);
+    vectorized->set_initial(initial);
+    standard->enable_provenance();
+    vectorized->enable_provenance();
+
+    IterateMapOpts opts;
+    opts.use_threads = true;
+    for (int64_t max : { int64_t{100'000}, max_entry - 1 }) {
+        opts.max = max;
+        standard->compute_till(opts);
+        vectorized->compute_till(opts);
+    }
+
+    for (int64_t i = 0; i < max_entry; i += (i < 100'000) ? 1 : 997) {
+        if (!vectorized->is_reachable(i)) continue;
+
+        _assert(valid_derivation<Maps>(vectorized->derivation(i), i, initial));
+        _assert(valid_derivation<Maps>(standard->derivation(i), i, initial));
+    }
+}
+
+void test_derivation() {
+    check_derivations<standard_map_set>({ 1 });
+    check_derivations<shifted_map_set>({ 1, 2, 500'000 });
+    check_derivations<wide_map_set>({ 1, 3, 7 });
+
+    VectorizedIterateMap<standard_map_set, 1 << 20> m;
+    m.set_initial({ 1 });
+    m.enable_provenance();
+    m.compute_till({ .max = 10'000 });
+
+    // 4443 is the first unreachable 4k+3 (result.tex); the next one has a witness
+    auto chain = m.derivation(4447);
+    _assert(valid_derivation<standard_map_set>(chain, 4447, { 1 }));
+
+    bool threw = false;
+    try {
+        m.derivation(4443);
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    _assert(threw);
+}
+
+AffineMapSet<
+    AffineMap<2, 1>,
+    AffineMap<3, 7>
+    > standard_subset_map_set;
+
+void test_batch_iterate_map() {
+    constexpr int64_t max_entry = 1 << 20;
+
+    // Seeds {s} for s = 1..100 with all maps, plus one configuration of a subset of the maps
+    auto batch = std::make_unique<BatchIterateMap<standard_map_set, 2, max_entry>>();
+    for (int64_t s = 1; s <= 100; ++s) batch->add_configuration({ s });
+    int subset = batch->add_configuration<standard_subset_map_set>({ 1, 5 });
+
+    IterateMapOpts opts;
+    opts.use_threads = true;
+    opts.max = 300'000;
+    batch->compute_till(opts);
+    opts.max = max_entry - 1;
+    batch->compute_till(opts);
+
+    auto counts = batch->count_solutions();
+    auto range_counts = batch->count_solutions(1000, 777'777);
+    _assert((int)counts.size() == 101);
+
+    for (int lane : { 0, 1, 63, 64, 99 }) {
+        VectorizedIterateMap<standard_map_set, max_entry> m;
+        m.set_initial({ lane + 1 });
+        m.compute_till({ .max = max_entry - 1 });
+
+        _assert(counts[lane] == m.count_solutions());
+        _assert(range_counts[lane] == m.count_solutions(1000, 777'777));
+
+        auto words = batch->bitmap(lane);
+        for (int64_t i = 0; i < max_entry; ++i) {
+            _assert(((words[i >> 6] >> (i & 63)) & 1) == m.is_reachable(i));
+        }
+    }
+
+    VectorizedIterateMap<standard_subset_map_set, max_entry> m;
+    m.set_initial({ 1, 5 });
+    m.compute_till({ .max = max_entry - 1 });
+
+    _assert(counts[subset] == m.count_solutions());
+    for (int64_t i = 0; i < max_entry; i += 7) _assert(batch->is_reachable(subset, i) == m.is_reachable(i));
+}
+
+void test_residue_stats() {
+    constexpr int64_t max_entry = 1 << 26;
+
+    auto m = std::make_unique<VectorizedIterateMap<standard_map_set, max_entry>>();
+    m->set_initial({ 1 });
+    m->compute_till({ .max = max_entry - 1 });
+
+    std::vector<int> moduli{ 1, 4, 7, 8, 64, 97 };
+    ExecutionOpts opts;
+    opts.use_threads = true;
+
+    for (auto [min, max] : { std::pair<int64_t, int64_t>{ 0, max_entry - 1 }, { 12'345, 54'321'000 } }) {
+        ResidueStats stats = m->residue_stats(moduli, min, max, opts);
+
+        for (int mod : moduli) {
+            std::vector<ResidueClassStats> expected(mod);
+            for (int64_t i = min; i <= max; ++i) {
+                if (m->is_reachable(i)) continue;
+
+                auto& c = expected[i % mod];
+                if (c.count++ == 0) c.first = i; else c.largest_gap = std::max(c.largest_gap, i - c.last);
+                c.last = i;
+            }
+
+            for (int r = 0; r < mod; ++r) {
+                auto& got = stats.get(mod, r);
+                _assert(got.count == expected[r].count && got.first == expected[r].first
+                        && got.last == expected[r].last && got.largest_gap == expected[r].largest_gap);
+            }
+        }
+    }
+
+    // result.tex: 4443 is the first unreachable 4k+3
+    _assert(m->residue_stats({ 4 }).get(4, 3).first == 4443);
+}
+
+void test_progress_reports() {
+    constexpr int64_t max_entry = 1 << 26;
+
+    std::vector<ProgressReport> reports;
+    std::vector<double> fractions;
+
+    IterateMapOpts opts;
+    opts.use_threads = true;
+    opts.progress_callback = [&] (double progress) { fractions.push_back(progress); };
+    opts.progress_report_callback = [&] (const ProgressReport& r) { reports.push_back(r); };
+
+    auto check = [&] {
+        _assert(!reports.empty() && reports.size() == fractions.size());
+        _assert(reports.back().progress == 1.0 && fractions.back() == 1.0);
+        _assert(reports.back().bits_done == reports.back().bits_total && reports.back().blocks_done > 0);
+
+        for (std::size_t i = 1; i < reports.size(); ++i) _assert(reports[i].bits_done >= reports[i - 1].bits_done);
+
+        reports.clear();
+        fractions.clear();
+    };
+
+    auto vectorized = std::make_unique<VectorizedIterateMap<standard_map_set, max_entry>>();
+    vectorized->set_initial({ 1 });
+    opts.max = max_entry / 2;
+    vectorized->compute_till(opts);
+    check();
+
+    opts.max = max_entry - 1;
+    vectorized->compute_till(opts);
+    check();
+
+    vectorized->clear_data();
+    vectorized->stream_till(opts, {});
+    check();
+
+    StandardIterateMap<standard_map_set, max_entry> standard;
+    standard.set_initial({ 1 });
+    opts.max = 1'000'000;
+    standard.compute_till(opts);
+    check();
+
+    auto batch = std::make_unique<BatchIterateMap<standard_map_set, 1, max_entry>>();
+    batch->add_configuration({ 1 });
+    batch->compute_till(opts);
+    check();
+}
+
+void test_for_each_filters() {
+    constexpr int64_t max_entry = 1 << 20;
+
+    VectorizedIterateMap<standard_map_set, max_entry> m;
+    StandardIterateMap<standard_map_set, max_entry> standard;
+    m.set_initial({ 1 });
+    standard.set_initial({ 1 });
+    m.compute_till({ .max = max_entry - 1 });
+    standard.compute_till({ .max = max_entry - 1 });
+
+    for (ResidueClass c : { ResidueClass{}, ResidueClass{ 4, 3 }, ResidueClass{ 96, 95 }, ResidueClass{ 7, -1 } }) {
+        for (auto [min, max] : { std::pair<int64_t, int64_t>{ 0, max_entry - 1 }, { 4443, 4443 }, { 65, 100'003 } }) {
+            std::vector<int64_t> reachable, unreachable, got_reachable, got_unreachable, got_standard;
+
+            m.for_each_solution([&] (int64_t i, bool r) {
+                if ((i % c.modulus + c.modulus) % c.modulus == (c.residue % c.modulus + c.modulus) % c.modulus) {
+                    (r ? reachable : unreachable).push_back(i);
+                }
+            }, min, max);
+
+            m.for_each_reachable([&] (int64_t i) { got_reachable.push_back(i); }, min, max, c);
+            m.for_each_unreachable([&] (int64_t i) { got_unreachable.push_back(i); }, min, max, c);
+            standard.for_each_unreachable([&] (int64_t i) { got_standard.push_back(i); }, min, max, c);
+
+            _assert(got_reachable == reachable);
+            _assert(got_unreachable == unreachable);
+            _assert(got_standard == unreachable);
+        }
+    }
+
+    int64_t first = -1;
+    m.for_each_unreachable([&] (int64_t i) { if (first < 0) first = i; }, 0, -1, { 4, 3 });
+    _assert(first == 4443);
+}
+
+void test_out_of_core() {
+    constexpr int64_t max_entry = 1 << 24;
+    const char* filename = "/tmp/affine_map_out_of_core_test.bin";
+    const char* copy_filename = "/tmp/affine_map_out_of_core_copy_test.bin";
+    std::remove(filename);
+    std::remove(copy_filename);
+
+    auto full = std::make_unique<VectorizedIterateMap<standard_map_set, max_entry>>();
+    full->set_initial({ 1 });
+    full->compute_till({ .max = max_entry - 1 });
+
+    // Small chunks, so that most chunks are capped by the chunk size rather than by their sources
+    {
+        OutOfCoreIterateMap<standard_map_set, max_entry> m{filename, 1 << 12};
+        m.set_initial({ 1 });
+        m.compute_till({ .max = 1'234'567 });
+        _assert(m.count_solutions() == full->count_solutions(0, 1'234'567));
+    }
+
+    _assert(Checkpoint::verify(filename) == -1);
+
+    // Resume from the file, with threads
+    {
+        OutOfCoreIterateMap<standard_map_set, max_entry> m{filename, 1 << 12};
+        _assert(m.max_reached() == 1'234'567);
+
+        bool threw = false;
+        try {
+            m.set_initial({ 2 });
+        } catch (std::runtime_error&) {
+            threw = true;
+        }
+        _assert(threw);
+
+        IterateMapOpts opts;
+        opts.use_threads = true;
+        m.compute_till(opts);
+
+        for (int64_t i = 0; i < max_entry; ++i) {
+            _assert(m.is_reachable(i) == full->is_reachable(i));
+        }
+    }
+
+    _assert(Checkpoint::verify(filename) == -1);
+
+    // The file is an ordinary checkpoint, and any checkpoint can be copied into an out-of-core file
+    VectorizedIterateMap<standard_map_set, max_entry> loaded;
+    loaded.read_from_file(filename);
+    _assert(loaded.max_reached() == max_entry - 1 && loaded.count_solutions() == full->count_solutions());
+
+    {
+        OutOfCoreIterateMap<standard_map_set, max_entry> copy{copy_filename};
+        copy.read_from_file(filename);
+        _assert(copy.count_solutions(1000, 9'999'999) == full->count_solutions(1000, 9'999'999));
+    }
+
+    _assert(Checkpoint::verify(copy_filename) == -1);
+
+    // A file computed for other maps is refused
+    bool threw = false;
+    try {
+        OutOfCoreIterateMap<shifted_map_set, 1 << 20> other{copy_filename};
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    _assert(threw);
+
+    // Initial values past the prefix, and maps reading more than one word back
+    std::remove(copy_filename);
+
+    StandardIterateMap<shifted_map_set, 1 << 20> shifted;
+    OutOfCoreIterateMap<shifted_map_set, 1 << 20> shifted_out_of_core{copy_filename, 1 << 10};
+
+    shifted.set_initial({ 1, 2, 500'000 });
+    shifted_out_of_core.set_initial({ 1, 2, 500'000 });
+    shifted.compute_till({ .max = 1'000'000 });
+    shifted_out_of_core.compute_till({ .max = 1'000'000 });
+
+    for (int64_t i = 0; i <= 1'000'000; ++i) {
+        _assert(shifted.is_reachable(i) == shifted_out_of_core.is_reachable(i));
+    }
+
+    std::remove(filename);
+    std::remove(copy_filename);
+
+    // A checkpoint ending inside the bit-by-bit prefix is completed on import
+    {
+        VectorizedIterateMap<prefix_map_set, 1 << 20> partial, prefix_full;
+        partial.set_initial({ 3, 7 });
+        prefix_full.set_initial({ 3, 7 });
+        partial.compute_till({ .max = 10 });
+        prefix_full.compute_till({ .max = 100'000 });
+        partial.write_to_file(copy_filename);
+
+        OutOfCoreIterateMap<prefix_map_set, 1 << 20> imported{filename};
+        imported.read_from_file(copy_filename);
+        imported.compute_till({ .max = 100'000 });
+        _assert(imported.count_solutions() == prefix_full.count_solutions());
+    }
+
+    _assert(Checkpoint::verify(filename) == -1);
+
+    // Commits copy the metadata to alternating slots of a second file before rewriting it in place, so damaging
+    // the newest copies (as a crash during a commit could) resumes from the ones left
+    const std::string metadata_filename = std::string{filename} + ".meta";
+    int64_t slot_bytes = 0;
+
+    auto two_commits = [&] {
+        std::remove(filename);
+
+        OutOfCoreIterateMap<standard_map_set, max_entry> m{filename, 1 << 12};
+        m.set_initial({ 1 });
+        m.compute_till({ .max = 1'000'000 });
+        m.compute_till({ .max = 2'000'000 });
+
+        Checkpoint::File file{filename, O_RDONLY};
+        slot_bytes = Checkpoint::read_metadata(file).header.bitmap_offset;
+    };
+
+    auto damage = [&] (const char* name, int64_t offset) {
+        Checkpoint::File file{name, O_RDWR};
+        int64_t bogus = 3'000'000;
+        _assert(pwrite(file.descriptor(), &bogus, sizeof(bogus), offset + offsetof(Checkpoint::Header, max_reached))
+                == sizeof(bogus));
+    };
+
+    auto resumes_at = [&] (int64_t expected) {
+        OutOfCoreIterateMap<standard_map_set, max_entry> m{filename, 1 << 12};
+        _assert(m.max_reached() == expected);
+        _assert(Checkpoint::verify(filename) == -1);
+
+        m.compute_till({ .max = 3'000'000 });
+        _assert(m.count_solutions() == full->count_solutions(0, 3'000'000));
+    };
+
+    two_commits();
+    damage(filename, 0);
+    resumes_at(2'000'000);
+
+    two_commits();
+    damage(filename, 0);
+    damage(metadata_filename.c_str(), slot_bytes);
+    resumes_at(1'000'000);
+
+    two_commits();
+    damage(filename, 0);
+    damage(metadata_filename.c_str(), 0);
+    damage(metadata_filename.c_str(), slot_bytes);
+    threw = false;
+    try {
+        OutOfCoreIterateMap<standard_map_set, max_entry> m{filename};
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    _assert(threw);
+
+    std::remove(filename);
+    std::remove(copy_filename);
+    std::remove(metadata_filename.c_str());
+    std::remove((std::string{copy_filename} + ".meta").c_str());
+}
+
+// Depths and derivation counts by forward search over the maps, for values below limit
+void check_semirings(std::initializer_list<int64_t> initial, int64_t limit) {
+    constexpr auto coeffs = standard_map_set.get_coeffs();
+
+    std::vector<int> depth(limit, 255);
+    std::vector<int64_t> derivations(limit, 0);
+    std::vector<int64_t> frontier;
+
+    for (int64_t i : initial) {
+        depth[i] = 0;
+        frontier.push_back(i);
+    }
+
+    for (int d = 1; !frontier.empty(); ++d) {
+        std::vector<int64_t> next;
+        for (int64_t x : frontier) {
+            for (auto [a, b] : coeffs) {
+                int64_t n = a * x + b;
+                if (n < limit && depth[n] == 255) {
+                    depth[n] = d;
+                    next.push_back(n);
+                }
+            }
+        }
+        frontier = std::move(next);
+    }
+
+    // Every map increases positive values, so derivations can be counted in increasing order
+    for (int64_t n = 0; n < limit; ++n) {
+        derivations[n] += std::count(initial.begin(), initial.end(), n);
+        for (auto [a, b] : coeffs) {
+            if (a * n + b < limit) derivations[a * n + b] += derivations[n];
+        }
+    }
+
+    DepthIterateMap<standard_map_set, 1 << 24> depths;
+    DerivationCountMap<standard_map_set, 1 << 24> counts;
+    SemiringIterateMap<standard_map_set, Semiring::WrappingCount, 1 << 24> wrapped;
+    SemiringIterateMap<standard_map_set, Semiring::Boolean, 1 << 24> reachable;
+    VectorizedIterateMap<standard_map_set, 1 << 24> bitmap;
+
+    depths.set_initial(initial);
+    counts.set_initial(initial);
+    wrapped.set_initial(initial);
+    reachable.set_initial(initial);
+    bitmap.set_initial(initial);
+
+    // In two steps, the second one with threads
+    IterateMapOpts opts;
+    opts.use_threads = true;
+    opts.max = limit - 1;
+
+    depths.compute_till({ .max = limit / 3 });
+    counts.compute_till({ .max = limit / 3 });
+    depths.compute_till(opts);
+    counts.compute_till(opts);
+    wrapped.compute_till(opts);
+    reachable.compute_till(opts);
+    bitmap.compute_till(opts);
+
+    for (int64_t n = 0; n < limit; ++n) {
+        _assert(depths.value(n) == depth[n]);
+        _assert(counts.value(n) == std::min<int64_t>(derivations[n], 255));
+        _assert(wrapped.value(n) == derivations[n] % 256);
+        _assert(reachable.value(n) == bitmap.is_reachable(n));
+    }
+
+    auto histogram = depths.histogram(0, -1, opts);
+    for (int d : { 0, 5, 20, 255 }) {
+        _assert(histogram[d] == std::count(depth.begin(), depth.end(), d));
+    }
+}
+
+void test_semiring_engines() {
+    check_semirings({ 1 }, 5'000'000);
+    check_semirings({ 1, 2, 100'000 }, 1'000'000);
+
+    // 3x maps 0 to itself, so 0 has infinitely many derivations
+    DerivationCountMap<standard_map_set, 1 << 20> saturated;
+    saturated.set_initial({ 0 });
+    saturated.compute_till({ .max = 1000 });
+    _assert(saturated.value(0) == 255 && saturated.value(1) == 255);
+
+    bool threw = false;
+    try {
+        SemiringIterateMap<standard_map_set, Semiring::WrappingCount, 1 << 20> wrapped;
+        wrapped.set_initial({ 0 });
+        wrapped.compute_till({ .max = 1000 });
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    _assert(threw);
+}
+
+void test_reachable_batch() {
+    constexpr int64_t max_entry = 1 << 20;
+
+    VectorizedIterateMap<standard_map_set, max_entry> m;
+    m.set_initial({ 1 });
+    m.compute_till({ .max = max_entry - 1 });
+
+    // Enough queries to be split across threads, with a partial last word
+    std::vector<int64_t> queries(300'037);
+    uint64_t state = 777;
+    for (auto& q : queries) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        q = (state >> 20) % max_entry;
+    }
+    queries.back() = max_entry - 1;
+
+    for (bool threads : { false, true }) {
+        ExecutionOpts opts{ .use_threads = threads };
+
+        auto results = std::make_unique<bool[]>(queries.size());
+        std::vector<uint64_t> packed((queries.size() + 63) / 64, ~uint64_t{0});
+
+        m.is_reachable_batch(queries, std::span<bool>{results.get(), queries.size()}, opts);
+        m.is_reachable_batch(queries, std::span<uint64_t>{packed}, opts);
+
+        for (std::size_t i = 0; i < queries.size(); ++i) {
+            _assert(results[i] == m.is_reachable(queries[i]));
+            _assert(((packed[i / 64] >> (i % 64)) & 1) == m.is_reachable(queries[i]));
+        }
+
+        _assert(packed.back() >> (queries.size() % 64) == 0);
+    }
+
+    uint64_t word;
+    for (int64_t bad : { int64_t{-1}, max_entry }) {
+        std::vector<int64_t> q{ 5, bad };
+        bool threw = false;
+        try {
+            m.is_reachable_batch(q, std::span<uint64_t>{&word, 1});
+        } catch (std::runtime_error&) {
+            threw = true;
+        }
+        _assert(threw);
+    }
+
+    bool threw = false;
+    try {
+        std::vector<int64_t> q(65, 1);
+        m.is_reachable_batch(q, std::span<uint64_t>{&word, 1});
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    _assert(threw);
+}
+
+void test_compressed_bitmap() {
+    // Chunks of every kind and polarity: sparse unset bits, sparse set bits, long runs, noise, and a partial end
+    constexpr int64_t C = CompressedBitmap::CHUNK_BITS;
+    int64_t n = 6 * C + 1000;
+    std::vector<uint64_t> words((n + 63) / 64 + 1);
+
+    uint64_t state = 99;
+    auto next = [&] () { return state = state * 6364136223846793005ULL + 1442695040888963407ULL; };
+    for (int64_t i = 0; i < n; ++i) {
+        int64_t k = i / C;
+        bool bit = (k == 0) ? next() % 100 != 0
+            : (k == 1) ? next() % 100 == 0
+            : (k == 2) ? (i / 300) % 2 == 0
+            : (k == 3) ? next() >> 63
+            : (k == 4) ? true
+            : (k == 5) ? false
+            : i % 7 != 0;
+        words[i / 64] |= uint64_t{bit} << (i % 64);
+    }
+    words.back() = ~uint64_t{0};
+
+    CompressedBitmap compressed{words.data(), n, 4};
+    using Kind = CompressedBitmap::Kind;
+    _assert(compressed.chunk_kind(0) == Kind::Array && compressed.chunk_kind(C) == Kind::Array);
+    _assert(compressed.chunk_kind(2 * C) == Kind::Runs && compressed.chunk_kind(3 * C) == Kind::Bitmap);
+
+    auto bit = [&] (int64_t i) { return (bool)((words[i / 64] >> (i % 64)) & 1); };
+    for (int64_t i = 0; i < n; ++i) _assert(compressed.is_reachable(i) == bit(i));
+
+    std::vector<int64_t> prefix{0};
+    for (int64_t i = 0; i < n; ++i) prefix.push_back(prefix.back() + bit(i));
+
+    for (int i = 0; i < 2000; ++i) {
+        int64_t min = next() % n, max = min + next() % (n - min);
+        _assert(compressed.count_solutions(min, max) == prefix[max + 1] - prefix[min]);
+    }
+    _assert(compressed.count_solutions() == prefix.back());
+
+    for (ResidueClass c : { ResidueClass{}, ResidueClass{ 4, 3 }, ResidueClass{ 7, -1 } }) {
+        for (auto [min, max] : { std::pair<int64_t, int64_t>{ 0, n - 1 }, { 65, 3 * C + 17 }, { 4443, 4443 } }) {
+            std::vector<int64_t> expected[2], got[2];
+            for (int64_t i = min; i <= max; ++i) {
+                if (((i - c.residue) % c.modulus + c.modulus) % c.modulus == 0) expected[bit(i)].push_back(i);
+            }
+
+            compressed.for_each_unreachable([&] (int64_t i) { got[0].push_back(i); }, min, max, c);
+            compressed.for_each_reachable([&] (int64_t i) { got[1].push_back(i); }, min, max, c);
+            _assert(got[0] == expected[0] && got[1] == expected[1]);
+        }
+    }
+
+    constexpr int64_t max_entry = 1 << 22;
+    VectorizedIterateMap<standard_map_set, max_entry> m;
+    m.set_initial({ 1 });
+    m.compute_till({ .max = max_entry - 1 });
+
+    CompressedBitmap from_map = m.compress({ .use_threads = true });
+    _assert(from_map.size() == max_entry);
+    _assert(from_map.count_solutions(1000, max_entry - 1) == m.count_solutions(1000, max_entry - 1));
+    _assert(from_map.memory_usage() * 4 < max_entry / 8);
+
+    std::vector<int64_t> unreachable, got;
+    m.for_each_unreachable([&] (int64_t i) { unreachable.push_back(i); });
+    from_map.for_each_unreachable([&] (int64_t i) { got.push_back(i); });
+    _assert(got == unreachable);
+}
+
+void test_reachable_extended() {
+    constexpr int64_t max_entry = 1 << 22;
+
+    // A small table answering for a large one, including an initial value beyond the small one
+    auto check = [&] <AffineMapSet Maps> (std::initializer_list<int64_t> initial) {
+        VectorizedIterateMap<Maps, max_entry> full, small;
+        full.set_initial(initial);
+        small.set_initial(initial);
+        full.compute_till({ .max = max_entry - 1 });
+        small.compute_till({ .max = 1 << 12 });
+
+        std::vector<int64_t> queries;
+        for (int64_t n = 0; n < max_entry; n += (n < 100'000) ? 1 : 97) queries.push_back(n);
+
+        for (bool threads : { false, true }) {
+            auto results = std::make_unique<bool[]>(queries.size());
+            small.is_reachable_extended_batch(queries, std::span<bool>{results.get(), queries.size()},
+                    { .use_threads = threads });
+
+            for (std::size_t i = 0; i < queries.size(); ++i) _assert(results[i] == full.is_reachable(queries[i]));
+        }
+
+        _assert(small.is_reachable_extended(max_entry - 1) == full.is_reachable(max_entry - 1));
+    };
+
+    check.operator()<standard_map_set>({ 1 });
+    check.operator()<shifted_map_set>({ 1, 50'000 });
+    check.operator()<mixed_map_set>({ 1, 2 });
+    check.operator()<wide_map_set>({ 1, 3, 7 });
+
+    // The memo follows the initial values wherever they change, not just when queried
+    {
+        const char* filename = "/tmp/affine_map_extended_test.bin";
+        VectorizedIterateMap<shifted_map_set, max_entry> full, seeded, small;
+        full.set_initial({ 1 });
+        seeded.set_initial({ 1, 50'000 });
+        full.compute_till({ .max = max_entry - 1 });
+        seeded.compute_till({ .max = max_entry - 1 });
+
+        auto matches = [&] (auto& reference) {
+            for (int64_t n = 40'000; n < max_entry; n += 89) {
+                if (small.is_reachable_extended(n) != reference.is_reachable(n)) return false;
+            }
+            return true;
+        };
+
+        small.set_initial({ 1 });
+        small.compute_till({ .max = 1 << 12 });
+        small.write_to_file(filename);
+        _assert(matches(full));
+
+        small.clear_data();
+        small.set_initial({ 1, 50'000 });
+        small.compute_till({ .max = 1 << 12 });
+        _assert(matches(seeded));
+
+        small.read_from_file(filename);
+        _assert(matches(full));
+
+        std::remove(filename);
+    }
+
+    VectorizedIterateMap<standard_map_set, max_entry> m;
+    m.set_initial({ 1 });
+
+    bool threw = false;
+    try {
+        m.is_reachable_extended(100);
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    _assert(threw);
+
+    m.compute_till({ .max = 1 << 16 });
+    for (int64_t n : { Descent::MAX_VALUE, Descent::MAX_VALUE - 1, int64_t{4443} << 40 }) {
+        m.is_reachable_extended(n);
+    }
+
+    threw = false;
+    try {
+        m.is_reachable_extended(Descent::MAX_VALUE + 1);
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    _assert(threw);
+}
+
+// Compare the sparse engine with a bitmap over every query it supports, computing in a few increments
+template <AffineMapSet Maps>
+void compare_sparse(std::initializer_list<int64_t> initial) {
+    constexpr int64_t max_entry = 1 << 22;
+
+    VectorizedIterateMap<Maps, max_entry> dense;
+    SparseIterateMap<Maps> sparse;
+    dense.set_initial(initial);
+    sparse.set_initial(initial);
+    dense.compute_till({ .max = max_entry - 1 });
+
+    for (int64_t max : { int64_t{10}, int64_t{100'000}, max_entry - 1 }) {
+        sparse.compute_till({ .max = max });
+
+        for (int64_t i = 0; i <= max; ++i) _assert(sparse.is_reachable(i) == dense.is_reachable(i));
+        _assert(sparse.count_solutions() == dense.count_solutions(0, max));
+    }
+
+    uint64_t state = 5;
+    for (int i = 0; i < 1000; ++i) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        int64_t min = (state >> 20) % max_entry, max = min + (state >> 40) % (max_entry - min);
+        _assert(sparse.count_solutions(min, max) == dense.count_solutions(min, max));
+    }
+
+    for (ResidueClass c : { ResidueClass{}, ResidueClass{ 4, 3 } }) {
+        std::vector<int64_t> expected[2], got[2];
+        dense.for_each_reachable([&] (int64_t i) { expected[1].push_back(i); }, 65, 300'000, c);
+        dense.for_each_unreachable([&] (int64_t i) { expected[0].push_back(i); }, 65, 300'000, c);
+        sparse.for_each_reachable([&] (int64_t i) { got[1].push_back(i); }, 65, 300'000, c);
+        sparse.for_each_unreachable([&] (int64_t i) { got[0].push_back(i); }, 65, 300'000, c);
+
+        _assert(got[0] == expected[0] && got[1] == expected[1]);
+    }
+
+    int64_t solutions = 0;
+    sparse.for_each_solution([&] (int64_t i, bool r) {
+        _assert(r == dense.is_reachable(i));
+        solutions += r;
+    }, 0, 4096);
+    _assert(solutions == dense.count_solutions(0, 4096));
+}
+
+void test_sparse_engine() {
+    static_assert(Sparse::has_density_zero<sparse_map_set>() && Sparse::has_density_zero<mixed_map_set>());
+    static_assert(!Sparse::has_density_zero<standard_map_set>());
+    static_assert(Sparse::has_density_zero<coprime_map_set>() && !Sparse::has_density_zero<dense_coprime_map_set>());
+    static_assert(std::is_same_v<AutoIterateMap<coprime_map_set>, SparseIterateMap<coprime_map_set>>);
+    static_assert(std::is_same_v<AutoIterateMap<sparse_map_set>, SparseIterateMap<sparse_map_set>>);
+
+    compare_sparse<sparse_map_set>({ 1, 70, 1000 });
+    compare_sparse<mixed_map_set>({ 1, 2 });
+    compare_sparse<near_dense_map_set>({ 1 });
+
+    // Far beyond any bitmap: about n^0.52 values up to n, at under two bytes each
+    AutoIterateMap<sparse_map_set> m;
+    m.set_initial({ 1 });
+    m.compute_till({ .max = 100'000'000'000'000 });
+
+    _assert(m.count_solutions() == 19'632'597);
+    _assert(m.memory_usage() < (size_t{40} << 20));
+    _assert(m.is_reachable(3 * (5 * (3 * 1 + 1) + 3) + 1) && !m.is_reachable(3 * (5 * 1 + 3) + 2));
+
+    bool threw = false;
+    try {
+        m.write_to_file("/dev/null");
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    _assert(threw);
+}
+
+// Compare the runtime-configured engine with the standard one for the same maps, computing with threads at the end
+template <AffineMapSet Maps>
+void compare_dynamic(std::initializer_list<int64_t> initial) {
+    constexpr int64_t max_entry = 1 << 22;
+
+    constexpr auto coeffs = Maps.get_coeffs();
+
+    StandardIterateMap<Maps, max_entry> standard;
+    DynamicIterateMap dynamic{{ coeffs.begin(), coeffs.end() }, max_entry};
+
+    standard.set_initial(initial);
+    dynamic.set_initial(initial);
+    standard.compute_till({ .max = max_entry - 1 });
+
+    for (int64_t max : { int64_t{1000}, int64_t{77777}, max_entry - 1 }) {
+        dynamic.compute_till({ { .use_threads = max == max_entry - 1 }, max });
+
+        for (int64_t i = 0; i <= max; ++i) _assert(dynamic.is_reachable(i) == standard.is_reachable(i));
+    }
+
+    _assert(dynamic.count_solutions() == standard.count_solutions());
+}
+
+AffineMapSet<
+    AffineMap<6, 1>,
+    AffineMap<7, -7>,
+    AffineMap<11, 512>,
+    AffineMap<2, 3>
+    > generic_map_set;
+
+void test_dynamic_engine() {
+    compare_dynamic<standard_map_set>({ 1 });
+    compare_dynamic<shifted_map_set>({ 1, 2, 500'000 });
+    compare_dynamic<wide_map_set>({ 1, 3, 7 });
+    compare_dynamic<generic_map_set>({ 1, 5 });
+
+    _assert(DynamicIterateMap::is_specialized(6) && !DynamicIterateMap::is_specialized(7));
+
+    for (auto maps : { std::vector<coefficient_pair>{}, { { 1, 0 } }, { { 2, -3 } }, { { 257, 0 } }, { { 3, 513 } } }) {
+        bool threw = false;
+        try {
+            DynamicIterateMap m{maps};
+        } catch (std::runtime_error&) {
+            threw = true;
+        }
+        _assert(threw);
+    }
+
+    // Checkpoints are interchangeable with the compile-time engines for the same maps
+    constexpr int64_t max_entry = 1 << 20;
+    const char* filename = "/tmp/affine_map_test_dynamic.bin";
+
+    DynamicIterateMap dynamic{{ { 2, 1 }, { 3, 0 }, { 3, 2 }, { 3, 7 } }, max_entry};
+    dynamic.set_initial({ 1 });
+    dynamic.compute_till({ .max = 500'000 });
+    dynamic.write_to_file(filename);
+
+    VectorizedIterateMap<standard_map_set, max_entry> vectorized;
+    vectorized.read_from_file(filename);
+    _assert(vectorized.max_reached() == 500'000 && vectorized.count_solutions() == dynamic.count_solutions());
+
+    // Resuming restores seeds above the checkpoint and the rest of a partially stored prefix, as the other engines do
+    VectorizedIterateMap<standard_map_set, max_entry> seeded;
+    seeded.set_initial({ 1, 503'009 });
+    seeded.compute_till({ .max = 1000 });
+    seeded.write_to_file(filename);
+    seeded.compute_till({ .max = 1'000'000 });
+
+    DynamicIterateMap resumed{{ { 2, 1 }, { 3, 0 }, { 3, 2 }, { 3, 7 } }, max_entry};
+    resumed.read_from_file(filename);
+    resumed.compute_till({ .max = 1'000'000 });
+    _assert(resumed.is_reachable(503'009) && resumed.count_solutions() == seeded.count_solutions());
+
+    VectorizedIterateMap<prefix_map_set, max_entry> prefix;
+    prefix.set_initial({ 3, 7 });
+    prefix.compute_till({ .max = 10 });
+    prefix.write_to_file(filename);
+    prefix.compute_till({ .max = 100'000 });
+
+    DynamicIterateMap prefix_resumed{{ { 2, -2 }, { 3, 1 }, { 5, -5 } }, max_entry};
+    prefix_resumed.read_from_file(filename);
+    prefix_resumed.compute_till({ .max = 100'000 });
+    _assert(prefix_resumed.count_solutions() == prefix.count_solutions());
+
+    DynamicIterateMap other{{ { 2, 1 }, { 3, 0 } }, max_entry};
+    bool threw = false;
+    try {
+        other.read_from_file(filename);
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    _assert(threw);
+
+    std::remove(filename);
+}
+
+AffineMapSet<
+    AffineMap<2, 1>,
+    AffineMap<2, 2>
+    > binary_map_set;
+
+void test_descent_certificate() {
+    CertificateOpts opts;
+    opts.max_depth = 16;
+    opts.max_root_modulus = 1 << 14;
+
+    VectorizedIterateMap<standard_map_set, 1 << 24> m;
+    m.set_initial({ 1 });
+    m.compute_till({ .max = 10'000'000 });
+
+    // 4443 is the least unreachable 4k+3, so it must lie below the bound or in an unresolved class
+    DescentCertificate<standard_map_set> four{{ .modulus = 4, .residue = 3 }};
+    auto result = four.search(opts);
+    four.check(result, m);
+
+    bool open = std::any_of(result.unresolved.begin(), result.unresolved.end(), [] (auto& u) {
+        return 4443 % u.c.modulus == u.c.residue;
+    });
+    _assert(result.resolved_classes > 0 && !result.proves_reachable());
+    _assert(result.bound >= 4443 ? result.unreachable_below_bound > 0 : open);
+
+    DescentCertificate<standard_map_set> eight{{ .modulus = 8, .residue = 7 }};
+    result = eight.search(opts);
+
+    opts.use_threads = true;
+    auto threaded = eight.search(opts);
+    _assert(threaded.bound == result.bound && threaded.resolved_classes == result.resolved_classes);
+    _assert(threaded.unresolved.size() == result.unresolved.size() && !result.unresolved.empty());
+
+    eight.check(result, m, opts);
+    _assert(result.unreachable_below_bound == 0 && !result.proves_reachable());
+    for (auto& u : result.unresolved) _assert(u.unreachable == 0 && u.first_unreachable == -1);
+
+    // From 0, 2x + 1 and 2x + 2 reach everything, and every predecessor stays in the class of all values
+    VectorizedIterateMap<binary_map_set, 1 << 16> binary;
+    binary.set_initial({ 0 });
+    binary.compute_till({ .max = 1000 });
+
+    DescentCertificate<binary_map_set> all{{ .modulus = 1, .residue = 0 }};
+    result = all.search();
+    all.check(result, binary);
+    _assert(result.bound == 2 && result.unresolved.empty() && result.proves_reachable());
+}
+
+// Query the finalized prefix from this thread while another computes, then cancel and budget runs
+void test_compute_async() {
+    constexpr int64_t reference_max = 1 << 22, max_entry = int64_t{1} << 32;
+
+    VectorizedIterateMap<standard_map_set, reference_max + 1> reference;
+    reference.set_initial({ 1 });
+    reference.compute_till({ .max = reference_max });
+
+    VectorizedIterateMap<standard_map_set, max_entry> m;
+    m.set_initial({ 1 });
+    _assert(m.finalized() == -1 && !m.try_is_reachable(0));
+
+    {
+        auto task = m.compute_till_async({ { .use_threads = true }, (int64_t{1} << 30) - 1 });
+
+        int64_t last = -1, checked = 0;
+        uint64_t state = 99;
+        while (!task.is_ready() || checked == 0) {
+            int64_t f = m.finalized();
+            _assert(f >= last);
+            last = f;
+
+            if (f < 0) continue;
+            _assert(!m.try_is_reachable(f + 1) || m.finalized() > f);
+
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            int64_t n = (state >> 20) % (std::min(f, reference_max) + 1);
+            _assert(*m.try_is_reachable(n) == reference.is_reachable(n));
+            checked++;
+        }
+
+        _assert(task.get() == (int64_t{1} << 30) - 1 && m.finalized() == m.max_reached());
+        _assert(m.count_finalized(0, reference_max) == reference.count_solutions());
+    }
+
+    // Cancelled tasks stop at the end of a step, with everything up to it final
+    auto task = m.compute_till_async({ .max = max_entry - 1 });
+    while (m.finalized() < (int64_t{1} << 30) + 64);
+    task.cancel();
+
+    int64_t reached = task.get();
+    _assert(reached < max_entry - 1 && (reached + 1) % Async::STEP_BITS == 0 && m.finalized() == reached);
+
+    task = m.compute_till_async({ .max = max_entry - 1 }, { .max_bytes = int64_t{1} << 28 });
+    _assert(task.get() == (int64_t{1} << 31) - 1 && m.max_reached() == (int64_t{1} << 31) - 1);
+
+    // The word holding an unaligned max_reached is recomputed on resuming, so it stays unpublished until then
+    StandardIterateMap<standard_map_set, reference_max + 1> standard;
+    VectorizedIterateMap<standard_map_set, reference_max + 1> vectorized;
+    standard.set_initial({ 1 });
+    vectorized.set_initial({ 1 });
+    standard.compute_till({ .max = 1'000'037 });
+    vectorized.compute_till({ .max = 1'000'037 });
+    _assert(standard.finalized() == 999'999 && vectorized.finalized() == 999'999);
+
+    auto check_while_computing = [&] (auto& engine) {
+        auto task = engine.compute_till_async({ .max = reference_max });
+
+        int64_t checked = 0;
+        uint64_t state = 7;
+        while (!task.is_ready() || checked == 0) {
+            int64_t f = engine.finalized();
+            _assert(f >= 999'999 && (f + 1) % 64 == 0);
+
+            // Mostly the newest word, which the resumed computation was writing next to
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            int64_t n = (state >> 40) % 4 ? f - (int64_t)((state >> 20) % 64) : (int64_t)((state >> 20) % (f + 1));
+            _assert(*engine.try_is_reachable(n) == reference.is_reachable(n));
+            checked++;
+        }
+
+        _assert(task.get() == reference_max && engine.finalized() == reference_max - 1);
+        _assert(engine.count_finalized() == reference.count_solutions(0, reference_max - 1));
+    };
+
+    check_while_computing(standard);
+    check_while_computing(vectorized);
+
+    m.clear_data();
+    _assert(m.finalized() == -1);
+}
+
 const std::vector<TestCase> test_cases = {
-    { "LinearMapSet::apply", test_map_set_apply }
+    { "LinearMapSet::apply", test_map_set_apply },
+    { "VectorizedIterateMap::compute_till", test_vectorized_matches_standard },
+    { "WatermarkScheduler::run", test_watermark_scheduler },
+    { "IterateMap::count_solutions", test_count_solutions_range },
+    { "RankSelectIndex", test_rank_select_index },
+    { "IterateMap::read_from_file", test_checkpoint_round_trip },
+    { "IterateMap::export_unreachable", test_export_unreachable },
+    { "BitmapStorage", test_growable_storage },
+    { "VectorizedIterateMap::stream_till", test_stream_till },
+    { "IterateMap::derivation", test_derivation },
+    { "BatchIterateMap", test_batch_iterate_map },
+    { "IterateMap::residue_stats", test_residue_stats },
+    { "ExecutionOpts::progress_callback", test_progress_reports },
+    { "IterateMap::for_each_unreachable", test_for_each_filters },
+    { "OutOfCoreIterateMap", test_out_of_core },
+    { "SemiringIterateMap", test_semiring_engines },
+    { "IterateMap::is_reachable_batch", test_reachable_batch },
+    { "CompressedBitmap", test_compressed_bitmap },
+    { "IterateMap::is_reachable_extended", test_reachable_extended },
+    { "SparseIterateMap", test_sparse_engine },
+    { "DynamicIterateMap", test_dynamic_engine },
+    { "DescentCertificate", test_descent_certificate },
+    { "IterateMap::compute_till_async", test_compute_async }
 };
 
 int main(int argc, char** argv) {
     current_test_case = ("undefined");
 
     auto regex_opts = std::regex::icase;
-    std::regex regex = std::regex{(argc >= 2) ? argv[0] : "", regex_opts};
+    std::regex regex = std::regex{(argc >= 2) ? argv[1] : "", regex_opts};
 
     int cases_called = 0, total_cases = 0;
     for (auto& case_ : test_cases) {
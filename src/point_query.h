@@ -0,0 +1,96 @@
+/**
+ * Batched lookups of single bits in the little-endian word layout used by the engines.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <immintrin.h>
+
+#include "scheduler.h"
+
+namespace Affine {
+    namespace PointQuery {
+        // How many queries ahead the cache line of a query is prefetched
+        constexpr int64_t PREFETCH_DISTANCE = 32;
+
+        // Number of queries per chunk handed to each thread by lookup_bits_parallel (a multiple of 64)
+        constexpr int64_t PARALLEL_CHUNK_QUERIES = 1 << 16;
+
+        /**
+         * Bits of the queries q[0..n), n <= 64, packed into a word (bit j for q[j]). The queries are independent,
+         * so their loads all overlap; the out-of-order core already keeps as many misses in flight as it can,
+         * and the prefetches only cover the first few lookups of the next word.
+         */
+        inline uint64_t lookup_word(const uint64_t* words, const int64_t* q, int64_t n, const int64_t* end) {
+            const int64_t* ahead = q + PREFETCH_DISTANCE;
+            uint64_t bits = 0;
+            int64_t j = 0;
+
+#ifdef __AVX2__
+            for (; j + 4 <= n; j += 4) {
+                for (int k = 0; k < 4; ++k) {
+                    if (ahead + j + k < end) _mm_prefetch((const char*)(words + (ahead[j + k] >> 6)), _MM_HINT_T0);
+                }
+
+                __m256i i = _mm256_loadu_si256((const __m256i*)(q + j));
+                __m256i w = _mm256_i64gather_epi64((const long long*)words, _mm256_srli_epi64(i, 6), 8);
+                // Move each looked-up bit to the sign bit of its lane
+                __m256i b = _mm256_slli_epi64(_mm256_srlv_epi64(w, _mm256_and_si256(i, _mm256_set1_epi64x(63))), 63);
+
+                bits |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(b)) << j;
+            }
+#endif
+
+            for (; j < n; ++j) {
+                if (ahead + j < end) _mm_prefetch((const char*)(words + (ahead[j] >> 6)), _MM_HINT_T0);
+                bits |= ((words[q[j] >> 6] >> (q[j] & 63)) & 1) << j;
+            }
+
+            return bits;
+        }
+    }
+
+    /**
+     * Look up the bits of queries[0..count) and pass each word of results to emit(w, bits), where bit j of bits is
+     * the result of query 64 * w + j. Queries must be in bounds.
+     */
+    template <typename Emit>
+        void lookup_bits(const uint64_t* words, const int64_t* queries, int64_t count, Emit emit) {
+            const int64_t* end = queries + count;
+
+            for (int64_t w = 0; w * 64 < count; ++w) {
+                emit(w, PointQuery::lookup_word(words, queries + w * 64, std::min(count - w * 64, int64_t{64}), end));
+            }
+        }
+
+    /**
+     * lookup_bits split into chunks across the thread pool; small batches are looked up on the calling thread.
+     * emit is called concurrently, but never twice for the same w.
+     */
+    template <typename Emit>
+        void lookup_bits_parallel(const uint64_t* words, const int64_t* queries, int64_t count, int thread_count,
+                Emit emit) {
+            constexpr int64_t C = PointQuery::PARALLEL_CHUNK_QUERIES;
+
+            if (thread_count <= 1 || count < 4 * C) {
+                lookup_bits(words, queries, count, emit);
+                return;
+            }
+
+            int64_t chunks = (count + C - 1) / C;
+            std::atomic<int64_t> next{0};
+
+            ThreadPool::shared().run(thread_count, [&] (int) {
+                int64_t c;
+                while ((c = next.fetch_add(1, std::memory_order_relaxed)) < chunks) {
+                    int64_t offset = c * (C / 64);
+                    lookup_bits(words, queries + c * C, std::min(C, count - c * C), [&] (int64_t w, uint64_t bits) {
+                        emit(offset + w, bits);
+                    });
+                }
+            });
+        }
+}
@@ -0,0 +1,156 @@
+/**
+ * Population counts over the little-endian word layout used by the engines.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+#include "scheduler.h"
+
+namespace Affine {
+    namespace Popcount {
+#ifdef __AVX2__
+        // Popcount of each byte via a nibble lookup, summed into four 64-bit lanes (Wojciech Muła)
+        inline __m256i popcount256(__m256i v) {
+            const __m256i lookup = _mm256_setr_epi8(
+                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+            const __m256i low_mask = _mm256_set1_epi8(0x0f);
+
+            const __m256i lo = _mm256_and_si256(v, low_mask);
+            const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+            const __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+
+            return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+        }
+
+        // Carry-save adder: (h, l) = a + b + c, bitwise
+        inline void csa(__m256i& h, __m256i& l, __m256i a, __m256i b, __m256i c) {
+            const __m256i u = _mm256_xor_si256(a, b);
+            h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+            l = _mm256_xor_si256(u, c);
+        }
+
+        // Harley-Seal popcount of n 256-bit vectors: 16 vectors are reduced with CSAs before each real popcount
+        inline uint64_t harley_seal(const __m256i* d, size_t n) {
+            __m256i total = _mm256_setzero_si256();
+            __m256i ones = _mm256_setzero_si256(), twos = _mm256_setzero_si256(),
+                    fours = _mm256_setzero_si256(), eights = _mm256_setzero_si256(), sixteens;
+            __m256i twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+
+            auto load = [&] (size_t i) { return _mm256_loadu_si256(d + i); };
+
+            size_t i = 0;
+            for (; i + 16 <= n; i += 16) {
+                csa(twos_a, ones, ones, load(i), load(i + 1));
+                csa(twos_b, ones, ones, load(i + 2), load(i + 3));
+                csa(fours_a, twos, twos, twos_a, twos_b);
+                csa(twos_a, ones, ones, load(i + 4), load(i + 5));
+                csa(twos_b, ones, ones, load(i + 6), load(i + 7));
+                csa(fours_b, twos, twos, twos_a, twos_b);
+                csa(eights_a, fours, fours, fours_a, fours_b);
+                csa(twos_a, ones, ones, load(i + 8), load(i + 9));
+                csa(twos_b, ones, ones, load(i + 10), load(i + 11));
+                csa(fours_a, twos, twos, twos_a, twos_b);
+                csa(twos_a, ones, ones, load(i + 12), load(i + 13));
+                csa(twos_b, ones, ones, load(i + 14), load(i + 15));
+                csa(fours_b, twos, twos, twos_a, twos_b);
+                csa(eights_b, fours, fours, fours_a, fours_b);
+                csa(sixteens, eights, eights, eights_a, eights_b);
+
+                total = _mm256_add_epi64(total, popcount256(sixteens));
+            }
+
+            total = _mm256_slli_epi64(total, 4);
+            total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(eights), 3));
+            total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(fours), 2));
+            total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(twos), 1));
+            total = _mm256_add_epi64(total, popcount256(ones));
+
+            for (; i < n; ++i) {
+                total = _mm256_add_epi64(total, popcount256(load(i)));
+            }
+
+            return static_cast<uint64_t>(_mm256_extract_epi64(total, 0)) + static_cast<uint64_t>(_mm256_extract_epi64(total, 1))
+                + static_cast<uint64_t>(_mm256_extract_epi64(total, 2)) + static_cast<uint64_t>(_mm256_extract_epi64(total, 3));
+        }
+#endif
+
+        // Number of words per chunk handed to each thread by count_bits_parallel
+        constexpr int64_t PARALLEL_CHUNK_WORDS = 1 << 20;
+    }
+
+    // Count the number of set bits in [start, start + count), where count is in bytes
+    inline int64_t vectorized_popcnt(const void* start, size_t count) {
+        const char* p = static_cast<const char*>(start);
+        int64_t result = 0;
+
+#ifdef __AVX2__
+        result += Popcount::harley_seal(reinterpret_cast<const __m256i*>(p), count / 32);
+        p += count / 32 * 32;
+        count %= 32;
+#endif
+
+        for (; count >= 8; count -= 8, p += 8) {
+            uint64_t w;
+            std::memcpy(&w, p, 8);
+            result += __builtin_popcountll(w);
+        }
+
+        for (; count > 0; --count, ++p) {
+            result += __builtin_popcount(static_cast<unsigned char>(*p));
+        }
+
+        return result;
+    }
+
+    /**
+     * Count the set bits with indices in [min, max], inclusive, masking the partial words at either end
+     */
+    inline int64_t count_bits(const uint64_t* words, int64_t min, int64_t max) {
+        if (max < min) return 0;
+
+        int64_t first = min >> 6, last = max >> 6;
+        uint64_t first_mask = ~uint64_t{0} << (min & 63);
+        uint64_t last_mask = ~uint64_t{0} >> (63 - (max & 63));
+
+        if (first == last) {
+            return __builtin_popcountll(words[first] & first_mask & last_mask);
+        }
+
+        return __builtin_popcountll(words[first] & first_mask)
+            + vectorized_popcnt(words + first + 1, (last - first - 1) * sizeof(uint64_t))
+            + __builtin_popcountll(words[last] & last_mask);
+    }
+
+    /**
+     * count_bits split into chunks across the thread pool; small ranges are counted on the calling thread
+     */
+    inline int64_t count_bits_parallel(const uint64_t* words, int64_t min, int64_t max, int thread_count) {
+        constexpr int64_t chunk_bits = Popcount::PARALLEL_CHUNK_WORDS * 64;
+
+        if (thread_count <= 1 || max - min < 4 * chunk_bits) {
+            return count_bits(words, min, max);
+        }
+
+        int64_t chunks = (max - min) / chunk_bits + 1;
+        std::atomic<int64_t> next{0}, total{0};
+
+        ThreadPool::shared().run(thread_count, [&] (int) {
+            int64_t c, local = 0;
+            while ((c = next.fetch_add(1, std::memory_order_relaxed)) < chunks) {
+                int64_t lo = min + c * chunk_bits;
+                local += count_bits(words, lo, std::min(max, lo + chunk_bits - 1));
+            }
+
+            total.fetch_add(local, std::memory_order_relaxed);
+        });
+
+        return total.load();
+    }
+}
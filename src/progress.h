@@ -0,0 +1,176 @@
+/**
+ * Progress reporting for long computations, sampled from a separate thread so that the engines only bump a counter
+ * once per tile or block.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace Affine {
+    struct ProgressReport {
+        // Fraction of the requested range computed, in [0, 1]
+        double progress;
+        int64_t bits_done;
+        int64_t bits_total;
+        // Tiles or blocks finished
+        int64_t blocks_done;
+        double elapsed_seconds;
+        // Throughput since the previous report
+        double bits_per_second;
+        // Estimated time left at the average throughput so far; negative if nothing is done yet
+        double eta_seconds;
+    };
+
+    /**
+     * Per-thread counters plus a sampler thread that turns them into a ProgressReport every period. Each counter
+     * has a single writer, so updates are plain relaxed loads and stores on a cache line of their own.
+     */
+    class ProgressMeter {
+        struct alignas(64) Counter {
+            std::atomic<int64_t> bits{0};
+            std::atomic<int64_t> blocks{0};
+        };
+
+        using Clock = std::chrono::steady_clock;
+
+        std::function<void(const ProgressReport&)> report;
+        std::chrono::duration<double> period;
+        int64_t total;
+
+        std::unique_ptr<Counter[]> counters;
+        int slots;
+
+        Clock::time_point start = Clock::now();
+        Clock::time_point last_time = start;
+        int64_t last_bits = 0;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping = false;
+        std::thread sampler;
+
+        ProgressReport sample() {
+            int64_t bits = 0, blocks = 0;
+            for (int i = 0; i < slots; ++i) {
+                bits += counters[i].bits.load(std::memory_order_relaxed);
+                blocks += counters[i].blocks.load(std::memory_order_relaxed);
+            }
+
+            bits = std::min(bits, total);
+
+            auto now = Clock::now();
+            double elapsed = std::chrono::duration<double>(now - start).count();
+            double interval = std::chrono::duration<double>(now - last_time).count();
+
+            ProgressReport r;
+            r.progress = (total > 0) ? (double)bits / total : 1.0;
+            r.bits_done = bits;
+            r.bits_total = total;
+            r.blocks_done = blocks;
+            r.elapsed_seconds = elapsed;
+            r.bits_per_second = (interval > 0) ? (bits - last_bits) / interval : 0;
+            r.eta_seconds = (bits > 0) ? elapsed * (total - bits) / bits : -1;
+
+            last_time = now;
+            last_bits = bits;
+
+            return r;
+        }
+
+        void sampler_loop() {
+            std::unique_lock lock{mutex};
+
+            while (!wake.wait_for(lock, period, [&] { return stopping; })) {
+                report(sample());
+            }
+        }
+    public:
+        /**
+         * Report on total_bits of work, done by up to slots threads, every period_seconds
+         */
+        ProgressMeter(std::function<void(const ProgressReport&)> report, double period_seconds, int64_t total_bits,
+                int slots) : report(std::move(report)), period(std::max(period_seconds, 0.001)),
+                total(std::max(total_bits, int64_t{0})), counters(std::make_unique<Counter[]>(std::max(slots, 1))),
+                slots(std::max(slots, 1)) {
+            sampler = std::thread{[this] { sampler_loop(); }};
+        }
+
+        ProgressMeter(const ProgressMeter&) = delete;
+        ProgressMeter& operator=(const ProgressMeter&) = delete;
+
+        ~ProgressMeter() {
+            {
+                std::lock_guard lock{mutex};
+                stopping = true;
+            }
+
+            wake.notify_all();
+            if (sampler.joinable()) sampler.join();
+        }
+
+        /**
+         * Record bits of work finished by the thread owning slot
+         */
+        void add(int slot, int64_t bits) {
+            Counter& c = counters[slot];
+            c.bits.store(c.bits.load(std::memory_order_relaxed) + bits, std::memory_order_relaxed);
+            c.blocks.store(c.blocks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        /**
+         * Stop sampling and send a last report, from the calling thread
+         */
+        void finish() {
+            {
+                std::lock_guard lock{mutex};
+                if (stopping) return;
+                stopping = true;
+            }
+
+            wake.notify_all();
+            sampler.join();
+
+            report(sample());
+        }
+    };
+
+    /**
+     * Runs a ProgressMeter for the duration of a computation and publishes it through current, unless a report
+     * callback is missing or an enclosing computation already publishes one (whose meter then gets all the work)
+     */
+    class ProgressScope {
+        ProgressMeter*& current;
+        std::unique_ptr<ProgressMeter> meter;
+    public:
+        ProgressScope(ProgressMeter*& current, std::function<void(const ProgressReport&)> report,
+                double period_seconds, int64_t total_bits, int slots) : current(current) {
+            if (!current && report) {
+                meter = std::make_unique<ProgressMeter>(std::move(report), period_seconds, total_bits, slots);
+                current = meter.get();
+            }
+        }
+
+        ProgressScope(const ProgressScope&) = delete;
+        ProgressScope& operator=(const ProgressScope&) = delete;
+
+        ~ProgressScope() {
+            if (meter) current = nullptr;
+        }
+
+        /**
+         * Send the last report once the computation has succeeded
+         */
+        void finish() {
+            if (meter) meter->finish();
+        }
+    };
+}
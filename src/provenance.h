@@ -0,0 +1,97 @@
+/**
+ * Optional record of how each reachable value was produced, for reconstructing derivation chains.
+ */
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+#include "bitmap_storage.h"
+#include "map_def.h"
+
+namespace Affine {
+    /**
+     * For every reachable value, the index of one map that produces it from a reachable value, stored as
+     * ceil(log2(map_count)) bit planes in the engines' word layout: bit i of plane k is bit k of the map index for i.
+     * That is 2 bits per value for four maps (misc/m.cc's GET_HISTORY kept one bit per map).
+     *
+     * The recorded producer was always final before the value itself was set, so following producers back from any
+     * reachable value ends at an initial value.
+     */
+    template <AffineMapSet Maps>
+        class ProvenanceIndex {
+        public:
+            static constexpr int PLANES = std::bit_width(Maps.map_count - 1);
+
+        private:
+            bool enabled = false;
+            int64_t max_words;
+            std::vector<BitmapStorage> planes;
+        public:
+            explicit ProvenanceIndex(int64_t max_words) : max_words(max_words) {
+
+            }
+
+            bool is_enabled() const {
+                return enabled;
+            }
+
+            /**
+             * Start recording (reserving address space for the planes), or stop and release everything
+             */
+            void enable(bool enable) {
+                enabled = enable;
+                planes.clear();
+
+                if (enable) {
+                    for (int k = 0; k < PLANES; ++k) planes.emplace_back(max_words);
+                }
+            }
+
+            /**
+             * Forget all recorded producers, keeping the planes reserved if enabled
+             */
+            void clear() {
+                for (auto& plane : planes) plane.reset();
+            }
+
+            /**
+             * Make the words [0, words) of every plane accessible
+             */
+            void ensure(int64_t words) {
+                for (auto& plane : planes) plane.ensure(words);
+            }
+
+            /**
+             * Pointers to word w of every plane, for the word kernel
+             */
+            std::array<uint64_t*, PLANES> planes_at(int64_t w) {
+                std::array<uint64_t*, PLANES> p{};
+                for (int k = 0; k < PLANES; ++k) p[k] = planes[k].data() + w;
+                return p;
+            }
+
+            /**
+             * Record that value i is produced by map m; i must not have been recorded before
+             */
+            void record(int64_t i, int m) {
+                for (int k = 0; k < PLANES; ++k) {
+                    planes[k].data()[i >> 6] |= uint64_t((m >> k) & 1) << (i & 63);
+                }
+            }
+
+            /**
+             * Index of the recorded map producing the reachable, non-initial value i
+             */
+            int producer(int64_t i) const {
+                int m = 0;
+                for (int k = 0; k < PLANES; ++k) {
+                    m |= static_cast<int>((planes[k].data()[i >> 6] >> (i & 63)) & 1) << k;
+                }
+                return m;
+            }
+        };
+}
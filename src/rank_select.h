@@ -0,0 +1,208 @@
+/**
+ * Succinct rank/select index over a bitmap in the engines' word layout.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <immintrin.h>
+
+#include "popcount.h"
+#include "scheduler.h"
+#include "word_kernel.h"
+
+namespace Affine {
+    /**
+     * Two-level cumulative counts: the number of set bits before each 2^16-bit superblock (64 bits per entry), and
+     * before each 512-bit block relative to its superblock (16 bits per entry). That is about 3.1% on top of the
+     * bitmap. A block is one cache line, so rank touches two index entries and one line of the bitmap.
+     */
+    class RankSelectIndex {
+    public:
+        static constexpr int64_t BLOCK_BITS = 512;
+        static constexpr int64_t SUPERBLOCK_BITS = 1 << 16;
+        static constexpr int64_t BLOCKS_PER_SUPERBLOCK = SUPERBLOCK_BITS / BLOCK_BITS;
+
+    private:
+        // Entry s counts the set bits in [0, s * SUPERBLOCK_BITS); one extra entry covers the end of the bitmap
+        std::vector<uint64_t> superblocks;
+        // Entry b counts the set bits in [superblock start, b * BLOCK_BITS)
+        std::vector<uint16_t> blocks;
+
+        // Number of indexed bits
+        int64_t bits = 0;
+
+        // Word i of the bitmap (inverted for zeros), restricted to the indexed bits
+        template <bool ones=true>
+            uint64_t masked_word(const uint64_t* words, int64_t i) const {
+                int64_t valid = bits - i * 64;
+                if (valid <= 0) return 0;
+
+                uint64_t w = ones ? words[i] : ~words[i];
+                return (valid >= 64) ? w : w & ((uint64_t{1} << valid) - 1);
+            }
+
+        // Index entries of superblock s; returns the number of set bits in it
+        uint64_t build_superblock(const uint64_t* words, int64_t s) {
+            uint64_t count = 0;
+            int64_t first_block = s * BLOCKS_PER_SUPERBLOCK;
+            int64_t last_block = std::min(first_block + BLOCKS_PER_SUPERBLOCK, (int64_t)blocks.size());
+
+            for (int64_t b = first_block; b < last_block; ++b) {
+                blocks[b] = static_cast<uint16_t>(count);
+
+                for (int64_t w = b * 8; w < b * 8 + 8; ++w) {
+                    count += __builtin_popcountll(masked_word(words, w));
+                }
+            }
+
+            return count;
+        }
+
+        // Set (or for zeros, unset) bits before superblock s and block b
+        template <bool ones>
+            int64_t superblock_rank(int64_t s) const {
+                return ones ? superblocks[s] : s * SUPERBLOCK_BITS - superblocks[s];
+            }
+
+        template <bool ones>
+            int64_t block_rank(int64_t b) const {
+                int64_t within = (b % BLOCKS_PER_SUPERBLOCK) * BLOCK_BITS;
+                return ones ? blocks[b] : within - blocks[b];
+            }
+
+        static int select_in_word(uint64_t w, int64_t k) {
+#ifdef __BMI2__
+            return __builtin_ctzll(Kernel::pdep(uint64_t{1} << k, w));
+#else
+            for (; k > 0; --k) w &= w - 1;
+            return __builtin_ctzll(w);
+#endif
+        }
+    public:
+        /**
+         * Number of indexed bits
+         */
+        int64_t size() const {
+            return bits;
+        }
+
+        /**
+         * Bytes used by the index itself
+         */
+        size_t memory_usage() const {
+            return superblocks.size() * sizeof(uint64_t) + blocks.size() * sizeof(uint16_t);
+        }
+
+        /**
+         * Index the bits [0, n) of words. Only the superblocks from the previous end onwards are recomputed, so
+         * calling this again after the bitmap has grown is incremental.
+         */
+        void extend(const uint64_t* words, int64_t n, int thread_count = 1) {
+            if (n < bits) bits = 0;
+
+            int64_t first = bits / SUPERBLOCK_BITS;
+            int64_t superblock_count = n / SUPERBLOCK_BITS + 1;
+
+            bits = n;
+            superblocks.resize(superblock_count + 1);
+            blocks.resize(n / BLOCK_BITS + 1);
+
+            // Per-superblock entries are independent; only the cumulative superblock counts are sequential
+            std::vector<uint64_t> totals(superblock_count - first);
+            std::atomic<int64_t> next{first};
+
+            auto work = [&] (int) {
+                int64_t s;
+                while ((s = next.fetch_add(1, std::memory_order_relaxed)) < superblock_count) {
+                    totals[s - first] = build_superblock(words, s);
+                }
+            };
+
+            if (thread_count > 1 && superblock_count - first > 64) {
+                ThreadPool::shared().run(thread_count, work);
+            } else {
+                work(0);
+            }
+
+            for (int64_t s = first; s < superblock_count; ++s) {
+                superblocks[s + 1] = superblocks[s] + totals[s - first];
+            }
+        }
+
+        void clear() {
+            superblocks.clear();
+            blocks.clear();
+            bits = 0;
+        }
+
+        /**
+         * Number of set bits in [0, i), for i <= size()
+         */
+        int64_t rank(const uint64_t* words, int64_t i) const {
+            int64_t b = i / BLOCK_BITS;
+            int64_t r = superblocks[i / SUPERBLOCK_BITS] + blocks[b];
+
+            for (int64_t w = b * 8; w < i / 64; ++w) {
+                r += __builtin_popcountll(words[w]);
+            }
+
+            if (i & 63) {
+                r += __builtin_popcountll(words[i / 64] & ((uint64_t{1} << (i & 63)) - 1));
+            }
+
+            return r;
+        }
+
+        /**
+         * Number of set bits in [min, max], for max < size()
+         */
+        int64_t count(const uint64_t* words, int64_t min, int64_t max) const {
+            return rank(words, max + 1) - rank(words, min);
+        }
+
+        /**
+         * Position of the k-th (0-based) set bit if ones, or unset bit otherwise; -1 if there are not that many
+         */
+        template <bool ones>
+            int64_t select(const uint64_t* words, int64_t k) const {
+                int64_t superblock_count = bits / SUPERBLOCK_BITS + 1;
+                int64_t total = ones ? superblocks[superblock_count] : bits - superblocks[superblock_count];
+
+                if (k < 0 || k >= total) {
+                    return -1;
+                }
+
+                // Last superblock starting with at most k matching bits before it
+                int64_t lo = 0, hi = superblock_count - 1;
+                while (lo < hi) {
+                    int64_t mid = (lo + hi + 1) / 2;
+                    if (superblock_rank<ones>(mid) <= k) lo = mid; else hi = mid - 1;
+                }
+
+                k -= superblock_rank<ones>(lo);
+
+                int64_t first_block = lo * BLOCKS_PER_SUPERBLOCK;
+                int64_t b_lo = first_block, b_hi = std::min(first_block + BLOCKS_PER_SUPERBLOCK, (int64_t)blocks.size()) - 1;
+                while (b_lo < b_hi) {
+                    int64_t mid = (b_lo + b_hi + 1) / 2;
+                    if (block_rank<ones>(mid) <= k) b_lo = mid; else b_hi = mid - 1;
+                }
+
+                k -= block_rank<ones>(b_lo);
+
+                for (int64_t w = b_lo * 8; ; ++w) {
+                    uint64_t word = masked_word<ones>(words, w);
+                    int64_t c = __builtin_popcountll(word);
+                    if (k < c) {
+                        return w * 64 + select_in_word(word, k);
+                    }
+
+                    k -= c;
+                }
+            }
+    };
+}
@@ -0,0 +1,187 @@
+/**
+ * Statistics of the unreachable values in every residue class of several moduli, from one sweep over the bitmap.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <immintrin.h>
+
+#include "scheduler.h"
+
+namespace Affine {
+    struct ResidueClassStats {
+        // Number of unreachable values in the class
+        int64_t count = 0;
+        // First and last unreachable value in the class, or -1 if there are none
+        int64_t first = -1;
+        int64_t last = -1;
+        // Largest difference between consecutive unreachable values in the class, or 0 if there are fewer than two
+        int64_t largest_gap = 0;
+
+        // Combine with the stats of a range directly after this one
+        void append(const ResidueClassStats& next) {
+            if (next.count == 0) return;
+
+            if (count == 0) {
+                *this = next;
+                return;
+            }
+
+            largest_gap = std::max({ largest_gap, next.largest_gap, next.first - last });
+            count += next.count;
+            last = next.last;
+        }
+    };
+
+    /**
+     * Stats for every class r mod m of every requested modulus m
+     */
+    class ResidueStats {
+    public:
+        static constexpr int MAX_MODULUS = 4096;
+
+        // Words per chunk handed to each thread
+        static constexpr int64_t CHUNK_WORDS = 1 << 18;
+
+    private:
+        std::vector<int> _moduli;
+        // Classes of modulus i start at offsets[i]
+        std::vector<int64_t> offsets;
+        std::vector<ResidueClassStats> classes;
+
+        // Value of i mod m for i < 64, for every modulus; this and the word's base residue give each bit's class
+        std::vector<uint16_t> bit_residues;
+
+        void add_word(uint64_t unreachable, int64_t w, std::vector<int>& base) {
+            for (std::size_t i = 0; i < _moduli.size(); ++i) {
+                base[i] = static_cast<int>((64 * w) % _moduli[i]);
+            }
+
+            while (unreachable) {
+                int bit = __builtin_ctzll(unreachable);
+                int64_t v = 64 * w + bit;
+                unreachable &= unreachable - 1;
+
+                for (std::size_t i = 0; i < _moduli.size(); ++i) {
+                    int r = base[i] + bit_residues[64 * i + bit];
+                    if (r >= _moduli[i]) r -= _moduli[i];
+
+                    ResidueClassStats& c = classes[offsets[i] + r];
+                    if (c.count++ == 0) {
+                        c.first = v;
+                    } else {
+                        c.largest_gap = std::max(c.largest_gap, v - c.last);
+                    }
+                    c.last = v;
+                }
+            }
+        }
+
+        // Accumulate the unreachable values in [min, max]. Unreachable values are sparse in practice, so runs of
+        // four fully reachable words are skipped with one vector test.
+        void scan(const uint64_t* words, int64_t min, int64_t max) {
+            std::vector<int> base(_moduli.size());
+            int64_t first = min >> 6, last = max >> 6;
+
+            for (int64_t w = first; w <= last; ) {
+#ifdef __AVX2__
+                if (w > first && w + 4 <= last) {
+                    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + w));
+                    if (_mm256_testc_si256(v, _mm256_set1_epi64x(-1))) {
+                        w += 4;
+                        continue;
+                    }
+                }
+#endif
+                uint64_t unreachable = ~words[w];
+                if (w == first) unreachable &= ~uint64_t{0} << (min & 63);
+                if (w == last) unreachable &= ~uint64_t{0} >> (63 - (max & 63));
+
+                if (unreachable) add_word(unreachable, w, base);
+                ++w;
+            }
+        }
+
+        void append(const ResidueStats& next) {
+            for (std::size_t c = 0; c < classes.size(); ++c) classes[c].append(next.classes[c]);
+        }
+    public:
+        explicit ResidueStats(std::vector<int> moduli) : _moduli(std::move(moduli)) {
+            for (int m : _moduli) {
+                if (m < 1 || m > MAX_MODULUS) {
+                    throw std::runtime_error("Invalid modulus " + std::to_string(m) + "; must be in range [1.."
+                            + std::to_string(MAX_MODULUS) + "]");
+                }
+
+                offsets.push_back(classes.size());
+                classes.resize(classes.size() + m);
+
+                for (int bit = 0; bit < 64; ++bit) bit_residues.push_back(bit % m);
+            }
+        }
+
+        /**
+         * Compute the stats of the unset bits of words in [min, max], splitting the range across threads
+         */
+        static ResidueStats compute(const uint64_t* words, int64_t min, int64_t max, std::vector<int> moduli,
+                int thread_count = 1) {
+            ResidueStats result{std::move(moduli)};
+            if (max < min) return result;
+
+            constexpr int64_t chunk_bits = CHUNK_WORDS * 64;
+            int64_t chunks = (max - min) / chunk_bits + 1;
+
+            if (thread_count <= 1 || chunks < 4) {
+                result.scan(words, min, max);
+                return result;
+            }
+
+            // Partial results are merged in order, since first/last/gap depend on it. Chunks are handed out in
+            // batches so that only a few partial results exist at a time.
+            int64_t batch = 4 * thread_count;
+            std::vector<ResidueStats> partial(std::min(batch, chunks), ResidueStats{result._moduli});
+
+            for (int64_t first = 0; first < chunks; first += batch) {
+                int64_t last = std::min(first + batch, chunks);
+                std::atomic<int64_t> next{first};
+
+                ThreadPool::shared().run(thread_count, [&] (int) {
+                    int64_t c;
+                    while ((c = next.fetch_add(1, std::memory_order_relaxed)) < last) {
+                        int64_t lo = min + c * chunk_bits;
+
+                        auto& p = partial[c - first];
+                        std::fill(p.classes.begin(), p.classes.end(), ResidueClassStats{});
+                        p.scan(words, lo, std::min(max, lo + chunk_bits - 1));
+                    }
+                });
+
+                for (int64_t c = first; c < last; ++c) result.append(partial[c - first]);
+            }
+
+            return result;
+        }
+
+        const std::vector<int>& moduli() const {
+            return _moduli;
+        }
+
+        /**
+         * Stats of the class r mod m; m must be one of the moduli
+         */
+        const ResidueClassStats& get(int m, int r) const {
+            auto it = std::find(_moduli.begin(), _moduli.end(), m);
+            if (it == _moduli.end() || r < 0 || r >= m) {
+                throw std::runtime_error("No residue class " + std::to_string(r) + " mod " + std::to_string(m));
+            }
+
+            return classes[offsets[it - _moduli.begin()] + r];
+        }
+    };
+}
@@ -0,0 +1,196 @@
+/**
+ * Persistent thread pool and a barrier-free block scheduler for computations where each block only depends on a
+ * prefix of the blocks before it.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <immintrin.h>
+
+namespace Affine {
+    /**
+     * Pool of worker threads that live for the whole process, so that repeated calls to compute_till don't pay for
+     * thread creation.
+     */
+    class ThreadPool {
+        struct Job {
+            std::function<void(int)> f;
+            int count;
+
+            std::atomic<int> next{0};
+            std::atomic<int> finished{0};
+
+            std::mutex mutex;
+            std::condition_variable done;
+
+            // Claim and run indices until none are left
+            void work() {
+                int i;
+                while ((i = next.fetch_add(1)) < count) {
+                    f(i);
+
+                    if (finished.fetch_add(1) + 1 == count) {
+                        std::lock_guard lock{mutex};
+                        done.notify_all();
+                    }
+                }
+            }
+        };
+
+        std::vector<std::thread> workers;
+        std::deque<std::shared_ptr<Job>> queue;
+
+        std::mutex mutex;
+        std::condition_variable available;
+        bool stopping = false;
+
+        void worker_loop() {
+            while (true) {
+                std::shared_ptr<Job> job;
+
+                {
+                    std::unique_lock lock{mutex};
+                    available.wait(lock, [&] { return stopping || !queue.empty(); });
+
+                    if (stopping) return;
+
+                    job = queue.front();
+                    queue.pop_front();
+                }
+
+                job->work();
+            }
+        }
+    public:
+        explicit ThreadPool(int worker_count) {
+            for (int i = 0; i < worker_count; ++i) {
+                workers.emplace_back([this] { worker_loop(); });
+            }
+        }
+
+        ~ThreadPool() {
+            {
+                std::lock_guard lock{mutex};
+                stopping = true;
+            }
+
+            available.notify_all();
+            for (auto& w : workers) w.join();
+        }
+
+        /**
+         * Number of threads that can run a job concurrently, including the calling thread
+         */
+        int concurrency() const {
+            return static_cast<int>(workers.size()) + 1;
+        }
+
+        /**
+         * Run f(i) for every i in [0, count) and return once all calls have finished. The calling thread takes part,
+         * so this makes progress (and cannot deadlock) even when every worker is busy.
+         */
+        void run(int count, std::function<void(int)> f) {
+            auto job = std::make_shared<Job>();
+            job->f = std::move(f);
+            job->count = count;
+
+            {
+                std::lock_guard lock{mutex};
+                for (int i = 1; i < std::min(count, concurrency()); ++i) queue.push_back(job);
+            }
+
+            available.notify_all();
+            job->work();
+
+            std::unique_lock lock{job->mutex};
+            job->done.wait(lock, [&] { return job->finished.load() == count; });
+        }
+
+        /**
+         * Process-wide pool with one thread per hardware thread
+         */
+        static ThreadPool& shared() {
+            static ThreadPool pool{std::max(1, static_cast<int>(std::thread::hardware_concurrency())) - 1};
+            return pool;
+        }
+    };
+
+    /**
+     * Hands out blocks [0, block_count) to threads in increasing order. Block b may start as soon as the first
+     * dependency(b) blocks are complete; there are no other barriers. The completion watermark (the length of the
+     * finished prefix) is advanced lock-free by whichever thread completes the block at its edge.
+     */
+    class WatermarkScheduler {
+        std::unique_ptr<std::atomic<bool>[]> done;
+        int64_t block_count;
+
+        std::atomic<int64_t> next_block{0};
+        std::atomic<int64_t> watermark{0};
+
+        // Sequentially consistent so that two threads finishing adjacent blocks can't both miss each other's flag
+        void complete(int64_t b) {
+            done[b].store(true);
+
+            int64_t w = watermark.load();
+            while (w < block_count && done[w].load()) {
+                // Whoever wins the exchange moves on to the next block; losers reload and retry
+                if (watermark.compare_exchange_weak(w, w + 1)) ++w;
+            }
+        }
+
+        void wait_for(int64_t blocks) {
+            for (int spins = 0; watermark.load(std::memory_order_acquire) < blocks; ++spins) {
+                if (spins < 64) {
+                    _mm_pause();
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    public:
+        explicit WatermarkScheduler(int64_t block_count) :
+            done(std::make_unique<std::atomic<bool>[]>(block_count)), block_count(block_count) {
+
+        }
+
+        /**
+         * Number of blocks in the finished prefix
+         */
+        int64_t completed() const {
+            return watermark.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Process all blocks with up to thread_count threads of the pool. work is called as work(b), or as
+         * work(b, slot) where slot in [0, thread_count) is distinct for threads running concurrently.
+         */
+        template <typename Dependency, typename Work>
+            void run(ThreadPool& pool, int thread_count, Dependency dependency, Work work) {
+                pool.run(thread_count, [&] (int slot) {
+                    int64_t b;
+                    while ((b = next_block.fetch_add(1, std::memory_order_relaxed)) < block_count) {
+                        wait_for(dependency(b));
+
+                        if constexpr (std::is_invocable_v<Work, int64_t, int>) {
+                            work(b, slot);
+                        } else {
+                            work(b);
+                        }
+
+                        complete(b);
+                    }
+                });
+            }
+    };
+}
@@ -0,0 +1,533 @@
+/**
+ * Engine propagating a byte per integer over a semiring instead of a reachability bit, e.g. the minimum number of
+ * map applications needed to reach each value or the number of its derivations.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <immintrin.h>
+
+#include "bitmap_storage.h"
+#include "iterate_map.h"
+#include "map_def.h"
+#include "progress.h"
+#include "scheduler.h"
+#include "word_kernel.h"
+
+namespace Affine {
+    /**
+     * Semirings over bytes. The value of n is the sum (plus) over the maps ax+b with n = ax+b of extend(value of x),
+     * plus one if n is an initial value; zero is the value of integers that aren't reached at all. Each semiring
+     * has scalar operations and the same operations on 16 (extend) or 32 bytes (plus) at a time.
+     */
+    namespace Semiring {
+        // Reachability, as in the bitmap engines but a byte per value
+        struct Boolean {
+            static constexpr uint8_t zero = 0;
+            static constexpr uint8_t one = 1;
+
+            static uint8_t plus(uint8_t x, uint8_t y) { return x | y; }
+            static uint8_t extend(uint8_t x) { return x; }
+            static __m128i extend(__m128i x) { return x; }
+#ifdef __AVX2__
+            static __m256i plus(__m256i x, __m256i y) { return _mm256_or_si256(x, y); }
+#endif
+        };
+
+        // Minimum number of map applications from an initial value, or 255 if unreachable. A shortest derivation
+        // never repeats a value and each map at least doubles all but a few small values, so depths stay far below
+        // 255 (extend saturates there regardless).
+        struct MinDepth {
+            static constexpr uint8_t zero = 255;
+            static constexpr uint8_t one = 0;
+
+            static uint8_t plus(uint8_t x, uint8_t y) { return std::min(x, y); }
+            static uint8_t extend(uint8_t x) { return x + (x != 255); }
+            static __m128i extend(__m128i x) { return _mm_adds_epu8(x, _mm_set1_epi8(1)); }
+#ifdef __AVX2__
+            static __m256i plus(__m256i x, __m256i y) { return _mm256_min_epu8(x, y); }
+#endif
+        };
+
+        // Number of distinct derivations from the initial values, saturating at 255
+        struct SaturatingCount {
+            static constexpr uint8_t zero = 0;
+            static constexpr uint8_t one = 1;
+
+            static uint8_t plus(uint8_t x, uint8_t y) { return (x + y > 255) ? 255 : x + y; }
+            static uint8_t extend(uint8_t x) { return x; }
+            static __m128i extend(__m128i x) { return x; }
+#ifdef __AVX2__
+            static __m256i plus(__m256i x, __m256i y) { return _mm256_adds_epu8(x, y); }
+#endif
+        };
+
+        // Number of distinct derivations mod 256. Undefined (compute_till throws) if a value has infinitely many.
+        struct WrappingCount {
+            static constexpr uint8_t zero = 0;
+            static constexpr uint8_t one = 1;
+
+            static uint8_t plus(uint8_t x, uint8_t y) { return x + y; }
+            static uint8_t extend(uint8_t x) { return x; }
+            static __m128i extend(__m128i x) { return x; }
+#ifdef __AVX2__
+            static __m256i plus(__m256i x, __m256i y) { return _mm256_add_epi8(x, y); }
+#endif
+        };
+    }
+
+    template <typename S>
+        concept ByteSemiring = requires (uint8_t x) {
+            { S::zero } -> std::convertible_to<uint8_t>;
+            { S::one } -> std::convertible_to<uint8_t>;
+            { S::plus(x, x) } -> std::same_as<uint8_t>;
+            { S::extend(x) } -> std::same_as<uint8_t>;
+        };
+
+    namespace Kernel {
+        /**
+         * Byte analogue of WordKernel. For a map ax+b, let E_a be the stream where byte a*k is extend(value of k)
+         * and every other byte is zero; the contribution of the map to value n is then byte n - b of E_a. Each tile
+         * fills E_a once per distinct a over its source window, and then sums the streams at constant byte offsets,
+         * 32 bytes at a time, so nothing is divided per value.
+         */
+        template <AffineMapSet Maps, ByteSemiring S>
+            struct ByteKernel {
+                using Words = WordKernel<Maps>;
+
+                static constexpr auto coeffs = Maps.get_coeffs();
+                static constexpr std::size_t map_count = coeffs.size();
+                static constexpr auto distinct = Words::distinct;
+
+                // Maximum number of values computed per tile
+                static constexpr int64_t TILE_ENTRIES = 8192;
+
+                // Range of constant terms of the maps sharing the d-th distinct coefficient
+                static constexpr int64_t min_b(std::size_t d) {
+                    int64_t m = INT64_MAX;
+                    for (std::size_t i = 0; i < map_count; ++i)
+                        if (Words::buffer_index(i) == d) m = std::min<int64_t>(m, coeffs[i].second);
+                    return m;
+                }
+
+                static constexpr int64_t max_b(std::size_t d) {
+                    int64_t m = INT64_MIN;
+                    for (std::size_t i = 0; i < map_count; ++i)
+                        if (Words::buffer_index(i) == d) m = std::max<int64_t>(m, coeffs[i].second);
+                    return m;
+                }
+
+                static constexpr int64_t BUFFER_ENTRIES = [] {
+                    int64_t spread = 0;
+                    for (std::size_t d = 0; d < distinct.size(); ++d) spread = std::max(spread, max_b(d) - min_b(d));
+                    return TILE_ENTRIES + spread + 1;
+                }();
+
+                /**
+                 * Last source value read when computing the values [n0, n1)
+                 */
+                static constexpr int64_t last_source(int64_t n1) {
+                    int64_t s = -1;
+                    for (auto [a, b] : coeffs) s = std::max(s, Words::floor_div(n1 - 1 - b, a));
+                    return s;
+                }
+
+                /**
+                 * Largest n1 such that the tile [n0, n1) only reads values below n0, capped at the next multiple of
+                 * the tile size
+                 */
+                static constexpr int64_t max_tile_end(int64_t n0) {
+                    int64_t lo = n0, hi = (n0 / TILE_ENTRIES + 1) * TILE_ENTRIES;
+
+                    while (lo < hi) {
+                        int64_t mid = (lo + hi + 1) / 2;
+                        if (last_source(mid) < n0) lo = mid; else hi = mid - 1;
+                    }
+
+                    return lo;
+                }
+
+                /**
+                 * First value from which tiles can be computed; the values before it may depend on each other and
+                 * are computed by a fixpoint
+                 */
+                static constexpr int64_t first_entry = [] {
+                    int64_t n = 1;
+                    while (max_tile_end(n) <= n) ++n;
+                    return n;
+                }();
+
+                /**
+                 * Shuffle spreading 16 source bytes over the 16a bytes of E_a they produce: byte p of the f-th output
+                 * vector is source byte (16f + p) / a if a divides 16f + p, and zero otherwise. PSHUFB zeroes the
+                 * bytes with the high bit set, so fill holds S::zero for exactly those.
+                 */
+                template <int a>
+                    struct Spread {
+                        struct Vector {
+                            alignas(16) uint8_t shuffle[16];
+                            alignas(16) uint8_t fill[16];
+                        };
+
+                        static constexpr std::array<Vector, a> vectors = [] {
+                            std::array<Vector, a> t{};
+
+                            for (int f = 0; f < a; ++f) {
+                                for (int p = 0; p < 16; ++p) {
+                                    bool source = (16 * f + p) % a == 0;
+                                    t[f].shuffle[p] = source ? (16 * f + p) / a : 0x80;
+                                    t[f].fill[p] = source ? 0 : S::zero;
+                                }
+                            }
+
+                            return t;
+                        }();
+                    };
+
+                static inline __m128i load(const uint8_t* p) {
+                    return _mm_load_si128(reinterpret_cast<const __m128i*>(p));
+                }
+
+                // Write E_a[k] for k in [k0, k1) to buf[0..k1-k0)
+                template <int a>
+                    static void fill(const uint8_t* src, uint8_t* buf, int64_t k0, int64_t k1) {
+                        int64_t k = k0;
+
+                        for (; k < k1 && (k < 0 || k % a != 0); ++k) {
+                            buf[k - k0] = (k >= 0 && k % a == 0) ? S::extend(src[k / a]) : S::zero;
+                        }
+
+#ifdef __SSSE3__
+                        for (; k + 16 * a <= k1; k += 16 * a) {
+                            __m128i s = S::extend(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + k / a)));
+
+                            [&]<std::size_t... F>(std::index_sequence<F...>) {
+                                (_mm_storeu_si128(reinterpret_cast<__m128i*>(buf + (k - k0) + 16 * F),
+                                    _mm_or_si128(_mm_shuffle_epi8(s, load(Spread<a>::vectors[F].shuffle)),
+                                                 load(Spread<a>::vectors[F].fill))), ...);
+                            }(std::make_index_sequence<a>{});
+                        }
+#endif
+
+                        for (; k + a <= k1; k += a) {
+                            uint8_t* out = buf + (k - k0);
+                            out[0] = S::extend(src[k / a]);
+
+                            [&]<std::size_t... F>(std::index_sequence<F...>) {
+                                ((out[F + 1] = S::zero), ...);
+                            }(std::make_index_sequence<a - 1>{});
+                        }
+
+                        for (; k < k1; ++k) buf[k - k0] = (k % a == 0) ? S::extend(src[k / a]) : S::zero;
+                    }
+
+                /**
+                 * Write the values [n0, n1) of the array in values, not counting initial values. Requires
+                 * n0 >= first_entry and n1 <= max_tile_end(n0).
+                 */
+                static void compute_tile(uint8_t* values, int64_t n0, int64_t n1) {
+                    uint8_t buffers[distinct.size()][BUFFER_ENTRIES];
+
+                    [&]<std::size_t... D>(std::index_sequence<D...>) {
+                        (fill<distinct[D]>(values, buffers[D], n0 - max_b(D), n1 - min_b(D)), ...);
+                    }(std::make_index_sequence<distinct.size()>{});
+
+                    [&]<std::size_t... I>(std::index_sequence<I...>) {
+                        // Byte n0 + j of map I's stream
+                        const uint8_t* src[map_count] = {
+                            (buffers[Words::buffer_index(I)] + max_b(Words::buffer_index(I)) - coeffs[I].second)...
+                        };
+
+                        uint8_t* out = values + n0;
+                        int64_t j = 0;
+#ifdef __AVX2__
+                        for (; j + 32 <= n1 - n0; j += 32) {
+                            __m256i acc = _mm256_set1_epi8(static_cast<char>(S::zero));
+                            ((acc = S::plus(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src[I] + j)))), ...);
+                            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j), acc);
+                        }
+#endif
+                        for (; j < n1 - n0; ++j) {
+                            uint8_t acc = S::zero;
+                            ((acc = S::plus(acc, src[I][j])), ...);
+                            out[j] = acc;
+                        }
+                    }(std::make_index_sequence<map_count>{});
+                }
+            };
+    }
+
+    /**
+     * A byte per integer, computed over the semiring S (see Semiring). With MinDepth this gives the distribution of
+     * derivation depths, and with SaturatingCount or WrappingCount the number of derivations; Boolean matches the
+     * bitmap engines at eight times the memory.
+     */
+    template <AffineMapSet Maps, ByteSemiring S, int64_t max_entry=_DEFAULT_MAX_ENTRY>
+        class SemiringIterateMap {
+            using KernelType = Kernel::ByteKernel<Maps, S>;
+
+            // Values per block handed out by the scheduler when computing with threads
+            static constexpr int64_t parallel_block_entries = 4 * KernelType::TILE_ENTRIES;
+
+            // First block boundary from which every block only reads values before its own start
+            static constexpr int64_t parallel_start = [] {
+                int64_t n = parallel_block_entries;
+                while (KernelType::last_source(n + parallel_block_entries) >= n) n += parallel_block_entries;
+                return n;
+            }();
+
+            // Below this many remaining values, threads aren't worth waking up
+            static constexpr int64_t parallel_threshold_entries = 16 * parallel_block_entries;
+
+            // Fixpoint passes over the first values before giving up on convergence
+            static constexpr int MAX_PREFIX_PASSES = 1024;
+
+            std::vector<int64_t> initial_values;
+            int64_t _max_reached = -1;
+
+            BitmapStorage storage;
+
+            // Meter of the running computation, if progress is being reported
+            ProgressMeter* _progress = nullptr;
+
+            uint8_t* values() {
+                return reinterpret_cast<uint8_t*>(storage.data());
+            }
+
+            // Value of n given the current values, by pulling from the source of every map
+            uint8_t pull(int64_t n) {
+                uint8_t v = S::zero;
+
+                for (auto [a, b] : Maps.get_coeffs()) {
+                    int64_t k = n - b;
+                    if (k >= 0 && k % a == 0) v = S::plus(v, S::extend(values()[k / a]));
+                }
+
+                if (std::find(initial_values.begin(), initial_values.end(), n) != initial_values.end()) {
+                    v = S::plus(v, S::one);
+                }
+
+                return v;
+            }
+
+            // Compute the values before KernelType::first_entry, repeating until nothing changes since small values
+            // can depend on larger ones (e.g. 2x-2 maps 1 to 0), or on themselves (3x maps 0 to 0)
+            void compute_prefix() {
+                const int64_t end = KernelType::first_entry;
+                std::fill(values(), values() + end, S::zero);
+
+                for (int pass = 0; pass < MAX_PREFIX_PASSES; ++pass) {
+                    bool changed = false;
+
+                    for (int64_t n = 0; n < end; ++n) {
+                        uint8_t v = pull(n);
+                        changed |= v != values()[n];
+                        values()[n] = v;
+                    }
+
+                    if (!changed) return;
+                }
+
+                throw std::runtime_error("Values have infinitely many derivations; use a saturating semiring");
+            }
+
+            // Compute the values [n, end) tile by tile, given that all values before n are final
+            void compute_entries(int64_t n, int64_t end, int slot = 0) {
+                while (n < end) {
+                    int64_t tile_end = std::min(end, KernelType::max_tile_end(n));
+                    KernelType::compute_tile(values(), n, tile_end);
+
+                    for (int64_t i : initial_values) {
+                        if (i >= n && i < tile_end) values()[i] = S::plus(values()[i], S::one);
+                    }
+
+                    if (_progress) _progress->add(slot, tile_end - n);
+                    n = tile_end;
+                }
+            }
+
+            // Same as compute_entries, with blocks handed out to the thread pool as soon as their sources are final
+            void compute_entries_parallel(int64_t n, int64_t end, int thread_count) {
+                constexpr int64_t B = parallel_block_entries;
+                int64_t start = std::max(parallel_start, (n + B - 1) / B * B);
+
+                if (start >= end) {
+                    compute_entries(n, end);
+                    return;
+                }
+
+                compute_entries(n, start);
+
+                auto block_end = [&] (int64_t b) {
+                    return std::min(start + (b + 1) * B, end);
+                };
+
+                WatermarkScheduler scheduler{(end - start + B - 1) / B};
+                scheduler.run(ThreadPool::shared(), thread_count, [&] (int64_t b) -> int64_t {
+                    int64_t last = KernelType::last_source(block_end(b));
+                    return (last < start) ? 0 : (last - start) / B + 1;
+                }, [&] (int64_t b, int slot) {
+                    compute_entries(start + b * B, block_end(b), slot);
+                });
+            }
+        public:
+            // Only reserves address space; memory is committed as compute_till advances
+            SemiringIterateMap() : storage((std::max(max_entry, KernelType::first_entry) + 7) / 8) {
+
+            }
+
+            /**
+             * Set the initial values, which get the value S::one (e.g. { 1 })
+             */
+            void set_initial(std::initializer_list<int64_t> initial) {
+                if (_max_reached >= 0) {
+                    throw std::runtime_error("Initial values must be set before computing (call clear_data first)");
+                }
+
+                initial_values.clear();
+                for (int64_t i : initial) {
+                    if (i < 0 || i >= max_entry) {
+                        throw std::runtime_error{"Invalid initial value " + std::to_string(i)};
+                    }
+
+                    initial_values.push_back(i);
+                }
+            }
+
+            int64_t max_reached() const {
+                return _max_reached;
+            }
+
+            void compute_till(const IterateMapOpts& opts) {
+                int64_t max = (opts.max < 0) ? max_entry - 1 : opts.max;
+
+                if (max <= _max_reached) {
+                    return;
+                }
+
+                if (max >= max_entry) {
+                    throw std::runtime_error("Max entry exceeded (max=" + std::to_string(max) +")");
+                }
+
+                int64_t end = std::max(max + 1, KernelType::first_entry);
+                storage.ensure((end + 7) / 8);
+
+                if (_max_reached == -1) {
+                    compute_prefix();
+                }
+
+                int64_t n = std::max(KernelType::first_entry, _max_reached + 1);
+
+                int thread_count = opts.use_threads ? opts.num_threads : 1;
+                ProgressScope progress{_progress, opts.progress_reporter(), (double)opts.callback_frequency,
+                        std::max<int64_t>(end - n, 0), thread_count};
+
+                if (thread_count > 1 && end - n >= parallel_threshold_entries) {
+                    compute_entries_parallel(n, end, thread_count);
+                } else {
+                    compute_entries(n, end);
+                }
+
+                _max_reached = max;
+                progress.finish();
+            }
+
+            void clear_data() {
+                storage.reset();
+                _max_reached = -1;
+            }
+
+            /**
+             * Value of n (unchecked)
+             */
+            uint8_t value(int64_t n) const {
+                return reinterpret_cast<const uint8_t*>(storage.data())[n];
+            }
+
+            /**
+             * The values [0, max_reached()], a byte each
+             */
+            const uint8_t* data() const {
+                return reinterpret_cast<const uint8_t*>(storage.data());
+            }
+
+            /**
+             * Number of integers in [min, max] with each value, e.g. the distribution of depths with MinDepth. Large
+             * ranges are split across threads if opts.use_threads is set.
+             */
+            std::array<int64_t, 256> histogram(int64_t min=0, int64_t max=-1, const ExecutionOpts& opts={}) const {
+                if (max == -1) max = _max_reached;
+                min = std::max(min, int64_t{0});
+
+                if (max < min || max > _max_reached) {
+                    throw std::runtime_error("Invalid bounds min=" + std::to_string(min)
+                            + ", max=" + std::to_string(max));
+                }
+
+                constexpr int64_t CHUNK = int64_t{1} << 24;
+                int64_t chunks = (max - min) / CHUNK + 1;
+                int thread_count = opts.use_threads ? std::max(1, std::min<int>(opts.num_threads, chunks)) : 1;
+
+                std::vector<std::array<int64_t, 256>> partial(thread_count);
+                std::atomic<int64_t> next{0};
+
+                auto work = [&] (int slot) {
+                    // Four interleaved tables, so that runs of equal values don't serialize on one counter
+                    std::array<std::array<int64_t, 256>, 4> h{};
+                    const uint8_t* v = data();
+
+                    int64_t c;
+                    while ((c = next.fetch_add(1, std::memory_order_relaxed)) < chunks) {
+                        int64_t lo = min + c * CHUNK, hi = std::min(max + 1, lo + CHUNK);
+                        int64_t i = lo;
+
+                        for (; i + 4 <= hi; i += 4) {
+                            ++h[0][v[i]];
+                            ++h[1][v[i + 1]];
+                            ++h[2][v[i + 2]];
+                            ++h[3][v[i + 3]];
+                        }
+
+                        for (; i < hi; ++i) ++h[0][v[i]];
+                    }
+
+                    for (int x = 0; x < 256; ++x) partial[slot][x] = h[0][x] + h[1][x] + h[2][x] + h[3][x];
+                };
+
+                if (thread_count > 1) {
+                    ThreadPool::shared().run(thread_count, work);
+                } else {
+                    work(0);
+                }
+
+                std::array<int64_t, 256> result{};
+                for (auto& p : partial) {
+                    for (int x = 0; x < 256; ++x) result[x] += p[x];
+                }
+
+                return result;
+            }
+        };
+
+    /**
+     * Minimum derivation depth of every value (255 if unreachable)
+     */
+    template <AffineMapSet Maps, int64_t max_entry=_DEFAULT_MAX_ENTRY>
+        using DepthIterateMap = SemiringIterateMap<Maps, Semiring::MinDepth, max_entry>;
+
+    /**
+     * Number of derivations of every value, saturating at 255
+     */
+    template <AffineMapSet Maps, int64_t max_entry=_DEFAULT_MAX_ENTRY>
+        using DerivationCountMap = SemiringIterateMap<Maps, Semiring::SaturatingCount, max_entry>;
+}
@@ -0,0 +1,407 @@
+/**
+ * Engine for map sets whose reachable set has density zero, storing the reachable values themselves rather than a
+ * bitmap.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bit_scan.h"
+#include "iterate_map.h"
+#include "map_def.h"
+
+namespace Affine {
+    namespace Sparse {
+        /**
+         * Whether the sum of 1/a over the maps is less than 1. The number of reachable values up to n then grows
+         * like n^s for the s < 1 with sum a^-s = 1, so they are a vanishing fraction of a bitmap.
+         *
+         * The sum is kept exactly, as num / den in lowest terms (den is the lcm of the coefficients so far), until it
+         * reaches 1. Should den outgrow 128 bits, which takes many coprime coefficients, the floating-point sum
+         * decides instead, and one too close to 1 to tell counts as 1 (which only costs using a bitmap).
+         */
+        template <AffineMapSet Maps>
+            constexpr bool has_density_zero() {
+                auto gcd = [] (__int128 x, __int128 y) {
+                    while (y != 0) {
+                        x %= y;
+                        std::swap(x, y);
+                    }
+                    return x;
+                };
+
+                __int128 num = 0, den = 1;
+                bool exact = true;
+                long double sum = 0;
+
+                for (auto [a, b] : Maps.get_coeffs()) {
+                    sum += 1.0L / a;
+                    if (!exact) continue;
+
+                    // num / den + 1 / a = (num * m + den / g) / (den * m), with g = gcd(den, a) and m = a / g
+                    __int128 g = gcd(den, a), m = a / g, part = den / g;
+                    exact = !__builtin_mul_overflow(den, m, &den) && !__builtin_mul_overflow(num, m, &num)
+                        && !__builtin_add_overflow(num, part, &num);
+                    if (!exact) continue;
+
+                    g = gcd(num, den);
+                    num /= g;
+                    den /= g;
+
+                    if (num >= den) return false;
+                }
+
+                return exact || sum < 1 - 1e-12L;
+            }
+
+        // Every this many values, the value and the position of the next gap are kept for random access
+        constexpr int64_t SAMPLE_INTERVAL = 128;
+
+        // Values computed by a fixpoint before the merge starts. Below 3, ax+b may not exceed x (e.g. 2x-2 maps 2 to
+        // itself), but every image of a value at least 64 is at least 126.
+        constexpr int64_t PREFIX_VALUES = 64;
+
+        // Values produced between progress updates
+        constexpr int64_t REPORT_INTERVAL = 1 << 16;
+    }
+
+    // Only bounds the values that may be computed, as memory is proportional to the number of reachable values
+    constexpr int64_t _DEFAULT_SPARSE_MAX_ENTRY = int64_t{1} << 62;
+
+    /**
+     * Reachable values generated in increasing order by a k-way merge. The values found so far are a sorted,
+     * deduplicated stream, stored as LEB128 gaps (a byte per value while the gaps are below 128), and every map
+     * reads that same stream through its own cursor: the next value is the smallest of a * x + b over the maps'
+     * current sources x (and the pending initial values), and each cursor skips sources whose image was already
+     * produced. A value is produced after all of its sources since ax+b > x for x >= 3.
+     *
+     * Memory is a few bytes per reachable value, independent of max_entry, so with sum 1/a < 1 this reaches
+     * maxima far beyond what a bitmap can. Lookups and counts start from the nearest sample and decode at most
+     * Sparse::SAMPLE_INTERVAL gaps. The merge is sequential, so opts.use_threads is ignored.
+     *
+     * There is no bitmap, so the IterateMap helpers built on one (word_data(), checkpoints, the rank index,
+     * provenance, batched and extended queries, export and residue stats) throw; for_each_solution,
+     * for_each_reachable and for_each_unreachable are provided here instead.
+     */
+    template <AffineMapSet Maps, int64_t max_entry=_DEFAULT_SPARSE_MAX_ENTRY>
+        class SparseIterateMap : public IterateMap<Maps, max_entry> {
+            template<AffineMapSet, int64_t>
+                friend class IterateMap;
+
+            static constexpr auto coeffs = Maps.get_coeffs();
+            static constexpr std::size_t map_count = coeffs.size();
+
+            static constexpr int64_t NONE = std::numeric_limits<int64_t>::max();
+
+            // Reachable values in increasing order, each as the LEB128 gap from the previous one (the first from -1)
+            std::vector<uint8_t> gaps;
+            int64_t count = 0;
+            int64_t last = -1;
+
+            // Value number k * SAMPLE_INTERVAL, and the offset of the gap after it
+            std::vector<int64_t> sample_values;
+            std::vector<int64_t> sample_offsets;
+
+            // Position of a map in the stream of values: the last value read is its current source
+            struct Cursor {
+                int64_t read = 0;
+                int64_t offset = 0;
+                int64_t value = -1;
+                // Whether the image of value may still be produced
+                bool pending = false;
+            };
+
+            std::array<Cursor, map_count> cursors{};
+
+            // Initial values above the prefix, sorted, and how many of them were produced
+            std::vector<int64_t> initial_above;
+            std::size_t initial_done = 0;
+
+            int64_t read_gap(int64_t& offset) const {
+                uint64_t g = 0;
+                for (int shift = 0; ; shift += 7) {
+                    uint8_t byte = gaps[offset++];
+                    g |= uint64_t(byte & 0x7f) << shift;
+                    if (!(byte & 0x80)) return g;
+                }
+            }
+
+            void append(int64_t v) {
+                for (uint64_t g = v - last; ; g >>= 7) {
+                    if (g < 0x80) {
+                        gaps.push_back(g);
+                        break;
+                    }
+
+                    gaps.push_back((g & 0x7f) | 0x80);
+                }
+
+                if (count % Sparse::SAMPLE_INTERVAL == 0) {
+                    sample_values.push_back(v);
+                    sample_offsets.push_back(gaps.size());
+                }
+
+                last = v;
+                ++count;
+            }
+
+            // Image of the current source of map i, or NONE if it can't be produced
+            int64_t image(std::size_t i) const {
+                auto [a, b] = coeffs[i];
+                int64_t x = cursors[i].value;
+
+                return (x > (max_entry - 1 - b) / a) ? NONE : a * x + b;
+            }
+
+            // Smallest image of map i that isn't produced yet, advancing its cursor; NONE if it has caught up
+            int64_t next_image(std::size_t i) {
+                Cursor& c = cursors[i];
+
+                while (true) {
+                    if (c.pending) {
+                        int64_t v = image(i);
+                        if (v > last) return v;
+                        c.pending = false;
+                    }
+
+                    if (c.read == count) return NONE;
+
+                    c.value += read_gap(c.offset);
+                    ++c.read;
+                    c.pending = true;
+                }
+            }
+
+            // Reachable values below the prefix bound, by a fixpoint as they may depend on each other in any order
+            void compute_prefix() {
+                std::array<bool, Sparse::PREFIX_VALUES> reachable{};
+                for (int64_t i : this->_initial_values) {
+                    if (i < Sparse::PREFIX_VALUES) reachable[i] = true;
+                }
+
+                for (bool changed = true; changed; ) {
+                    changed = false;
+
+                    for (int64_t x = 0; x < Sparse::PREFIX_VALUES; ++x) {
+                        if (!reachable[x]) continue;
+
+                        for (auto [a, b] : coeffs) {
+                            int64_t y = a * x + b;
+                            if (y >= 0 && y < Sparse::PREFIX_VALUES && !reachable[y]) {
+                                reachable[y] = changed = true;
+                            }
+                        }
+                    }
+                }
+
+                for (int64_t x = 0; x < Sparse::PREFIX_VALUES; ++x) {
+                    if (reachable[x]) append(x);
+                }
+
+                for (int64_t i : this->_initial_values) {
+                    if (i >= Sparse::PREFIX_VALUES) initial_above.push_back(i);
+                }
+
+                std::sort(initial_above.begin(), initial_above.end());
+                initial_above.erase(std::unique(initial_above.begin(), initial_above.end()), initial_above.end());
+            }
+
+            // Number of reachable values below n
+            int64_t rank(int64_t n) const {
+                int64_t k = std::lower_bound(sample_values.begin(), sample_values.end(), n) - sample_values.begin() - 1;
+                if (k < 0) return 0;
+
+                int64_t r = k * Sparse::SAMPLE_INTERVAL + 1, v = sample_values[k], offset = sample_offsets[k];
+                for (; r < count; ++r) {
+                    v += read_gap(offset);
+                    if (v >= n) break;
+                }
+
+                return r;
+            }
+
+            // Call f(v) for every reachable v in [min, max], in increasing order
+            template <typename F>
+                void for_each_value(F f, int64_t min, int64_t max) const {
+                    if (sample_values.empty()) return;
+
+                    int64_t k = std::upper_bound(sample_values.begin(), sample_values.end(), min)
+                        - sample_values.begin() - 1;
+                    if (k < 0) k = 0;
+
+                    int64_t r = k * Sparse::SAMPLE_INTERVAL, v = sample_values[k], offset = sample_offsets[k];
+                    while (v <= max) {
+                        if (v >= min) f(v);
+                        if (++r == count) break;
+                        v += read_gap(offset);
+                    }
+                }
+
+            // Call f(i) for every i in [lo, hi] in the class c
+            template <typename F>
+                static void for_each_in_class(F f, int64_t lo, int64_t hi, ResidueClass c) {
+                    int64_t m = c.modulus;
+                    for (int64_t i = lo + (((c.residue - lo) % m) + m) % m; i <= hi; i += m) f(i);
+                }
+
+            static bool in_class(int64_t i, ResidueClass c) {
+                return ((i - c.residue) % c.modulus + c.modulus) % c.modulus == 0;
+            }
+
+            void bounds(int64_t& min, int64_t& max, ResidueClass c) {
+                if (max == -1) max = this->_max_reached;
+                this->range_bounds_check(min, max);
+                min = std::max(min, int64_t{0});
+
+                if (c.modulus < 1 || c.modulus > ResidueMask::MAX_MODULUS) {
+                    throw std::runtime_error("Invalid modulus " + std::to_string(c.modulus) + "; must be in range [1.."
+                            + std::to_string(ResidueMask::MAX_MODULUS) + "]");
+                }
+            }
+
+            const uint64_t* word_data() {
+                throw std::runtime_error("The sparse engine keeps no bitmap");
+            }
+
+            int64_t count_solutions_impl(int64_t min, int64_t max, const ExecutionOpts&) {
+                return rank(max + 1) - rank(min);
+            }
+        public:
+            void read_from_file(const char*) {
+                throw std::runtime_error("Checkpoints hold a bitmap, which the sparse engine doesn't keep");
+            }
+
+            void write_to_file(const char*) {
+                throw std::runtime_error("Checkpoints hold a bitmap, which the sparse engine doesn't keep");
+            }
+
+            void compute_till(const IterateMapOpts& opts) {
+                int64_t max = (opts.max < 0) ? max_entry - 1 : opts.max;
+
+                if (max <= this->_max_reached) {
+                    return;
+                }
+
+                if (max >= max_entry) {
+                    throw std::runtime_error("Max entry exceeded (max=" + std::to_string(max) +")");
+                }
+
+                if (this->_provenance.is_enabled()) {
+                    throw std::runtime_error("Provenance is not supported by the sparse engine");
+                }
+
+                if (this->_max_reached == -1) {
+                    compute_prefix();
+                }
+
+                auto progress = this->progress_scope(opts, max - this->_max_reached, 1);
+                int64_t reported = this->_max_reached;
+
+                while (true) {
+                    int64_t next = NONE;
+                    for (std::size_t i = 0; i < map_count; ++i) next = std::min(next, next_image(i));
+
+                    while (initial_done < initial_above.size() && initial_above[initial_done] <= last) ++initial_done;
+                    if (initial_done < initial_above.size()) next = std::min(next, initial_above[initial_done]);
+
+                    if (next > max) break;
+                    append(next);
+
+                    if (this->_progress && count % Sparse::REPORT_INTERVAL == 0) {
+                        this->_progress->add(0, next - reported);
+                        reported = next;
+                    }
+                }
+
+                if (this->_progress) this->_progress->add(0, max - reported);
+
+                this->_max_reached = max;
+                progress.finish();
+            }
+
+            void clear_data() {
+                gaps.clear();
+                sample_values.clear();
+                sample_offsets.clear();
+                count = 0;
+                last = -1;
+
+                cursors = {};
+                initial_above.clear();
+                initial_done = 0;
+
+                this->_max_reached = -1;
+            }
+
+            bool is_reachable(int64_t i) {
+                int64_t k = std::upper_bound(sample_values.begin(), sample_values.end(), i) - sample_values.begin() - 1;
+                if (k < 0) return false;
+
+                int64_t r = k * Sparse::SAMPLE_INTERVAL, v = sample_values[k], offset = sample_offsets[k];
+                while (v < i && ++r < count) v += read_gap(offset);
+
+                return v == i;
+            }
+
+            /**
+             * Bytes used by the stored values and samples
+             */
+            size_t memory_usage() const {
+                return gaps.size() + (sample_values.size() + sample_offsets.size()) * sizeof(int64_t);
+            }
+
+            /**
+             * Execute a function, accepting a value and a boolean representing the reachability state, for all
+             * values in [min, max]
+             */
+            template <SolutionLambda L>
+                void for_each_solution(L l, int64_t min=0, int64_t max=-1) {
+                    bounds(min, max, {});
+
+                    int64_t next = min;
+                    for_each_value([&] (int64_t v) {
+                        for (; next < v; ++next) l(next, false);
+                        l(next++, true);
+                    }, min, max);
+
+                    for (; next <= max; ++next) l(next, false);
+                }
+
+            /**
+             * Call f(i) for every reachable i in [min, max] in the class c, in increasing order
+             */
+            template <typename F>
+                void for_each_reachable(F f, int64_t min=0, int64_t max=-1, ResidueClass c={}) {
+                    bounds(min, max, c);
+
+                    for_each_value([&] (int64_t v) {
+                        if (in_class(v, c)) f(v);
+                    }, min, max);
+                }
+
+            /**
+             * Call f(i) for every unreachable i in [min, max] in the class c, in increasing order. This visits the
+             * whole range, which is almost all unreachable.
+             */
+            template <typename F>
+                void for_each_unreachable(F f, int64_t min=0, int64_t max=-1, ResidueClass c={}) {
+                    bounds(min, max, c);
+
+                    int64_t next = min;
+                    for_each_value([&] (int64_t v) {
+                        for_each_in_class(f, next, v - 1, c);
+                        next = v + 1;
+                    }, min, max);
+
+                    for_each_in_class(f, next, max, c);
+                }
+        };
+}
@@ -0,0 +1,74 @@
+/**
+ * Consumers for engines that stream part of the bitmap instead of keeping it resident.
+ *
+ * Every map has a >= 2, so the bits in (max / 2, max] are never read when computing other bits up to max. An engine
+ * can therefore keep only the bits the upper range depends on, compute the rest chunk by chunk into a fixed-size
+ * buffer, and hand each chunk to the consumers before it is overwritten.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "export.h"
+#include "popcount.h"
+
+namespace Affine {
+    /**
+     * Bits [min, max] of the bitmap, in the engines' word layout. words[0] is the word containing min, i.e. it holds
+     * the bits starting at 64 * (min >> 6). Only valid for the duration of the consumer call.
+     */
+    struct BitmapChunk {
+        const uint64_t* words;
+        int64_t min;
+        int64_t max;
+
+        bool get_bit(int64_t i) const {
+            return (words[(i >> 6) - (min >> 6)] >> (i & 63)) & 1;
+        }
+
+        int64_t count_reachable() const {
+            return count_bits(words, min & 63, max - (min & ~int64_t{63}));
+        }
+
+        int64_t count_unreachable() const {
+            return (max - min + 1) - count_reachable();
+        }
+    };
+
+    // Chunks are delivered in increasing order, covering [0, max] without gaps, always on the calling thread
+    using ChunkConsumer = std::function<void(const BitmapChunk&)>;
+
+    /**
+     * Consumer adding the number of reachable values of each chunk to count
+     */
+    inline ChunkConsumer count_consumer(int64_t& count) {
+        return [&count] (const BitmapChunk& chunk) {
+            count += chunk.count_reachable();
+        };
+    }
+
+    /**
+     * Consumer appending the unreachable values in [writer.min, writer.max] to an export. The caller still has to
+     * call writer.finish() once streaming is done.
+     */
+    inline ChunkConsumer export_consumer(UnreachableWriter& writer) {
+        return [&writer] (const BitmapChunk& chunk) {
+            writer.append(chunk.words, chunk.min >> 6, chunk.max);
+        };
+    }
+
+    /**
+     * Consumer calling f(i, reachable) for every value, like IterateMap::for_each_solution
+     */
+    template <typename F>
+        ChunkConsumer value_consumer(F f) {
+            return [f] (const BitmapChunk& chunk) mutable {
+                for (int64_t i = chunk.min; i <= chunk.max; ++i) {
+                    f(i, chunk.get_bit(i));
+                }
+            };
+        }
+}
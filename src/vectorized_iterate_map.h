@@ -0,0 +1,274 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "bitmap_storage.h"
+#include "checkpoint.h"
+#include "iterate_map.h"
+#include "provenance.h"
+#include "scheduler.h"
+#include "sparse_iterate_map.h"
+#include "streaming.h"
+#include "word_driver.h"
+#include "word_kernel.h"
+
+namespace Affine {
+    /**
+     * Iterate map computed a word at a time, using the PDEP/CLMUL spreads from misc/m.cc generalized to arbitrary
+     * constants. Each step computes a tile of up to Kernel::TILE_WORDS words from the (already final) words below it.
+     */
+    template<AffineMapSet Maps, int64_t max_entry=_DEFAULT_MAX_ENTRY>
+        class VectorizedIterateMap : public IterateMap<Maps, max_entry> {
+            template<AffineMapSet, int64_t>
+                friend class IterateMap;
+
+            static_assert(Kernel::has_word_kernel<Maps>(), "No word kernel available for this map set");
+
+        protected:
+            using KernelType = Kernel::WordKernel<Maps>;
+
+            // Also covers the words computed bit by bit, which may extend past max_entry
+            static constexpr int64_t capacity_words = std::max((max_entry + 63) / 64, KernelType::first_word) + 1;
+
+            // Words per buffer when streaming the part of the bitmap that isn't kept resident
+            static constexpr int64_t stream_chunk_words = 64 * KernelType::tile_words;
+
+            // The word kernel as WordDriver sees it, filling in provenance when it is enabled
+            struct Tiles {
+                ProvenanceIndex<Maps>& provenance;
+
+                static constexpr int64_t first_word() { return KernelType::first_word; }
+                static constexpr int64_t tile_words() { return KernelType::tile_words; }
+                static constexpr int64_t last_source_word(int64_t w1) { return KernelType::last_source_word(w1); }
+                static constexpr int64_t max_tile_end(int64_t w0) { return KernelType::max_tile_end(w0); }
+
+                void compute_tile(uint64_t* words, int64_t w0, int64_t w1, int) {
+                    if (provenance.is_enabled()) {
+                        KernelType::compute_tile(words, words + w0, w0, w1, provenance.planes_at(w0));
+                    } else {
+                        KernelType::compute_tile(words, words + w0, w0, w1);
+                    }
+                }
+            };
+
+            BitmapStorage words;
+            Tiles tiles{this->_provenance};
+            WordDriver<Tiles> driver{tiles, words, decltype(Maps)::coeffs};
+
+            bool get_bit(int64_t i) const {
+                return (words.data()[i >> 6] >> (i & 63)) & 1;
+            }
+
+            // Number of words that must be resident to compute the words [0, end); the words after it only read them
+            static constexpr int64_t resident_words(int64_t end) {
+                return std::max(KernelType::last_source_word(end) + 1, KernelType::first_word);
+            }
+
+            // Compute the words [w0, w1) into buffer, which holds word w0 at index 0. All words read must be final.
+            void compute_stream_chunk(uint64_t* buffer, int64_t w0, int64_t w1) const {
+                std::fill(buffer, buffer + (w1 - w0), 0);
+
+                for (int64_t i : this->_initial_values) {
+                    if ((i >> 6) >= w0 && (i >> 6) < w1) {
+                        buffer[(i >> 6) - w0] |= uint64_t{1} << (i & 63);
+                    }
+                }
+
+                for (int64_t w = w0; w < w1; ) {
+                    int64_t tile_end = std::min(w1, (w / KernelType::tile_words + 1) * KernelType::tile_words);
+
+                    KernelType::compute_tile(words.data(), buffer + (w - w0), w, tile_end);
+                    w = tile_end;
+                }
+            }
+
+            const uint64_t* word_data() {
+                return words.data();
+            }
+
+            int64_t count_solutions_impl(int64_t min, int64_t max, const ExecutionOpts& opts) {
+                return count_bits_parallel(words.data(), min, max, opts.use_threads ? opts.num_threads : 1);
+            }
+        public:
+            // Only reserves address space; memory is committed as compute_till advances
+            VectorizedIterateMap() : words(capacity_words) {
+
+            }
+
+            /**
+             * Map a checkpoint written by write_to_file. The bitmap isn't copied: pages are read from the page cache
+             * on first access, so the table is queryable immediately, and compute_till resumes from its end.
+             */
+            void read_from_file(const char* filename) {
+                Checkpoint::File file{filename, O_RDONLY};
+                auto contents = Checkpoint::read_metadata(file);
+
+                Checkpoint::check_maps<Maps>(contents);
+                this->check_provenance_on_load();
+
+                if (contents.header.max_reached >= max_entry
+                        || (int64_t)contents.header.bitmap_bytes > words.capacity_words() * 8) {
+                    throw std::runtime_error("Checkpoint exceeds max entry (max_reached="
+                            + std::to_string(contents.header.max_reached) + ")");
+                }
+
+                this->assign_initial(contents.initial_values);
+                this->_max_reached = contents.header.max_reached;
+                driver.load(file, contents);
+
+                this->_finalized.store(this->whole_words_end(this->_max_reached), std::memory_order_release);
+                this->_rank_index.clear();
+                this->update_rank_index({});
+            }
+
+            void compute_till(const IterateMapOpts& opts) {
+                auto max = (opts.max < 0) ? max_entry - 1 : opts.max;
+                auto max_reached = this->_max_reached;
+
+                if (max <= max_reached) {
+                    return;
+                }
+
+                if (max >= max_entry) {
+                    throw std::runtime_error("Max entry exceeded (max=" + std::to_string(max) +")");
+                }
+
+                int64_t end = (max >> 6) + 1;
+                this->_provenance.ensure(std::max(end, KernelType::first_word));
+
+                // Partially computed words are simply recomputed, which is why publish() holds them back
+                const bool provenance = this->_provenance.is_enabled();
+                int64_t w = driver.begin(max_reached, end, this->_initial_values, [&] (int64_t i, int m) {
+                    if (provenance) this->_provenance.record(i, m);
+                });
+                this->publish(std::min(max, w * 64 - 1));
+
+                int thread_count = opts.use_threads ? opts.num_threads : 1;
+                auto progress = this->progress_scope(opts, (end - w) * 64, thread_count);
+
+                driver.compute(w, end, thread_count, this->_progress, [&] (int64_t word_end) {
+                    this->publish(std::min(max, word_end * 64 - 1));
+                });
+
+                this->publish(max);
+                this->_max_reached = max;
+                this->update_rank_index(opts);
+                progress.finish();
+            }
+
+            /**
+             * Compute [0, max] like compute_till, but only keep the words that the rest depends on resident (about
+             * [0, max / 2] when the smallest coefficient is 2). The words above them are computed into fixed-size
+             * buffers, handed to the consumers and discarded, so count-only and export-only runs need half the
+             * memory. The consumers see the whole range [0, max] in increasing order, the resident part first;
+             * only the resident part counts as computed for max_reached().
+             */
+            void stream_till(const IterateMapOpts& opts, const std::vector<ChunkConsumer>& consumers) {
+                int64_t max = (opts.max < 0) ? max_entry - 1 : opts.max;
+
+                if (max >= max_entry) {
+                    throw std::runtime_error("Max entry exceeded (max=" + std::to_string(max) +")");
+                }
+
+                int64_t end = (max >> 6) + 1;
+                int64_t resident = std::min(end, resident_words(end));
+
+                // One report covers both the resident part and the streamed chunks
+                int thread_count = opts.use_threads ? opts.num_threads : 1;
+                int64_t computed_from = std::min(resident, std::max(KernelType::first_word, (this->_max_reached + 1) >> 6));
+                auto progress = this->progress_scope(opts, (end - computed_from) * 64, thread_count);
+
+                IterateMapOpts resident_opts = opts;
+                resident_opts.max = std::min(max, resident * 64 - 1);
+                compute_till(resident_opts);
+
+                auto deliver = [&] (const BitmapChunk& chunk) {
+                    for (auto& consumer : consumers) consumer(chunk);
+                };
+
+                deliver({ words.data(), 0, resident_opts.max });
+
+                // Chunks are computed in parallel batches, but delivered in order on this thread
+                int64_t chunk_count = (end - resident + stream_chunk_words - 1) / stream_chunk_words;
+                int64_t batch = std::max(1, thread_count);
+
+                std::vector<std::vector<uint64_t>> buffers(std::min(batch, chunk_count),
+                        std::vector<uint64_t>(stream_chunk_words));
+
+                auto chunk_start = [&] (int64_t c) { return resident + c * stream_chunk_words; };
+                auto chunk_end = [&] (int64_t c) { return std::min(end, chunk_start(c + 1)); };
+
+                for (int64_t first = 0; first < chunk_count; first += batch) {
+                    int64_t last = std::min(first + batch, chunk_count);
+                    std::atomic<int64_t> next{first};
+
+                    auto work = [&] (int slot) {
+                        int64_t c;
+                        while ((c = next.fetch_add(1, std::memory_order_relaxed)) < last) {
+                            compute_stream_chunk(buffers[c - first].data(), chunk_start(c), chunk_end(c));
+                            if (this->_progress) this->_progress->add(slot, (chunk_end(c) - chunk_start(c)) * 64);
+                        }
+                    };
+
+                    if (thread_count > 1 && last - first > 1) {
+                        ThreadPool::shared().run(thread_count, work);
+                    } else {
+                        work(0);
+                    }
+
+                    for (int64_t c = first; c < last; ++c) {
+                        deliver({ buffers[c - first].data(), chunk_start(c) * 64, std::min(max, chunk_end(c) * 64 - 1) });
+                    }
+                }
+
+                progress.finish();
+            }
+
+            void clear_data() {
+                words.reset();
+                this->_max_reached = -1;
+                this->_finalized.store(-1, std::memory_order_release);
+                this->_rank_index.clear();
+                this->_provenance.clear();
+                this->_descent.clear();
+            }
+
+            bool is_reachable(int64_t i) {
+                return get_bit(i);
+            }
+
+            void write_to_file(const char* filename) {
+                Checkpoint::write(filename, Maps.get_coeffs(), this->_initial_values, this->_max_reached, words.data());
+            }
+        };
+
+    namespace {
+        template <AffineMapSet Maps, int64_t max_entry, bool vectorized = Kernel::has_word_kernel<Maps>(),
+                bool sparse = Sparse::has_density_zero<Maps>()>
+            struct AutoIterateMapSelector {
+                using type = StandardIterateMap<Maps, max_entry>;
+            };
+
+        template <AffineMapSet Maps, int64_t max_entry>
+            struct AutoIterateMapSelector<Maps, max_entry, true, false> {
+                using type = VectorizedIterateMap<Maps, max_entry>;
+            };
+
+        // The default bound only limits the address space reserved for a bitmap, which the sparse engine doesn't
+        // have, so it gets its own
+        template <AffineMapSet Maps, int64_t max_entry, bool vectorized>
+            struct AutoIterateMapSelector<Maps, max_entry, vectorized, true> {
+                using type = SparseIterateMap<Maps, (max_entry == _DEFAULT_MAX_ENTRY) ? _DEFAULT_SPARSE_MAX_ENTRY
+                    : max_entry>;
+            };
+    }
+
+    /**
+     * Fastest engine available for the given maps, chosen at compile time: the sparse engine when the sum of 1/a
+     * is less than 1, otherwise a bitmap engine
+     */
+    template <AffineMapSet Maps, int64_t max_entry=_DEFAULT_MAX_ENTRY>
+        using AutoIterateMap = typename AutoIterateMapSelector<Maps, max_entry>::type;
+}
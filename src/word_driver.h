@@ -0,0 +1,200 @@
+/**
+ * Driver shared by the engines that compute their bitmap in memory with a word kernel, whether the kernel is fixed
+ * at compile time (VectorizedIterateMap) or built at runtime (DynamicIterateMap).
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "bitmap_storage.h"
+#include "checkpoint.h"
+#include "map_def.h"
+#include "progress.h"
+#include "scheduler.h"
+
+namespace Affine {
+    /**
+     * Everything around the kernel of an engine computing its bitmap a word at a time: the words before the
+     * kernel's first word, computed bit by bit; the tiling; the parallel schedule; and resuming from a checkpoint.
+     * K is the kernel as the engine sees it, providing
+     *
+     *   first_word(), tile_words(), last_source_word(w1), max_tile_end(w0)     as in Kernel::WordKernel
+     *   compute_tile(words, w0, w1, slot)      compute the words [w0, w1) of words in place, where slot is that
+     *                                          of the calling thread, in [0, thread_count)
+     *
+     * The engine's hooks: record(i, m) is called for every bit the prefix sets through map m, and publish(w) once
+     * the words before w are final.
+     */
+    template <typename K>
+        class WordDriver {
+            K& kernel;
+            BitmapStorage& words;
+            std::span<const coefficient_pair> coeffs;
+
+            bool get_bit(int64_t i) const {
+                return (words.data()[i >> 6] >> (i & 63)) & 1;
+            }
+
+            void set_bit(int64_t i) {
+                words.data()[i >> 6] |= uint64_t{1} << (i & 63);
+            }
+
+            // Compute the bits before the kernel's first word directly, repeating until nothing changes since
+            // small values can depend on larger ones (e.g. 2x-2 maps 1 to 0)
+            template <typename Record>
+                void compute_prefix(Record record) {
+                    const int64_t end = kernel.first_word() * 64;
+
+                    bool changed = true;
+                    while (changed) {
+                        changed = false;
+
+                        for (int64_t i = 0; i < end; ++i) {
+                            if (get_bit(i)) continue;
+
+                            for (int m = 0; m < (int)coeffs.size(); ++m) {
+                                int64_t a = coeffs[m].first;
+                                int64_t b = coeffs[m].second;
+
+                                int64_t k = i - b;
+                                if (k >= 0 && k % a == 0 && get_bit(k / a)) {
+                                    set_bit(i);
+                                    record(i, m);
+                                    changed = true;
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                }
+
+            // Compute the words [w, end) tile by tile, given that all words before w are final. Progress is credited
+            // to the given slot of the meter.
+            void compute_words(int64_t w, int64_t end, ProgressMeter* progress, int slot) {
+                while (w < end) {
+                    int64_t tile_end = std::min(end, kernel.max_tile_end(w));
+                    kernel.compute_tile(words.data(), w, tile_end, slot);
+
+                    if (progress) progress->add(slot, (tile_end - w) * 64);
+                    w = tile_end;
+                }
+            }
+
+            // Same as compute_words, but in blocks of parallel_block_words, publishing after each
+            template <typename Publish>
+                void compute_words_published(int64_t w, int64_t end, ProgressMeter* progress, Publish& publish) {
+                    while (w < end) {
+                        int64_t block_end = std::min(end, (w / parallel_block_words + 1) * parallel_block_words);
+
+                        compute_words(w, block_end, progress, 0);
+                        publish(block_end);
+                        w = block_end;
+                    }
+                }
+
+            // Same as compute_words_published, but blocks are handed out to the thread pool as soon as the words
+            // they read are final, without waiting for the rest of their doubling wave
+            template <typename Publish>
+                void compute_words_parallel(int64_t w, int64_t end, int thread_count, ProgressMeter* progress,
+                        Publish& publish) {
+                    const int64_t B = parallel_block_words;
+                    int64_t start = std::max(parallel_start, (w + B - 1) / B * B);
+
+                    if (start >= end) {
+                        compute_words_published(w, end, progress, publish);
+                        return;
+                    }
+
+                    compute_words_published(w, start, progress, publish);
+
+                    auto block_end = [&] (int64_t b) {
+                        return std::min(start + (b + 1) * B, end);
+                    };
+
+                    WatermarkScheduler scheduler{(end - start + B - 1) / B};
+                    scheduler.run(ThreadPool::shared(), thread_count, [&] (int64_t b) -> int64_t {
+                        int64_t last = kernel.last_source_word(block_end(b));
+                        return (last < start) ? 0 : (last - start) / B + 1;
+                    }, [&] (int64_t b, int slot) {
+                        compute_words(start + b * B, block_end(b), progress, slot);
+
+                        // Lags by the blocks still in flight; compute publishes the rest when it returns
+                        publish(std::min(start + scheduler.completed() * B, end));
+                    });
+                }
+
+            static int64_t first_parallel_start(const K& kernel, int64_t B) {
+                int64_t w = B;
+                while (kernel.last_source_word(w + B) >= w) w += B;
+                return w;
+            }
+        public:
+            // Words per block handed out by the scheduler when computing with threads
+            const int64_t parallel_block_words;
+            // First block boundary from which every block only reads words before its own start
+            const int64_t parallel_start;
+            // Below this many remaining words, threads aren't worth waking up
+            const int64_t parallel_threshold_words;
+
+            WordDriver(K& kernel, BitmapStorage& words, std::span<const coefficient_pair> coeffs) :
+                    kernel(kernel), words(words), coeffs(coeffs), parallel_block_words(4 * kernel.tile_words()),
+                    parallel_start(first_parallel_start(kernel, parallel_block_words)),
+                    parallel_threshold_words(16 * parallel_block_words) {
+
+            }
+
+            /**
+             * Prepare to compute the words up to end from a bitmap computed up to max_reached: the first time, seed
+             * the initial values and compute the prefix. Returns the first word left to compute; partially computed
+             * words are simply recomputed.
+             */
+            template <typename Record>
+                int64_t begin(int64_t max_reached, int64_t end, const std::vector<int64_t>& initial_values,
+                        Record record) {
+                    words.ensure(std::max(end, kernel.first_word()));
+
+                    if (max_reached == -1) {
+                        for (int64_t i : initial_values) {
+                            words.ensure((i >> 6) + 1);
+                            set_bit(i);
+                        }
+
+                        compute_prefix(record);
+                    }
+
+                    return std::max(kernel.first_word(), (max_reached + 1) >> 6);
+                }
+
+            /**
+             * Compute the words [w, end), with threads if thread_count > 1 and there are enough of them
+             */
+            template <typename Publish>
+                void compute(int64_t w, int64_t end, int thread_count, ProgressMeter* progress, Publish publish) {
+                    if (thread_count > 1 && end - w >= parallel_threshold_words) {
+                        compute_words_parallel(w, end, thread_count, progress, publish);
+                    } else {
+                        compute_words_published(w, end, progress, publish);
+                    }
+                }
+
+            /**
+             * Map the bitmap of a checkpoint, whose metadata has been read and checked, and restore what it doesn't
+             * store (see Checkpoint::restore_unsaved)
+             */
+            void load(Checkpoint::File& file, const Checkpoint::Contents& contents) {
+                words.reset();
+                words.map_file(file.descriptor(), contents.header.bitmap_offset, contents.header.bitmap_bytes);
+                words.ensure(kernel.first_word());
+
+                Checkpoint::restore_unsaved(contents.header.max_reached, contents.initial_values,
+                        kernel.first_word() * 64, [&] (int64_t i) {
+                    words.ensure((i >> 6) + 1);
+                    set_bit(i);
+                }, [&] { compute_prefix([] (int64_t, int) {}); });
+            }
+        };
+}
@@ -0,0 +1,396 @@
+/**
+ * Word-level propagation kernel shared by the faster iterate map engines.
+ *
+ * The bitmap is stored as little-endian 64-bit words (bit n lives in word n / 64 at position n % 64). For a map
+ * ax+b, let S_a be the "spread" stream of the bitmap, where bit a*j of S_a is bit j of the bitmap. The contribution
+ * of the map to output word w is then bits [64w - b, 64w - b + 64) of S_a, i.e. a funnel shift of two consecutive
+ * S_a words at a constant offset. Maps sharing the same a share the same S_a words, so each tile first spreads its
+ * source window once per distinct a and then ORs the shifted words together.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <immintrin.h>
+
+#include "map_def.h"
+
+namespace Affine {
+    namespace Kernel {
+        // Every third bit, starting at bits 0, 2 and 1 respectively (the a = 3 masks of misc/m.cc)
+        constexpr uint64_t BIT_MASK_1 = 0x9249249249249249ULL;
+        constexpr uint64_t BIT_MASK_2 = BIT_MASK_1 >> 1;
+        constexpr uint64_t BIT_MASK_3 = BIT_MASK_1 >> 2;
+
+        // Maximum number of output words computed per tile
+        constexpr int64_t TILE_WORDS = 1024;
+
+        inline uint64_t pdep(uint64_t src, uint64_t mask) {
+#ifdef __BMI2__
+            return _pdep_u64(src, mask);
+#else
+            uint64_t result = 0;
+            for (uint64_t bit = 1; mask; bit <<= 1) {
+                if (src & bit) result |= mask & -mask;
+                mask &= mask - 1;
+            }
+            return result;
+#endif
+        }
+
+        // Spread the 64 bits of x to the even bits of the 128-bit result
+        inline void spread2(uint64_t x, uint64_t& lo, uint64_t& hi) {
+#ifdef __PCLMUL__
+            // Carry-less squaring of x is exactly x with zeros interleaved
+            __m128i v = _mm_cvtsi64_si128(x);
+            __m128i sq = _mm_clmulepi64_si128(v, v, 0x0);
+
+            lo = _mm_cvtsi128_si64(sq);
+            hi = _mm_cvtsi128_si64(_mm_unpackhi_epi64(sq, sq));
+#else
+            auto spread_half = [] (uint64_t v) {
+                v = (v | (v << 16)) & 0x0000FFFF0000FFFFULL;
+                v = (v | (v << 8)) & 0x00FF00FF00FF00FFULL;
+                v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+                v = (v | (v << 2)) & 0x3333333333333333ULL;
+                v = (v | (v << 1)) & 0x5555555555555555ULL;
+                return v;
+            };
+
+            lo = spread_half(x & 0xFFFFFFFFULL);
+            hi = spread_half(x >> 32);
+#endif
+        }
+
+        /**
+         * Generator for the words of S_a. fill() writes S_a[k] for k in [k0, k1) to buf[0..k1-k0), reading the
+         * source words of the bitmap in src, which holds source word origin at index 0. Words with k < 0 are zero.
+         *
+         * Every a consecutive words of S_a are built from exactly one source word, so the generic version keeps a
+         * constexpr table of (shift, PDEP mask) pairs for the a phases and unrolls a whole period at a time.
+         */
+        template <int a>
+            struct SpreadStream {
+                struct Phase {
+                    // First source bit (relative to the source word) landing in this word
+                    int shift;
+                    // Positions of the source bits in this word; zero if none land here
+                    uint64_t mask;
+                };
+
+                static constexpr std::array<Phase, a> phases = [] {
+                    std::array<Phase, a> t{};
+
+                    for (int f = 0; f < a; ++f) {
+                        int first = (64 * f + a - 1) / a;
+
+                        uint64_t mask = 0;
+                        for (int p = a * first - 64 * f; p < 64; p += a) mask |= uint64_t{1} << p;
+
+                        t[f] = { (mask == 0) ? 0 : first, mask };
+                    }
+
+                    return t;
+                }();
+
+                static constexpr int64_t last_source_word(int64_t k) {
+                    return (k < 0) ? -1 : k / a;
+                }
+
+                template <int f>
+                    static inline uint64_t phase(uint64_t s) {
+                        if constexpr (phases[f].mask == 0) {
+                            return 0;
+                        } else {
+                            return pdep(s >> phases[f].shift, phases[f].mask);
+                        }
+                    }
+
+                static inline uint64_t word(const uint64_t* src, int64_t k, int64_t origin) {
+                    const Phase& p = phases[k % a];
+                    return (p.mask == 0) ? 0 : pdep(src[k / a - origin] >> p.shift, p.mask);
+                }
+
+                static void fill(const uint64_t* src, uint64_t* buf, int64_t k0, int64_t k1, int64_t origin = 0) {
+                    int64_t k = k0;
+
+                    for (; k < k1 && k < 0; ++k) buf[k - k0] = 0;
+                    for (; k < k1 && k % a != 0; ++k) buf[k - k0] = word(src, k, origin);
+
+                    for (; k + a <= k1; k += a) {
+                        uint64_t s = src[k / a - origin];
+                        uint64_t* out = buf + (k - k0);
+
+                        [&]<std::size_t... F>(std::index_sequence<F...>) {
+                            ((out[F] = phase<F>(s)), ...);
+                        }(std::make_index_sequence<a>{});
+                    }
+
+                    for (; k < k1; ++k) buf[k - k0] = word(src, k, origin);
+                }
+            };
+
+        // The generated table for a = 3 is exactly the hand-written spread of misc/m.cc
+        static_assert(SpreadStream<3>::phases[0].mask == BIT_MASK_1 && SpreadStream<3>::phases[0].shift == 0);
+        static_assert(SpreadStream<3>::phases[1].mask == BIT_MASK_2 && SpreadStream<3>::phases[1].shift == 22);
+        static_assert(SpreadStream<3>::phases[2].mask == BIT_MASK_3 && SpreadStream<3>::phases[2].shift == 43);
+
+        // Spreading by 2 is a carry-less squaring, which produces two words per instruction
+        template <>
+            struct SpreadStream<2> {
+                static constexpr int64_t last_source_word(int64_t k) {
+                    return (k < 0) ? -1 : k / 2;
+                }
+
+                static void fill(const uint64_t* src, uint64_t* buf, int64_t k0, int64_t k1, int64_t origin = 0) {
+                    int64_t k = k0;
+
+                    for (; k < k1 && k < 0; ++k) buf[k - k0] = 0;
+
+                    uint64_t lo, hi;
+                    if (k < k1 && (k & 1)) {
+                        spread2(src[(k >> 1) - origin], lo, hi);
+                        buf[k++ - k0] = hi;
+                    }
+
+                    for (; k + 1 < k1; k += 2) {
+                        spread2(src[(k >> 1) - origin], buf[k - k0], buf[k - k0 + 1]);
+                    }
+
+                    if (k < k1) {
+                        spread2(src[(k >> 1) - origin], lo, hi);
+                        buf[k - k0] = lo;
+                    }
+                }
+            };
+
+        template <int a>
+            concept HasSpreadStream = requires (const uint64_t* src, uint64_t* buf) {
+                SpreadStream<a>::fill(src, buf, int64_t{}, int64_t{});
+            };
+
+        template <AffineMapSet Maps>
+            constexpr bool has_word_kernel() {
+                return []<std::size_t... I>(std::index_sequence<I...>) {
+                    return (HasSpreadStream<Maps.get_coeffs()[I].first> && ...);
+                }(std::make_index_sequence<Maps.map_count>{});
+            }
+
+        /**
+         * Word kernel for a fixed map set. All offsets are computed at compile time so that the inner loop is
+         * a sequence of loads, immediate shifts and ORs that the compiler can vectorize.
+         */
+        template <AffineMapSet Maps>
+            struct WordKernel {
+                static constexpr auto coeffs = Maps.get_coeffs();
+                static constexpr std::size_t map_count = coeffs.size();
+
+                static constexpr int64_t floor_div(int64_t x, int64_t y) {
+                    return (x >= 0) ? x / y : -((-x + y - 1) / y);
+                }
+
+                // Output word w of map i is the funnel shift of S_a[w + word_offset(i)] and the next word by
+                // bit_offset(i)
+                static constexpr int64_t word_offset(std::size_t i) {
+                    return floor_div(-coeffs[i].second, 64);
+                }
+
+                static constexpr int bit_offset(std::size_t i) {
+                    return static_cast<int>(-coeffs[i].second - 64 * word_offset(i));
+                }
+
+                static constexpr std::size_t distinct_count() {
+                    std::size_t n = 0;
+                    for (std::size_t i = 0; i < map_count; ++i) {
+                        bool seen = false;
+                        for (std::size_t j = 0; j < i; ++j) seen |= coeffs[j].first == coeffs[i].first;
+                        n += !seen;
+                    }
+                    return n;
+                }
+
+                // Sorted distinct linear coefficients; one spread buffer is kept per entry
+                static constexpr auto distinct = [] {
+                    std::array<int, distinct_count()> d{};
+                    std::size_t n = 0;
+
+                    for (std::size_t i = 0; i < map_count; ++i) {
+                        if (std::find(d.begin(), d.begin() + n, coeffs[i].first) == d.begin() + n) {
+                            d[n++] = coeffs[i].first;
+                        }
+                    }
+
+                    std::sort(d.begin(), d.end());
+                    return d;
+                }();
+
+                static constexpr std::size_t buffer_index(std::size_t i) {
+                    return std::find(distinct.begin(), distinct.end(), coeffs[i].first) - distinct.begin();
+                }
+
+                // Range of word offsets used by the maps sharing the d-th distinct coefficient
+                static constexpr int64_t min_offset(std::size_t d) {
+                    int64_t m = INT64_MAX;
+                    for (std::size_t i = 0; i < map_count; ++i)
+                        if (buffer_index(i) == d) m = std::min(m, word_offset(i));
+                    return m;
+                }
+
+                static constexpr int64_t max_offset(std::size_t d) {
+                    int64_t m = INT64_MIN;
+                    for (std::size_t i = 0; i < map_count; ++i)
+                        if (buffer_index(i) == d) m = std::max(m, word_offset(i));
+                    return m;
+                }
+
+                static constexpr int64_t gcd(int64_t x, int64_t y) {
+                    return (y == 0) ? x : gcd(y, x % y);
+                }
+
+                /**
+                 * Number of words after which the phases of all spread streams repeat (the analogue of the 1536-bit
+                 * block of misc/m.cc). Tiles are aligned to it whenever it fits, so that every tile sees the same
+                 * head and tail pattern in SpreadStream::fill.
+                 */
+                static constexpr int64_t block_words = [] {
+                    int64_t l = 1;
+                    for (int a : distinct) l = l / gcd(l, a) * a;
+                    return l;
+                }();
+
+                static constexpr int64_t tile_words = (block_words <= TILE_WORDS)
+                    ? TILE_WORDS / block_words * block_words : TILE_WORDS;
+
+                static constexpr int64_t BUFFER_WORDS = tile_words + 16;
+
+                /**
+                 * Last source word read when computing the output words [w0, w1)
+                 */
+                static constexpr int64_t last_source_word(int64_t w1) {
+                    return []<std::size_t... D>(int64_t w1, std::index_sequence<D...>) {
+                        return std::max({ SpreadStream<distinct[D]>::last_source_word(w1 + max_offset(D))... });
+                    }(w1, std::make_index_sequence<distinct.size()>{});
+                }
+
+                /**
+                 * Largest w1 such that the tile [w0, w1) only reads words below w0, capped at the next multiple of
+                 * the tile size
+                 */
+                static constexpr int64_t max_tile_end(int64_t w0) {
+                    int64_t lo = w0, hi = (w0 / tile_words + 1) * tile_words;
+
+                    while (lo < hi) {
+                        int64_t mid = (lo + hi + 1) / 2;
+                        if (last_source_word(mid) < w0) lo = mid; else hi = mid - 1;
+                    }
+
+                    return lo;
+                }
+
+                /**
+                 * First word from which tiles can be computed by the kernel. Words before it must be computed bit by
+                 * bit, since their bits may depend on bits of the same word.
+                 */
+                static constexpr int64_t first_word = [] {
+                    int64_t w = 1;
+                    while (max_tile_end(w) <= w) ++w;
+                    return w;
+                }();
+
+                /**
+                 * Compute the output words [w0, w1) from the bitmap in src, ORing word w0 + j into out[j]. Requires
+                 * w0 >= first_word and w1 <= max_tile_end(w0); out may point into src or into a separate buffer.
+                 *
+                 * With provenance planes (see ProvenanceIndex), the index of the first map producing each bit is
+                 * ORed into planes[k][j] as well.
+                 */
+                template <std::size_t P = 0>
+                    static void compute_tile(const uint64_t* src, uint64_t* out, int64_t w0, int64_t w1,
+                            const std::array<uint64_t*, P>& planes = {}) {
+                        uint64_t buffers[distinct.size()][BUFFER_WORDS];
+
+                        [&]<std::size_t... D>(std::index_sequence<D...>) {
+                            (SpreadStream<distinct[D]>::fill(src, buffers[D], w0 + min_offset(D),
+                                                             w1 + max_offset(D) + 1), ...);
+                        }(std::make_index_sequence<distinct.size()>{});
+
+                        combine(buffers, out, w0, w1, planes);
+                    }
+
+                /**
+                 * Source words [first, end) read by the maps sharing the d-th distinct coefficient when computing the
+                 * output words [w0, w1); empty if they only read words before 0
+                 */
+                static constexpr std::pair<int64_t, int64_t> source_window(std::size_t d, int64_t w0, int64_t w1) {
+                    int64_t k0 = std::max<int64_t>(w0 + min_offset(d), 0), k1 = w1 + max_offset(d) + 1;
+                    return { k0 / distinct[d], (k1 <= k0) ? k0 / distinct[d] : (k1 - 1) / distinct[d] + 1 };
+                }
+
+                /**
+                 * Same as compute_tile, but the source words of the d-th distinct coefficient are read from
+                 * sources[d], which holds word origins[d] at index 0 and must cover source_window(d, w0, w1). This
+                 * lets an engine keep only those windows in memory.
+                 */
+                static void compute_tile(const std::array<const uint64_t*, distinct.size()>& sources,
+                        const std::array<int64_t, distinct.size()>& origins, uint64_t* out, int64_t w0, int64_t w1) {
+                    uint64_t buffers[distinct.size()][BUFFER_WORDS];
+
+                    [&]<std::size_t... D>(std::index_sequence<D...>) {
+                        (SpreadStream<distinct[D]>::fill(sources[D], buffers[D], w0 + min_offset(D),
+                                                         w1 + max_offset(D) + 1, origins[D]), ...);
+                    }(std::make_index_sequence<distinct.size()>{});
+
+                    combine(buffers, out, w0, w1, std::array<uint64_t*, 0>{});
+                }
+
+                // OR the shifted spread words of every map into out[0..w1-w0)
+                template <std::size_t P>
+                    static inline void combine(const uint64_t (&buffers)[distinct.size()][BUFFER_WORDS], uint64_t* out,
+                            int64_t w0, int64_t w1, const std::array<uint64_t*, P>& planes) {
+                        [&]<std::size_t... I>(std::index_sequence<I...>) {
+                            const uint64_t* src[map_count] = {
+                                (buffers[buffer_index(I)] + word_offset(I) - min_offset(buffer_index(I)))...
+                            };
+
+                            for (int64_t j = 0; j < w1 - w0; ++j) {
+                                uint64_t acc = 0;
+
+                                if constexpr (P == 0) {
+                                    ((acc |= funnel<bit_offset(I)>(src[I] + j)), ...);
+                                } else {
+                                    uint64_t plane_bits[P] = {};
+                                    (record<I, P>(funnel<bit_offset(I)>(src[I] + j), acc, plane_bits), ...);
+
+                                    for (std::size_t k = 0; k < P; ++k) planes[k][j] |= plane_bits[k];
+                                }
+
+                                out[j] |= acc;
+                            }
+                        }(std::make_index_sequence<map_count>{});
+                    }
+
+                // Add the bits produced by map I to acc, recording I in the planes for those not produced before
+                template <std::size_t I, std::size_t P>
+                    static inline void record(uint64_t produced, uint64_t& acc, uint64_t (&plane_bits)[P]) {
+                        uint64_t fresh = produced & ~acc;
+                        acc |= produced;
+
+                        for (std::size_t k = 0; k < P; ++k) {
+                            if ((I >> k) & 1) plane_bits[k] |= fresh;
+                        }
+                    }
+
+                template <int r>
+                    static inline uint64_t funnel(const uint64_t* p) {
+                        if constexpr (r == 0) {
+                            return p[0];
+                        } else {
+                            return (p[0] >> r) | (p[1] << (64 - r));
+                        }
+                    }
+            };
+    }
+}